@@ -30,12 +30,16 @@
 #include <stdarg.h>     // vprintf, va_list
 #include <assert.h>
 #include <string>
+#include <algorithm>    // std::upper_bound
+#include <atomic>
 
 #include <FL/Fl.H>
 #include <FL/Fl_Terminal.H>
 #include <FL/fl_utf8.h> // fl_utf8len1
 #include <FL/fl_draw.H>
 #include <FL/fl_string_functions.h>
+#include <FL/Fl_Text_Regex.H>
+#include "Fl_System_Driver.H"   // sleep_ms()
 
 /////////////////////////////////
 ////// Static Functions /////////
@@ -606,7 +610,7 @@ void Fl_Terminal::Utf8Char::text_utf8(const char *text,
 //
 void Fl_Terminal::Utf8Char::text_ascii(char c, const CharStyle& style) {
   // Signed char vals above 0x7f are /negative/, so <0x20 check covers those
-  if (c < 0x20 || c >= 0x7e) return;           // ASCII non-printable?
+  if (c < 0x20 || c > 0x7e) return;            // ASCII non-printable?
   text_utf8(&c, 1, style);
 }
 
@@ -682,6 +686,209 @@ Fl_Color Fl_Terminal::Utf8Char::attr_bg_color(const Fl_Widget *grp) const {
 }
 
 
+//////////////////////////////////////
+///// StyleTable Class Methods ///////
+//////////////////////////////////////
+
+// Ctor
+Fl_Terminal::StyleTable::StyleTable(void) {
+  clear();
+}
+
+// Remove all styles, except style #0 for a default Utf8Char
+void Fl_Terminal::StyleTable::clear(void) {
+  styles_.clear();
+  hash_.assign(64, 0);
+  Utf8Char u8c;
+  intern(u8c);
+}
+
+// Hash function for the style table
+unsigned Fl_Terminal::StyleTable::hash(const Style& s) {
+  unsigned h = s.attrib | (s.charflags << 8);
+  h = (h * 0x9e3779b1u) ^ unsigned(s.fgcolor);
+  h = (h * 0x85ebca6bu) ^ unsigned(s.bgcolor);
+  h *= 0xc2b2ae35u;
+  return h ^ (h >> 15);
+}
+
+// Return the style# of style 's', adding it to the table if needed
+int Fl_Terminal::StyleTable::intern(const Style& s) {
+  unsigned mask = unsigned(hash_.size()) - 1;
+  unsigned i = hash(s) & mask;
+  for (; hash_[i]; i = (i + 1) & mask) {         // walk the probe sequence
+    const Style &o = styles_[hash_[i] - 1];
+    if (o.attrib == s.attrib && o.charflags == s.charflags &&
+        o.fgcolor == s.fgcolor && o.bgcolor == s.bgcolor)
+      return hash_[i] - 1;                       // found
+  }
+  styles_.push_back(s);
+  int index = int(styles_.size()) - 1;
+  if (styles_.size() * 2 <= hash_.size()) {      // still room in hash table?
+    hash_[i] = index + 1;
+  } else {                                       // half full? double size, rehash all
+    hash_.assign(hash_.size() * 2, 0);
+    mask = unsigned(hash_.size()) - 1;
+    for (int n = 0; n < int(styles_.size()); n++) {
+      for (i = hash(styles_[n]) & mask; hash_[i]; i = (i + 1) & mask) { }
+      hash_[i] = n + 1;
+    }
+  }
+  return index;
+}
+
+// Return the style# for the attributes and colors of char 'u8c'
+int Fl_Terminal::StyleTable::intern(const Utf8Char& u8c) {
+  Style s;
+  s.attrib    = u8c.attrib_;
+  s.charflags = u8c.charflags_;
+  s.fgcolor   = u8c.fgcolor_;
+  s.bgcolor   = u8c.bgcolor_;
+  return intern(s);
+}
+
+// Set the attributes and colors of char 'u8c' to style# 'index'
+void Fl_Terminal::StyleTable::apply(int index, Utf8Char& u8c) const {
+  const Style &s = styles_[index];
+  u8c.attrib_    = s.attrib;
+  u8c.charflags_ = s.charflags;
+  u8c.fgcolor_   = s.fgcolor;
+  u8c.bgcolor_   = s.bgcolor;
+}
+
+/////////////////////////////////////
+///// PackedRow Class Methods ///////
+/////////////////////////////////////
+
+// PackedRow::data_ is a malloc'd block starting with these ints, followed
+// by 'nruns' pairs of ints (#chars, style#), and 'nbytes' bytes of UTF-8 text.
+// If 'lengths' is set, each char in the text is preceded by its byte length,
+// because it wasn't a single UTF-8 encoded char, e.g. a custom error_char().
+//
+enum { PR_NCHARS, PR_NRUNS, PR_NBYTES, PR_LENGTHS, PR_HEADER };
+
+// Return true if chars 'a' and 'b' have the same attributes and colors
+bool Fl_Terminal::PackedRow::same_style(const Utf8Char& a, const Utf8Char& b) {
+  return a.attrib() == b.attrib() && a.charflags() == b.charflags() &&
+         a.fgcolor() == b.fgcolor() && a.bgcolor() == b.bgcolor();
+}
+
+// Dtor
+Fl_Terminal::PackedRow::~PackedRow(void) {
+  if (data_) free(data_);
+}
+
+// Make the row all blanks with style# 'blank', for 'cols' columns
+void Fl_Terminal::PackedRow::clear(int blank, int cols) {
+  if (data_) { free(data_); data_ = 0; }
+  blank_ = blank;
+  cols_  = cols;
+}
+
+// Exchange contents with another packed row
+void Fl_Terminal::PackedRow::swap(PackedRow& o) {
+  uchar *d = data_;  data_  = o.data_;  o.data_  = d;
+  int    b = blank_; blank_ = o.blank_; o.blank_ = b;
+  int    c = cols_;  cols_  = o.cols_;  o.cols_  = c;
+}
+
+// Pack 'cols' chars starting at 'u8c', adding their styles to 'styles'
+void Fl_Terminal::PackedRow::pack(const Utf8Char *u8c, int cols, StyleTable& styles) {
+  clear(0, cols);
+  if (cols <= 0) return;
+  // Trailing blanks: spaces in the same style as the last char
+  int nchars = cols;
+  if (u8c[cols-1].is_char(' ') && u8c[cols-1].length() == 1) {
+    blank_ = styles.intern(u8c[cols-1]);
+    while (nchars > 0 && u8c[nchars-1].is_char(' ') && u8c[nchars-1].length() == 1 &&
+           same_style(u8c[nchars-1], u8c[cols-1]))
+      nchars--;
+  }
+  if (nchars == 0) return;                      // all blanks? no data needed
+  // Count style runs and bytes of text
+  int nruns = 0, nbytes = 0, lengths = 0;
+  for (int col=0; col<nchars; col++) {
+    const Utf8Char &c = u8c[col];
+    if (col == 0 || !same_style(c, u8c[col-1])) nruns++;
+    if (c.length() == 1) {                        // ASCII? (checked first, it's most common)
+      if (uchar(c.text_[0]) >= 0x80) lengths = 1;
+    } else if (c.length() != fl_utf8len(c.text_[0])) {
+      lengths = 1;
+    }
+    nbytes += c.length();
+  }
+  if (lengths) nbytes += nchars;
+  data_ = (uchar*)malloc(sizeof(int) * (PR_HEADER + 2*nruns) + nbytes);
+  int *hdr = (int*)data_;
+  hdr[PR_NCHARS]  = nchars;
+  hdr[PR_NRUNS]   = nruns;
+  hdr[PR_NBYTES]  = nbytes;
+  hdr[PR_LENGTHS] = lengths;
+  int   *run  = hdr + PR_HEADER - 2;
+  uchar *text = (uchar*)(hdr + PR_HEADER + 2*nruns);
+  for (int col=0; col<nchars; col++) {
+    const Utf8Char &c = u8c[col];
+    if (col == 0 || !same_style(c, u8c[col-1])) {  // new run?
+      run += 2;
+      run[0] = 0;
+      run[1] = styles.intern(c);
+    }
+    run[0]++;
+    if (lengths) *text++ = uchar(c.length());
+    if (c.length() == 1) *text++ = uchar(c.text_[0]);
+    else { memcpy(text, c.text_, c.length()); text += c.length(); }
+  }
+}
+
+// Unpack the row into 'cols' chars starting at 'u8c', using styles from 'styles'
+void Fl_Terminal::PackedRow::unpack(Utf8Char *u8c, int cols, const StyleTable& styles) const {
+  int col = 0;
+  if (data_) {
+    const int   *hdr  = (const int*)data_;
+    const int   *run  = hdr + PR_HEADER;
+    const uchar *text = (const uchar*)(run + 2*hdr[PR_NRUNS]);
+    for (int r=0; r<hdr[PR_NRUNS] && col<cols; r++, run+=2) {
+      for (int n=0; n<run[0] && col<cols; n++, col++) {
+        int len = hdr[PR_LENGTHS] ? *text++ : (*text < 0x80) ? 1 : fl_utf8len(char(*text));
+        u8c[col].text_utf8_((const char*)text, len);
+        styles.apply(run[1], u8c[col]);
+        text += len;
+      }
+    }
+  }
+  for (; col<cols && col<cols_; col++) {        // trailing blanks
+    u8c[col].text_utf8_(" ", 1);
+    styles.apply(blank_, u8c[col]);
+  }
+  for (; col<cols; col++) {                     // beyond packed columns
+    u8c[col].text_utf8_(" ", 1);
+    styles.apply(0, u8c[col]);
+  }
+}
+
+// Change the style#s of the row from table 'from' to table 'to'.
+//    'newindex' maps style#s of 'from' to 'to', -1 if not added to 'to' yet.
+//
+void Fl_Terminal::PackedRow::remap_styles(std::vector<int>& newindex,
+                                          const StyleTable& from, StyleTable& to) {
+  if (newindex[blank_] < 0) newindex[blank_] = to.intern(from, blank_);
+  blank_ = newindex[blank_];
+  if (!data_) return;
+  int *hdr = (int*)data_;
+  int *run = hdr + PR_HEADER;
+  for (int r=0; r<hdr[PR_NRUNS]; r++, run+=2) {
+    if (newindex[run[1]] < 0) newindex[run[1]] = to.intern(from, run[1]);
+    run[1] = newindex[run[1]];
+  }
+}
+
+// Return #bytes of memory used by the packed data
+int Fl_Terminal::PackedRow::nbytes(void) const {
+  if (!data_) return 0;
+  const int *hdr = (const int*)data_;
+  return int(sizeof(int) * (PR_HEADER + 2*hdr[PR_NRUNS])) + hdr[PR_NBYTES];
+}
+
 ////////////////////////////////////
 ///// RingBuffer Class Methods /////
 ////////////////////////////////////
@@ -701,72 +908,91 @@ void Fl_Terminal::RingBuffer::offset_adjust(int rows) {
   }
 }
 
-// Create a new copy of the buffer with different row/col sizes
-//   Preserves old contents of display and history in use.
+// Change the ring to hold 'rows' rows, preserving the rows at the bottom.
+//   Rows are kept in order, working up from the last row of the display;
+//   if the ring shrinks, the rows at the top of the history are dropped.
+//   If the ring grows, the new rows are added above the history, and
+//   can't be in use. The rows aren't copied, just their pointers, and
+//   the new ring starts at index 0 (offset_ is changed accordingly).
 //
-//   The old buffer might have an offset and the hist/disp might wrap
-//   around the end of the ring. The NEW buffer's offset will be zero,
-//   so the hist/disp do NOT wrap around, making the move operation easier to debug.
+//   'rows' may be larger than hist_rows_ + disp_rows_, the extra rows are
+//   spare rows between the bottom of the display and the top of the history,
+//   so the display can be enlarged later without changing the ring again.
 //
-//   The copy preservation starts at the LAST ROW in display of both old (src) and new (dst)
-//   buffers, and copies rows in reverse until hist_use_srow() reached, or if we hit top
-//   of the new history (index=0), which ever comes first. So in the following where the
-//   display is being enlarged, the copy preservation starts at "Line 5" (bottom of display)
-//   and works upwards, ending at "Line 1" (top of history use):
-//
-//                   OLD (SRC)            NEW (DST)
-//                 _____________        _____________   ___
-//                | x x x x x x |      | x x x x x x |   ʌ                      'x' indicates
-//                | Line 1      | ─┐   | x x x x x x |   |  hist_rows           unused history
-//                | Line 2      |  └─> | Line 1      |   v                      buffer memory.
-//                |-------------|      |-------------|  ---
-//                | Line 3      |      | Line 2      |   ʌ
-//                | Line 4      |      | Line 3      |   |
-//                | Line 5      | ─┐   | Line 4      |   |  disp_rows
-//                |_____________|  └─> | Line 5      |   |
-//                                     |_____________|  _v_
-//
-void Fl_Terminal::RingBuffer::new_copy(int drows, int dcols, int hrows, const CharStyle& style) {
-  (void)style;                                              // currently unused - need parameterized ctor (†)
-  // Create new buffer
-  int addhist       = disp_rows() - drows;                  // adjust history use
-  int new_ring_rows = (drows+hrows);
-  int new_hist_use  = clamp(hist_use_ + addhist, 0, hrows); // clamp incase new_hist_rows smaller than old
-  int new_nchars    = (new_ring_rows * dcols);
-  Utf8Char *new_ring_chars = new Utf8Char[new_nchars];      // Create new ring buffer (†)
-  // Preserve old contents in new buffer
-  int dst_cols      = dcols;
-  int src_stop_row  = hist_use_srow();
-  int tcols         = MIN(ring_cols(), dcols);
-  int src_row       = hist_use_srow() + hist_use_ + disp_rows_ - 1; // use row#s relative to hist_use_srow()
-  int dst_row       = new_ring_rows - 1;
-  // Copy rows: working up from bottom of disp, stop at top of hist
-  while ((src_row >= src_stop_row) && (dst_row >= 0)) {
-    Utf8Char *src = u8c_ring_row(src_row);
-    Utf8Char *dst = new_ring_chars + (dst_row*dst_cols);
-    for (int col=0; col<tcols; col++ ) *dst++ = *src++;
-    --src_row;
-    --dst_row;
+void Fl_Terminal::RingBuffer::resize_ring(int rows) {
+  Utf8Char **new_ring_chars = new Utf8Char*[rows];
+  PackedRow *new_packed     = new PackedRow[rows];
+  int bottom = offset_ + hist_rows_ + disp_rows_;       // one past the last display row
+  for (int r=0; r<rows; r++) {                          // r: #rows up from the bottom
+    int dst = rows - 1 - r;
+    if (r < ring_rows_) {
+      int src = normalize(bottom - 1 - r, ring_rows_);
+      new_ring_chars[dst] = ring_chars_[src];
+      ring_chars_[src] = 0;
+      new_packed[dst].swap(packed_[src]);
+    } else {
+      new_ring_chars[dst] = 0;                          // new rows are packed blank rows
+    }
   }
-  // Install new buffer: dump old, install new, adjust internals
-  if (ring_chars_) delete[] ring_chars_;
+  for (int row=0; row<ring_rows_; row++)                // dropped rows, if any
+    delete[] ring_chars_[row];
+  delete[] ring_chars_;
+  delete[] packed_;
   ring_chars_ = new_ring_chars;
-  ring_rows_  = new_ring_rows;
-  ring_cols_  = dcols;
-  nchars_     = new_nchars;
-  hist_rows_  = hrows;
-  hist_use_   = new_hist_use;
-  disp_rows_  = drows;
-  offset_     = 0;        // for new buffer, we used a zero offset
+  packed_     = new_packed;
+  ring_rows_  = rows;
+  offset_     = normalize(rows - hist_rows_ - disp_rows_, rows);
+  cache_clear();
+}
+
+// Change the number of columns to 'dcols'.
+//   Only the display rows are copied to rows of the new width. History rows
+//   are packed, and a packed row can be unpacked to any width: extra columns
+//   are cut off, missing columns are blank. History rows that were unpacked
+//   to be modified are packed first, so they don't need to be copied either.
+//   Lines are not reflowed: a line that was wrapped at the old width stays
+//   split over the same rows, and display row columns beyond a smaller width
+//   are discarded.
+//
+void Fl_Terminal::RingBuffer::resize_cols(int dcols) {
+  for (int row=0; row<ring_rows_; row++) {
+    if (!ring_chars_[row]) continue;                    // packed? any width is fine
+    if (!is_disp_ring_row(row)) { pack_row(row); continue; }
+    Utf8Char *u8c = new Utf8Char[dcols];
+    int tcols = MIN(ring_cols_, dcols);
+    for (int col=0; col<tcols; col++) u8c[col] = ring_chars_[row][col];
+    delete[] ring_chars_[row];
+    ring_chars_[row] = u8c;
+  }
+  for (int i=0; i<int(spare_.size()); i++)              // spares are the old width
+    delete[] spare_[i];
+  spare_.clear();
+  ring_cols_ = dcols;
+  delete[] cache_chars_;
+  cache_chars_ = new Utf8Char[cache_size_ * ring_cols_];
+  cache_clear();
+}
+
+// Delete all rows and the cache
+void Fl_Terminal::RingBuffer::clear_rows(void) {
+  for (int row=0; row<ring_rows_; row++)
+    delete[] ring_chars_[row];
+  for (int i=0; i<int(spare_.size()); i++)
+    delete[] spare_[i];
+  spare_.clear();
+  delete[] ring_chars_; ring_chars_ = 0;
+  delete[] packed_;     packed_ = 0;
+  delete[] cache_chars_; cache_chars_ = 0;
+  cache_clear();
 }
 
 // Clear the class, delete previous ring if any
 void Fl_Terminal::RingBuffer::clear(void) {
-  if (ring_chars_) delete[] ring_chars_; // dump our ring
-  ring_chars_ = 0;
+  clear_rows();                          // dump our ring
+  styles_.clear();
+  styles_gc_  = 4096;
   ring_rows_  = 0;
   ring_cols_  = 0;
-  nchars_     = 0;
   hist_rows_  = 0;
   hist_use_   = 0;
   disp_rows_  = 0;
@@ -778,16 +1004,35 @@ void Fl_Terminal::RingBuffer::clear_hist(void) {
   hist_use_ = 0;
 }
 
+// Clear all history rows using specified CharStyle 'style'
+void Fl_Terminal::RingBuffer::clear_hist_rows(const CharStyle& style) {
+  Utf8Char u8c;
+  u8c.clear(style);
+  int blank = styles_.intern(u8c);
+  for (int hrow=0; hrow<hist_rows_; hrow++) {
+    int row = hist_index(hrow);
+    if (ring_chars_[row]) { spare_.push_back(ring_chars_[row]); ring_chars_[row] = 0; }
+    packed_[row].clear(blank, ring_cols_);
+  }
+  cache_clear();
+}
+
 // Default ctor
 Fl_Terminal::RingBuffer::RingBuffer(void) {
-  ring_chars_ = 0;
+  ring_chars_  = 0;
+  packed_      = 0;
+  cache_chars_ = 0;
+  ring_rows_   = 0;
   clear();
 }
 
 // Ctor with specific sizes
 Fl_Terminal::RingBuffer::RingBuffer(int drows, int dcols, int hrows) {
   // Start with cleared buffer first..
-  ring_chars_ = 0;
+  ring_chars_  = 0;
+  packed_      = 0;
+  cache_chars_ = 0;
+  ring_rows_   = 0;
   clear();
   // ..then create.
   create(drows, dcols, hrows);
@@ -795,8 +1040,7 @@ Fl_Terminal::RingBuffer::RingBuffer(int drows, int dcols, int hrows) {
 
 // Dtor
 Fl_Terminal::RingBuffer::~RingBuffer(void) {
-  if (ring_chars_) delete[] ring_chars_;
-  ring_chars_ = NULL;
+  clear_rows();
 }
 
 // See if 'grow' is within the history buffer
@@ -833,8 +1077,7 @@ void Fl_Terminal::RingBuffer::move_disp_row(int src_row, int dst_row) {
 // Clear the display rows 'sdrow' thru 'edrow' inclusive using specified CharStyle 'style'
 void Fl_Terminal::RingBuffer::clear_disp_rows(int sdrow, int edrow, const CharStyle& style) {
   for (int drow=sdrow; drow<=edrow; drow++) {
-    int row = hist_rows_ + drow + offset_;
-    Utf8Char *u8c = u8c_ring_row(row);
+    Utf8Char *u8c = unpack_row(disp_index(drow), false);
     for (int col=0; col<disp_cols(); col++) u8c++->clear(style);
   }
 }
@@ -873,6 +1116,10 @@ void Fl_Terminal::RingBuffer::scroll(int rows, const CharStyle& style) {
     offset_adjust(rows);
     // Adjust hist_use, clamp to max
     hist_use_ = clamp(hist_use_ + rows, 0, hist_rows_);
+    // Pack the rows that scrolled into history
+    for (int hrow=MAX(hist_rows_-rows, 0); hrow<hist_rows_; hrow++)
+      pack_row(hist_index(hrow));
+    if (styles_.size() > styles_gc_) gc_styles();
     // Clear exposed lines at bottom
     int srow = (disp_rows() - rows) % disp_rows();
     int erow = disp_rows() - 1;
@@ -906,6 +1153,102 @@ void Fl_Terminal::RingBuffer::scroll(int rows, const CharStyle& style) {
   }
 }
 
+// Convert 'row' in the ring to an index into ring_chars_[] and packed_[]
+int Fl_Terminal::RingBuffer::ring_index(int row) const {
+  row = normalize(row, ring_rows());
+  assert(row >= 0 && row < ring_rows_);
+  return row;
+}
+
+// Convert 'hrow' in the history to an index into ring_chars_[] and packed_[]
+int Fl_Terminal::RingBuffer::hist_index(int hrow) const {
+  int rowi = normalize(hrow, hist_rows());
+  rowi = (rowi + offset_) % ring_rows_;
+  assert(rowi >= 0 && rowi <= ring_rows_);
+  return rowi;
+}
+
+// Convert 'hurow' in the history in use to an index into ring_chars_[] and packed_[]
+int Fl_Terminal::RingBuffer::hist_use_index(int hurow) const {
+  hurow = hurow % hist_use_;                // normalize indexing within history in use
+  hurow = hist_rows_ - hist_use_ + hurow;   // index hist_use rows from end history
+  hurow = (hurow + offset_) % ring_rows_;   // convert to absolute index in ring_chars_[]
+  assert(hurow >= 0 && hurow <= ring_rows_);
+  return hurow;
+}
+
+// Convert 'drow' in the display to an index into ring_chars_[] and packed_[]
+int Fl_Terminal::RingBuffer::disp_index(int drow) const {
+  int rowi = normalize(drow, disp_rows());
+  rowi = (hist_rows_ + rowi + offset_) % ring_rows_; // display starts at end of history
+  assert(rowi >= 0 && rowi <= ring_rows_);
+  return rowi;
+}
+
+// Return the chars of ring row index 'row' for reading.
+//    Packed rows are unpacked into the cache; the returned pointer
+//    stays valid until cache_size_ other packed rows have been read.
+//
+const Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::read_row(int row) const {
+  if (ring_chars_[row]) return ring_chars_[row];
+  for (int i=0; i<cache_size_; i++)                // already cached?
+    if (cache_row_[i] == row) return cache_chars_ + i * ring_cols_;
+  int i = cache_next_;                             // replace oldest entry
+  cache_next_ = (cache_next_ + 1) % cache_size_;
+  cache_row_[i] = row;
+  Utf8Char *u8c = cache_chars_ + i * ring_cols_;
+  packed_[row].unpack(u8c, ring_cols_, styles_);
+  return u8c;
+}
+
+// Forget all cached rows
+void Fl_Terminal::RingBuffer::cache_clear(void) const {
+  for (int i=0; i<cache_size_; i++) cache_row_[i] = -1;
+  cache_next_ = 0;
+}
+
+// Return an array for a row of chars, reusing a spare one if possible
+Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::new_row(void) {
+  if (spare_.empty()) return new Utf8Char[ring_cols_];
+  Utf8Char *u8c = spare_.back();
+  spare_.pop_back();
+  return u8c;
+}
+
+// Make sure ring row index 'row' is unpacked so it can be modified, and return its chars.
+//    If 'keep' is false, the caller overwrites all the chars, and the contents
+//    of a packed row are not unpacked.
+//
+Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::unpack_row(int row, bool keep) {
+  if (ring_chars_[row]) return ring_chars_[row];
+  Utf8Char *u8c = new_row();
+  if (keep) packed_[row].unpack(u8c, ring_cols_, styles_);
+  packed_[row].clear();
+  ring_chars_[row] = u8c;
+  cache_clear();
+  return u8c;
+}
+
+// Pack ring row index 'row', if it isn't already
+void Fl_Terminal::RingBuffer::pack_row(int row) {
+  if (!ring_chars_[row]) return;
+  packed_[row].pack(ring_chars_[row], ring_cols_, styles_);
+  spare_.push_back(ring_chars_[row]);              // keep array for reuse
+  ring_chars_[row] = 0;
+  cache_clear();
+}
+
+// Remove styles no longer used by any packed rows from the style table
+void Fl_Terminal::RingBuffer::gc_styles(void) {
+  StyleTable newstyles;
+  std::vector<int> newindex(styles_.size(), -1);
+  newindex[0] = 0;                                 // style #0 is always the default
+  for (int row=0; row<ring_rows_; row++)
+    packed_[row].remap_styles(newindex, styles_, newstyles);
+  styles_ = newstyles;
+  styles_gc_ = MAX(4096, 2 * styles_.size());
+}
+
 // Return UTF-8 char for 'row' in the ring
 // Scrolling offset is NOT applied; this is raw access to the ring's rows.
 //
@@ -917,9 +1260,7 @@ void Fl_Terminal::RingBuffer::scroll(int rows, const CharStyle& style) {
 //   }
 //
 const Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_ring_row(int row) const {
-  row = normalize(row, ring_rows());
-  assert(row >= 0 && row < ring_rows_);
-  return &ring_chars_[row * ring_cols()];
+  return read_row(ring_index(row));
 }
 
 // Return UTF-8 char for beginning of 'row' in the history buffer.
@@ -931,10 +1272,7 @@ const Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_ring_row(int row) cons
 //     }
 //
 const Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_hist_row(int hrow) const {
-  int rowi = normalize(hrow, hist_rows());
-  rowi = (rowi + offset_) % ring_rows_;
-  assert(rowi >= 0 && rowi <= ring_rows_);
-  return &ring_chars_[rowi * ring_cols()];
+  return read_row(hist_index(hrow));
 }
 
 // Special case to walk the "in use" rows of the history
@@ -947,11 +1285,7 @@ const Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_hist_row(int hrow) con
 //
 const Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_hist_use_row(int hurow) const {
   if (hist_use_ == 0) return 0;             // history is empty! (caller is dumb to ask)
-  hurow = hurow % hist_use_;                // normalize indexing within history in use
-  hurow = hist_rows_ - hist_use_ + hurow;   // index hist_use rows from end history
-  hurow = (hurow + offset_) % ring_rows_;   // convert to absolute index in ring_chars_[]
-  assert(hurow >= 0 && hurow <= hist_use());
-  return &ring_chars_[hurow * ring_cols()];
+  return read_row(hist_use_index(hurow));
 }
 
 // Return UTF-8 char for beginning of 'row' in the display buffer
@@ -963,13 +1297,11 @@ const Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_hist_use_row(int hurow
 //     }
 //
 const Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_disp_row(int drow) const {
-  int rowi = normalize(drow, disp_rows());
-  rowi = (hist_rows_ + rowi + offset_) % ring_rows_; // display starts at end of history
-  assert(rowi >= 0 && rowi <= ring_rows_);
-  return &ring_chars_[rowi * ring_cols()];
+  return ring_chars_[disp_index(drow)];     // display rows are never packed
 }
 
 // non-const versions of the above ////////////////////////////////////////////////
+//    These unpack history rows, so they can be modified.
 
 // Return UTF-8 char for 'row' in the ring.
 // Scrolling offset is NOT applied; this is raw access to the ring's rows.
@@ -981,13 +1313,13 @@ const Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_disp_row(int drow) con
 //   }
 //
 Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_ring_row(int row)
-  { return const_cast<Utf8Char*>(const_cast<const RingBuffer*>(this)->u8c_ring_row(row)); }
+  { return unpack_row(ring_index(row), true); }
 
 Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_hist_row(int hrow)
-  { return const_cast<Utf8Char*>(const_cast<const RingBuffer*>(this)->u8c_hist_row(hrow)); }
+  { return unpack_row(hist_index(hrow), true); }
 
 Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_hist_use_row(int hurow)
-  { return const_cast<Utf8Char*>(const_cast<const RingBuffer*>(this)->u8c_hist_use_row(hurow)); }
+  { return hist_use_ ? unpack_row(hist_use_index(hurow), true) : 0; }
 
 // Return UTF-8 char for beginning of 'row' in the display buffer
 // Example:
@@ -997,7 +1329,7 @@ Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_hist_use_row(int hurow)
 //     ..
 //   }
 Fl_Terminal::Utf8Char* Fl_Terminal::RingBuffer::u8c_disp_row(int drow)
-  { return const_cast<Utf8Char*>(const_cast<const RingBuffer*>(this)->u8c_disp_row(drow)); }
+  { return ring_chars_[disp_index(drow)]; }
 
 // Resize ring buffer by creating new one, dumping old (if any).
 // Input:
@@ -1015,27 +1347,69 @@ void Fl_Terminal::RingBuffer::create(int drows, int dcols, int hrows) {
   // Ring buffer
   ring_rows_  = hist_rows_ + disp_rows_;
   ring_cols_  = dcols;
-  nchars_     = ring_rows_ * ring_cols_;
-  ring_chars_ = new Utf8Char[nchars_];
+  ring_chars_ = new Utf8Char*[ring_rows_];
+  packed_     = new PackedRow[ring_rows_];
+  for (int row=0; row<ring_rows_; row++)          // history starts packed, display unpacked
+    ring_chars_[row] = (row >= hist_rows_) ? new Utf8Char[ring_cols_] : 0;
+  cache_chars_ = new Utf8Char[cache_size_ * ring_cols_];
 }
 
-// Resize the buffer, preserve previous contents as much as possible
+// Resize the buffer, preserve previous contents as much as possible.
+//
+//   The last row of the display stays where it is, and the history and
+//   display are moved around it, so rows change between history and display
+//   without being copied. Only rows that move into the display are unpacked,
+//   and rows that move out of it packed, so the text that is touched is
+//   proportional to the change in display size, not the size of the history.
+//   resize_ring() still walks all ring rows to relink them, but only when the
+//   ring is reallocated. New display rows below the preserved contents are
+//   cleared using 'style'.
+//
+//   The ring is only reallocated if it's too small for the new size, and then
+//   with room for another display's worth of rows, so enlarging the display
+//   one row at a time (e.g. while the window is resized) reallocates rarely.
+//   Where the display is enlarged, the history in use shrinks:
+//
+//                   BEFORE               AFTER
+//                 _____________        _____________   ___
+//                | x x x x x x |      | x x x x x x |   ʌ                      'x' indicates
+//                | Line 1      |      | Line 1      |   |  hist_rows           unused history
+//                | Line 2      |      |-------------|  ---                     buffer memory.
+//                |-------------|      | Line 2      |   ʌ
+//                | Line 3      |      | Line 3      |   |
+//                | Line 4      |      | Line 4      |   |  disp_rows
+//                | Line 5      |      | Line 5      |   |
+//                 -------------        -------------   _v_
+//
 void Fl_Terminal::RingBuffer::resize(int drows, int dcols, int hrows, const CharStyle& style) {
-  int  new_rows     = drows + hrows;              // old display + history rows
-  int  old_rows     = disp_rows() + hist_rows();  // new display + history rows
-  bool cols_changed = (dcols != disp_cols());     // was there a change in total #columns?
-  bool rows_changed = (new_rows != old_rows);     // was there a change in total #rows?
-  // If rows or cols changed, make a NEW buffer and copy old contents.
-  // New copy will have disp/hist_rows/cols and nchars adjusted.
-  if (cols_changed || rows_changed) {             // rows or cols changed?
-    new_copy(drows, dcols, hrows, style);         // rebuild ring buffer, preserving contents
-  } else {
-    // Cols and total rows the same, probably just changed disp/hist ratio
-    int addhist = disp_rows() - drows;            // adj hist_use smaller if disp enlarged
-    hist_rows_  = hrows;                          // adj hist rows for new value
-    disp_rows_  = drows;                          // adj disp rows for new value
-    hist_use_   = clamp(hist_use_ + addhist, 0, hrows);
+  if (dcols != ring_cols_) resize_cols(dcols);
+  int new_rows = drows + hrows;
+  if (new_rows > ring_rows_ || ring_rows_ > 2 * new_rows + drows)
+    resize_ring(new_rows + drows);                // too small, or way too big?
+  int bottom    = offset_ + hist_rows_ + disp_rows_;   // one past the last display row
+  int old_valid = disp_rows_ + hist_use_;             // #rows with contents, from the bottom
+  // Rows in the new display: unpack them, clear rows that had no contents
+  for (int r=0; r<drows; r++) {                       // r: #rows up from the bottom
+    int row = normalize(bottom - 1 - r, ring_rows_);
+    if (r < old_valid) {
+      unpack_row(row, true);
+    } else {
+      Utf8Char *u8c = unpack_row(row, false);
+      for (int col=0; col<ring_cols_; col++) u8c++->clear(style);
+    }
   }
+  // Rows that moved from the display into the history
+  for (int r=drows; r<disp_rows_; r++)
+    pack_row(normalize(bottom - 1 - r, ring_rows_));
+  hist_use_  = clamp(hist_use_ + disp_rows_ - drows, 0, hrows);
+  hist_rows_ = hrows;
+  disp_rows_ = drows;
+  offset_    = normalize(bottom - new_rows, ring_rows_);
+  if (int(spare_.size()) > disp_rows_) {              // keep some spares for scrolling
+    for (int i=disp_rows_; i<int(spare_.size()); i++) delete[] spare_[i];
+    spare_.resize(disp_rows_);
+  }
+  cache_clear();
 }
 
 // Change the display rows. Use style for new rows, if any.
@@ -1046,6 +1420,301 @@ void Fl_Terminal::RingBuffer::change_disp_rows(int drows, const CharStyle& style
 void Fl_Terminal::RingBuffer::change_disp_cols(int dcols, const CharStyle& style)
   { resize(disp_rows(), dcols, hist_rows(), style); }
 
+////////////////////////////////////
+///// DirtyRows Class Methods //////
+////////////////////////////////////
+
+// Default ctor
+Fl_Terminal::DirtyRows::DirtyRows(void) {
+  scol_ = ecol_ = 0;
+  rows_ = 0;
+  all_  = true;
+  scrolled_ = 0;
+  vscroll_ = hscroll_ = offset_ = cols_ = 0;
+  crow_ = ccol_ = 0;
+}
+
+// Dtor
+Fl_Terminal::DirtyRows::~DirtyRows(void) {
+  delete[] scol_;
+  delete[] ecol_;
+}
+
+// Track 'rows' display rows. Everything is marked dirty.
+void Fl_Terminal::DirtyRows::resize(int rows) {
+  if (rows != rows_) {
+    delete[] scol_;
+    delete[] ecol_;
+    rows_ = rows;
+    scol_ = new int[rows_];
+    ecol_ = new int[rows_];
+  }
+  clear();
+  all_ = true;
+}
+
+// Mark all rows unmodified, e.g. after draw() repainted them
+void Fl_Terminal::DirtyRows::clear(void) {
+  for (int drow=0; drow<rows_; drow++)
+    { scol_[drow] = 0x7fffffff; ecol_[drow] = -1; }
+  all_ = false;
+  scrolled_ = 0;
+}
+
+// Mark columns 'scol' thru 'ecol' inclusive of display row 'drow' as modified.
+//    Rows we don't know about (display was resized) mark everything.
+//
+void Fl_Terminal::DirtyRows::mark(int drow, int scol, int ecol) {
+  if (all_) return;                                // everything dirty already
+  if (drow < 0 || drow >= rows_) { all_ = true; return; }
+  if (scol < scol_[drow]) scol_[drow] = scol;
+  if (ecol > ecol_[drow]) ecol_[drow] = ecol;
+}
+
+// The display scrolled up 'rows' rows, leaving the ring at 'offset'.
+//    Moves the modified spans up with their rows and marks the rows scrolled
+//    in at the bottom modified. The saved view and cursor move along, as if
+//    the last draw() had drawn the screen scrolled up, which draw() does by
+//    moving the pixels up 'scrolled()' rows.
+//
+void Fl_Terminal::DirtyRows::scroll(int rows, int offset) {
+  if (all_) return;                                // everything dirty already
+  if (rows <= 0 || scrolled_ + rows >= rows_) { all_ = true; return; }
+  for (int drow=0; drow<rows_-rows; drow++)
+    { scol_[drow] = scol_[drow+rows]; ecol_[drow] = ecol_[drow+rows]; }
+  for (int drow=rows_-rows; drow<rows_; drow++)
+    { scol_[drow] = 0; ecol_[drow] = 0x7fffffff; }
+  scrolled_ += rows;
+  offset_    = offset;
+  crow_     -= rows;                               // <0 if cursor scrolled off
+}
+
+// Save the view and cursor position draw() used
+void Fl_Terminal::DirtyRows::view(int vscroll, int hscroll, int offset, int cols, int crow, int ccol) {
+  vscroll_ = vscroll; hscroll_ = hscroll; offset_ = offset; cols_ = cols;
+  crow_ = crow; ccol_ = ccol;
+}
+
+// Is the view the same as the one last used by draw()?
+bool Fl_Terminal::DirtyRows::is_view(int vscroll, int hscroll, int offset, int cols) const {
+  return vscroll == vscroll_ && hscroll == hscroll_ && offset == offset_ && cols == cols_;
+}
+
+/////////////////////////////////
+///// Search Class Methods //////
+/////////////////////////////////
+
+// Default ctor
+Fl_Terminal::Search::Search(void) {
+  regex_ = 0;
+  grow_ = -1; scol_ = ecol_ = 0;
+  highlight_all_ = false;
+  searchfgcolor_ = FL_BLACK;
+  searchbgcolor_ = FL_YELLOW;
+  hilite_row_ = 0;
+  hilite_valid_ = false;
+}
+
+// Dtor
+Fl_Terminal::Search::~Search(void) {
+  delete regex_;
+}
+
+// Compile 'pattern' for searching, see Fl_Terminal::search() for 'flags'.
+//    Plain text is searched as a regular expression that matches each
+//    character literally. NULL or "" ends searching.
+//    Returns 0 on success, -1 if 'pattern' is not a valid expression.
+//
+int Fl_Terminal::Search::compile(const char *pattern, int flags) {
+  delete regex_;
+  regex_ = 0;
+  grow_ = -1;
+  hilite_valid_ = false;
+  if (!pattern || !*pattern) return 0;
+  std::string re;
+  if (flags & SEARCH_REGEX) {
+    re = pattern;
+  } else {
+    for (const char *p = pattern; *p; p++) {
+      if (strchr("\\.[]()|*+?{}^$", *p)) re += '\\';
+      re += *p;
+    }
+  }
+  regex_ = new Fl_Text_Regex;
+  if (regex_->compile(re.c_str(), (flags & SEARCH_IGNORE_CASE) ? Fl_Text_Regex::IGNORE_CASE : 0) != 0)
+    { delete regex_; regex_ = 0; return -1; }
+  return 0;
+}
+
+// Load the text of the row of 'cols' characters at 'u8c' for searching.
+//    Trailing blanks are left off, so a pattern can't match the
+//    unused part of the row.
+//
+void Fl_Terminal::Search::load_row(const Utf8Char *u8c, int cols) const {
+  while (cols > 0 && u8c[cols-1].is_char(' ')) cols--;
+  text_.clear();
+  colpos_.clear();
+  for (int col=0; col<cols; col++) {
+    colpos_.push_back(int(text_.size()));
+    text_.append(u8c[col].text_utf8(), u8c[col].length());
+  }
+  colpos_.push_back(int(text_.size()));
+}
+
+// Return the column containing byte offset 'pos' of the loaded row
+int Fl_Terminal::Search::col_at(int pos) const {
+  return int(std::upper_bound(colpos_.begin(), colpos_.end(), pos) - colpos_.begin()) - 1;
+}
+
+// Find the first match in the loaded row starting at or after column 'col'.
+//    Returns true if found, with the first and last column of the match
+//    in 'scol' and 'ecol'. Empty matches are skipped.
+//
+bool Fl_Terminal::Search::find_forward(int col, int &scol, int &ecol) const {
+  int len = int(text_.size());
+  int ncols = int(colpos_.size()) - 1;
+  if (!regex_ || col < 0 || col >= ncols) return false;
+  int start, end;
+  int pos = colpos_[col];
+  while (regex_->search_forward(text_.data(), len, pos, &start, &end)) {
+    if (end > start) { scol = col_at(start); ecol = col_at(end-1); return true; }
+    int c = col_at(start) + 1;                     // empty match: try the next column
+    if (c >= ncols) break;
+    pos = colpos_[c];
+  }
+  return false;
+}
+
+// Find the last match in the loaded row starting at or before column 'col'.
+//    Returns true if found, with the first and last column of the match
+//    in 'scol' and 'ecol'. Empty matches are skipped.
+//
+bool Fl_Terminal::Search::find_backward(int col, int &scol, int &ecol) const {
+  int len = int(text_.size());
+  int ncols = int(colpos_.size()) - 1;
+  if (!regex_ || col < 0 || ncols == 0) return false;
+  if (col >= ncols) col = ncols - 1;
+  int start, end;
+  int pos = colpos_[col];
+  while (regex_->search_backward(text_.data(), len, pos, &start, &end)) {
+    if (end > start) { scol = col_at(start); ecol = col_at(end-1); return true; }
+    int c = col_at(start) - 1;                     // empty match: try the previous column
+    if (c < 0) break;
+    pos = colpos_[c];
+  }
+  return false;
+}
+
+// Find all matches in the loaded row, which is global row 'grow'
+void Fl_Terminal::Search::hilite(int grow) const {
+  hilite_.clear();
+  int scol, ecol, col = 0;
+  while (find_forward(col, scol, ecol)) {
+    hilite_.push_back(scol);
+    hilite_.push_back(ecol);
+    col = ecol + 1;
+  }
+  hilite_row_ = grow;
+  hilite_valid_ = true;
+}
+
+// Is column 'gcol' of the row passed to hilite() inside a match?
+bool Fl_Terminal::Search::is_hilite(int gcol) const {
+  for (size_t i=0; i<hilite_.size(); i+=2)
+    if (gcol >= hilite_[i] && gcol <= hilite_[i+1]) return true;
+  return false;
+}
+
+/////////////////////////////////
+///// Queue Class Methods ///////
+/////////////////////////////////
+
+// Single producer, single consumer lock-free queue of bytes.
+//    One worker thread writes with put(), the main thread reads with
+//    peek() and skip(). 'head_' and 'tail_' count all bytes ever written
+//    and read, so (head_ - tail_) is the number of bytes in the queue,
+//    even after the counters wrap around. Each side only changes its
+//    own counter; the release/acquire pairs make the bytes written
+//    before a counter changes visible to the other side.
+//
+//    The main thread stops draining the queue when it is empty, see sleep(),
+//    and the worker wakes it up when it queues more, see wake(). 'idle_' is
+//    set while the main thread is not draining. Both sides write their own
+//    variable before they read the other one, with a fence in between, so
+//    at least one of them sees that the other one was there. Whoever clears
+//    'idle_' restarts draining, so it is restarted exactly once.
+//
+class Fl_Terminal::Queue {
+  char    *buf_;                        // queued bytes, size_ is a power of 2
+  unsigned size_;
+  std::atomic<unsigned> head_;          // #bytes written, only changed by put()
+  std::atomic<unsigned> tail_;          // #bytes read, only changed by skip()
+  std::atomic<bool>     idle_;          // main thread stopped draining
+public:
+  Fl_Terminal *term_;                   // terminal that drains the queue
+  Queue *next_;                         // all queues, for queue_awake_cb()
+  static Queue *first_;
+  Queue(int size, Fl_Terminal *term) : head_(0), tail_(0), idle_(false), term_(term) {
+    size_ = 256;
+    while (size_ < unsigned(size) && size_ < 0x40000000u) size_ <<= 1;
+    buf_ = new char[size_];
+    next_ = first_;
+    first_ = this;
+  }
+  ~Queue(void) {
+    Queue **q = &first_;
+    while (*q != this) q = &(*q)->next_;
+    *q = next_;
+    delete[] buf_;
+  }
+  int size(void) const { return int(size_); }
+  bool empty(void) const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed);
+  }
+  bool idle(void) const { return idle_.load(std::memory_order_relaxed); }
+  // Main thread: stop draining the empty queue.
+  //    Returns true if text was queued meanwhile, and draining must go on.
+  bool sleep(void) {
+    idle_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return !empty() && idle_.exchange(false);
+  }
+  // Worker: call after put(). Returns true if the main thread stopped
+  //    draining, and must be woken up.
+  bool wake(void) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return idle_.load(std::memory_order_relaxed) && idle_.exchange(false);
+  }
+  // Queue up to 'len' bytes of 's', as many as fit.
+  //    Returns the number of bytes queued, 0 if the queue is full.
+  int put(const char *s, int len) {
+    unsigned head = head_.load(std::memory_order_relaxed);
+    unsigned room = size_ - (head - tail_.load(std::memory_order_acquire));
+    if (unsigned(len) > room) len = int(room);
+    unsigned pos = head & (size_ - 1);
+    unsigned n = (unsigned(len) < size_ - pos) ? unsigned(len) : size_ - pos;
+    memcpy(buf_ + pos, s, n);                          // up to end of buf_
+    memcpy(buf_, s + n, len - n);                      // rest wraps to start
+    head_.store(head + len, std::memory_order_release);
+    return len;
+  }
+  // Return the next run of queued bytes that is contiguous in memory,
+  //    and its length in 'len', which is 0 if the queue is empty.
+  const char *peek(int &len) const {
+    unsigned tail = tail_.load(std::memory_order_relaxed);
+    unsigned used = head_.load(std::memory_order_acquire) - tail;
+    unsigned pos  = tail & (size_ - 1);
+    len = int((used < size_ - pos) ? used : size_ - pos);
+    return buf_ + pos;
+  }
+  // Remove 'len' bytes returned by peek() from the queue
+  void skip(int len) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + len, std::memory_order_release);
+  }
+};
+
+Fl_Terminal::Queue *Fl_Terminal::Queue::first_ = 0;
+
 /////////////////////////////////////
 ///// Fl_Terminal Class Methods /////
 /////////////////////////////////////
@@ -1079,6 +1748,9 @@ const Fl_Terminal::Utf8Char* Fl_Terminal::u8c_disp_row(int drow) const
 
   Should really ONLY be used for making a complete copy of the ring.
 
+  History rows are stored packed, and this unpacks the row so it can be
+  modified. Use the const version of this method to just read the row.
+
   Example:
   \code
   // Walk ALL rows and cols in the raw ring buffer..
@@ -1095,16 +1767,21 @@ const Fl_Terminal::Utf8Char* Fl_Terminal::u8c_disp_row(int drow) const
   }
   \endcode
 */
-Fl_Terminal::Utf8Char* Fl_Terminal::u8c_ring_row(int grow)
-  { return const_cast<Utf8Char*>(const_cast<const Fl_Terminal*>(this)->u8c_ring_row(grow)); }
+Fl_Terminal::Utf8Char* Fl_Terminal::u8c_ring_row(int grow) {
+  dirty_.mark_all();        // row might be anywhere on screen; assume modified
+  return ring_.u8c_ring_row(grow);
+}
 
 /**
   Return u8c for beginning of a row inside the scrollback history.
   'hrow' is indexed relative to the beginning of the scrollback history buffer.
+  This unpacks the row so it can be modified, see u8c_ring_row(int).
   \see u8c_disp_row(int) for example use.
 */
-Fl_Terminal::Utf8Char* Fl_Terminal::u8c_hist_row(int hrow)
-  { return const_cast<Utf8Char*>(const_cast<const Fl_Terminal*>(this)->u8c_hist_row(hrow)); }
+Fl_Terminal::Utf8Char* Fl_Terminal::u8c_hist_row(int hrow) {
+  dirty_.mark_all();        // history might be on screen if scrolled back
+  return ring_.u8c_hist_row(hrow);
+}
 
 /**
   Return u8c for beginning of row \p hurow inside the 'in use' part
@@ -1131,8 +1808,10 @@ Fl_Terminal::Utf8Char* Fl_Terminal::u8c_hist_row(int hrow)
 
   \see u8c_disp_row(int) for example use.
 */
-Fl_Terminal::Utf8Char* Fl_Terminal::u8c_hist_use_row(int hurow)
-  { return const_cast<Utf8Char*>(const_cast<const Fl_Terminal*>(this)->u8c_hist_use_row(hurow)); }
+Fl_Terminal::Utf8Char* Fl_Terminal::u8c_hist_use_row(int hurow) {
+  dirty_.mark_all();        // history might be on screen if scrolled back
+  return ring_.u8c_hist_use_row(hurow);
+}
 
 /**
   Return pointer to the first u8c character in row \p drow of the display.
@@ -1164,8 +1843,10 @@ Fl_Terminal::Utf8Char* Fl_Terminal::u8c_hist_use_row(int hurow)
 
   \see u8c_hist_use_row() for examples of walking the screen history
 */
-Fl_Terminal::Utf8Char* Fl_Terminal::u8c_disp_row(int drow)
-  { return const_cast<Utf8Char*>(const_cast<const Fl_Terminal*>(this)->u8c_disp_row(drow)); }
+Fl_Terminal::Utf8Char* Fl_Terminal::u8c_disp_row(int drow) {
+  dirty_.mark_row(drow);    // caller may modify any char in the row
+  return ring_.u8c_disp_row(drow);
+}
 
 // Create ring buffer.
 // Input:
@@ -1181,6 +1862,7 @@ void Fl_Terminal::create_ring(int drows, int dcols, int hrows) {
   if (dcols != ring_.ring_cols()) init_tabstops(dcols);
   // recreate ring (dumps old)
   ring_.create(drows, dcols, hrows);
+  dirty_.mark_all();
   // ensure cursor starts at home position
   cursor_.home();
 }
@@ -1371,6 +2053,7 @@ void Fl_Terminal::refit_disp_to_screen(void) {
     }
   }
   clear_mouse_selection();
+  search_.match(-1, 0, 0);                      // ring rows may have moved
   update_screen(false);
 }
 
@@ -1416,6 +2099,7 @@ void Fl_Terminal::resize_display_rows(int drows) {
   // ..update cursor/selections to track text position
   cursor_.scroll(-drow_diff);
   select_.clear();                  // clear any mouse selection
+  search_.match(-1, 0, 0);          // ..and search match
   // ..update scrollbar, since disp_height relative to hist_use changed
   update_scrollbar();
 }
@@ -1430,6 +2114,7 @@ void Fl_Terminal::resize_display_columns(int dcols) {
   if (dcols == disp_cols()) return;
   // Change cols, preserves previous content if possible
   ring_.resize(disp_rows(), dcols, hist_rows(), *current_style_);
+  cursor_.col(clamp(cursor_.col(), 0, disp_cols()-1));  // keep cursor inside display
   update_scrollbar();
 }
 
@@ -1479,6 +2164,7 @@ int Fl_Terminal::history_rows(void) const {
 void Fl_Terminal::history_rows(int hrows) {
   if (hrows == history_rows()) return;        // no change? done
   ring_.resize(disp_rows(), disp_cols(), hrows, *current_style_);
+  search_.match(-1, 0, 0);                    // ring rows may have moved
   update_screen(false);                       // false: no font change
   display_modified();
 }
@@ -1542,12 +2228,15 @@ int Fl_Terminal::display_columns(void) const {
   text is if the user enlarges the widget, or the font size
   made smaller.
 
+  Lines are not rewrapped to the new width, see resize().
+
   To change the display width, it is best to use resize() instead.
 */
 void Fl_Terminal::display_columns(int dcols) {
   if (dcols == disp_cols()) return;           // no change? early exit
   // Change cols, preserves previous content if possible
   ring_.resize(disp_rows(), dcols, hist_rows(), *current_style_);
+  cursor_.col(clamp(cursor_.col(), 0, disp_cols()-1));  // keep cursor inside display
   update_screen(false);                       // false: no font change ?NEED?
   refit_disp_to_screen();
 }
@@ -1957,7 +2646,8 @@ void Fl_Terminal::clear_eod(void) {
 
 /// Clear from cursor to End Of Line (EOL), like \c "<ESC>[K".
 void Fl_Terminal::clear_eol(void) {
-  Utf8Char *u8c = u8c_disp_row(cursor_.row()) + cursor_.col();  // start at cursor
+  dirty_.mark(cursor_.row(), cursor_.col(), disp_cols()-1);
+  Utf8Char *u8c = ring_.u8c_disp_row(cursor_.row()) + cursor_.col(); // start at cursor
   for (int col=cursor_.col(); col<disp_cols(); col++)           // run from cursor to eol
     (u8c++)->clear(*current_style_);
   //TODO: Clear mouse selection?
@@ -1965,7 +2655,8 @@ void Fl_Terminal::clear_eol(void) {
 
 /// Clear from cursor to Start Of Line (SOL), like \c "<ESC>[1K".
 void Fl_Terminal::clear_sol(void) {
-  Utf8Char *u8c = u8c_disp_row(cursor_.row());  // start at sol
+  dirty_.mark(cursor_.row(), 0, cursor_.col());
+  Utf8Char *u8c = ring_.u8c_disp_row(cursor_.row()); // start at sol
   for (int col=0; col<=cursor_.col(); col++)    // run from sol to cursor
     (u8c++)->clear(*current_style_);
   //TODO: Clear mouse selection?
@@ -2090,6 +2781,21 @@ bool Fl_Terminal::is_inside_selection(int grow, int gcol) const {
   return (check >= start && check <= end);
 }
 
+/**
+  Is global row/column inside a search match highlighted by search_highlight_all()?
+
+  The matches of a row are found the first time one of its columns is
+  checked, and kept until the next row is checked or draw() starts over.
+*/
+bool Fl_Terminal::is_search_hilite(int grow, int gcol) const {
+  if (!search_.highlight_all() || !search_.is_search()) return false;
+  if (!search_.is_hilite_row(grow)) {
+    search_.load_row(utf8_char_at_glob(grow, 0), ring_cols());
+    search_.hilite(grow);
+  }
+  return search_.is_hilite(gcol);
+}
+
 // See if global row (grow) is inside the 'display' area
 //
 //    No wrap case:                          Wrap case:
@@ -2163,7 +2869,7 @@ const char* Fl_Terminal::selection_text(void) const {
 
 /// Clear any current mouse selection.
 void Fl_Terminal::clear_mouse_selection(void) {
-  select_.clear();
+  if (select_.clear()) dirty_.mark_all();  // selection was shown? redraw it away
 }
 
 /**
@@ -2191,7 +2897,7 @@ bool Fl_Terminal::selection_extend(int X,int Y) {
 void Fl_Terminal::select_word(int grow, int gcol) {
   int i, c0, c1;
   int r = grow, c = gcol;
-  Utf8Char *row = u8c_ring_row(r);
+  const Utf8Char *row = utf8_char_at_glob(r, 0);   // const: don't unpack history row
   int n = ring_cols();
   if (c >= n) return;
   if (row[c].text_utf8()[0]==' ') {
@@ -2215,6 +2921,163 @@ void Fl_Terminal::select_line(int grow) {
   select_.select(grow, 0, grow, ring_cols()-1);
 }
 
+// Return the search index of global row 'grow': rows are numbered from
+//    the oldest row of the history in use (0) to the last row of the display.
+//    Returns -1 if 'grow' is not in the history in use or the display.
+//
+int Fl_Terminal::search_row_index(int grow) const {
+  int index = (grow - hist_use_srow()) % ring_rows();
+  if (index < 0) index += ring_rows();
+  return (index < hist_use() + disp_rows()) ? index : -1;
+}
+
+// Make the match at columns 'scol' thru 'ecol' of search index 'index'
+//    the current match: select it, and scroll it into view.
+//
+void Fl_Terminal::search_show(int index, int scol, int ecol) {
+  // Scroll vertically so the row is on the screen
+  int top = hist_use() - scrollbar->value();       // index of the top row on the screen
+  int val = scrollbar->value();
+  if (index < top)                     val = hist_use() - index;
+  else if (index >= top + disp_rows()) val = hist_use() + disp_rows() - 1 - index;
+  scrollbar->value(clamp(val, 0, hist_use()));
+  // Scroll horizontally so the match is on the screen
+  if (hscrollbar->visible()) {
+    int hval  = hscrollbar->value();
+    int hcols = w_to_col(scrn_.w());               // #columns on the screen
+    if (ecol >= hval + hcols) hval = ecol - hcols + 1;
+    if (scol < hval)          hval = scol;
+    hscrollbar->value(clamp(hval, 0, int(hscrollbar->maximum()+.5)));
+  }
+  // Select the match, using the same row numbers as draw()
+  int grow = disp_srow() - hist_use() + index;
+  search_.match((hist_use_srow() + index) % ring_rows(), scol, ecol);
+  select_.select(grow, scol, grow, ecol);
+  redraw();
+}
+
+/**
+  Sets the pattern for search_forward() and search_backward().
+
+  The terminal's history and display are searched one row at a time,
+  reading the text in place, so searching a large history is fast and
+  uses little memory. A match can't span rows; a line that was wrapped
+  onto several rows is searched as separate rows, and trailing blanks
+  of a row are ignored.
+
+  \p flags is a combination of:
+  - SEARCH_LITERAL: \p pattern is plain text (default)
+  - SEARCH_REGEX: \p pattern is a regular expression, see Fl_Text_Regex for the syntax
+  - SEARCH_IGNORE_CASE: upper and lower case characters match alike
+
+  The current match is cleared, and the next search_forward() starts
+  at the top of the history, search_backward() at the bottom of the display.
+
+  \param[in] pattern text or regular expression to search for, NULL or "" ends searching
+  \param[in] flags search flags, see above
+  \returns 0 on success, -1 if \p pattern is not a valid regular expression,
+           in which case searching is ended.
+  \see search_forward(), search_backward(), search_highlight_all(bool)
+*/
+int Fl_Terminal::search(const char *pattern, int flags) {
+  int ret = search_.compile(pattern, flags);
+  redraw();
+  return ret;
+}
+
+/**
+  Finds the next match of the search() pattern after the current match.
+
+  The match is selected like a mouse selection, and the display is
+  scrolled to show it. Searching starts at the top of the history if
+  there is no current match, and doesn't wrap around at the bottom
+  of the display.
+
+  \returns true if a match was found, false if not, or search() wasn't set.
+  \see search(), search_backward(), search_match()
+*/
+bool Fl_Terminal::search_forward(void) {
+  if (!search_.is_search()) return false;
+  int nrows = hist_use() + disp_rows();
+  int index = 0, col = 0;
+  int mrow = (search_.match_row() < 0) ? -1 : search_row_index(search_.match_row());
+  if (mrow >= 0) { index = mrow; col = search_.match_ecol() + 1; }
+  for (; index<nrows; index++, col=0) {
+    int grow = (hist_use_srow() + index) % ring_rows();
+    search_.load_row(utf8_char_at_glob(grow, 0), ring_cols());
+    int scol, ecol;
+    if (search_.find_forward(col, scol, ecol))
+      { search_show(index, scol, ecol); return true; }
+  }
+  return false;
+}
+
+/**
+  Finds the previous match of the search() pattern before the current match.
+
+  The match is selected like a mouse selection, and the display is
+  scrolled to show it. Searching starts at the bottom of the display if
+  there is no current match, and doesn't wrap around at the top
+  of the history.
+
+  \returns true if a match was found, false if not, or search() wasn't set.
+  \see search(), search_forward(), search_match()
+*/
+bool Fl_Terminal::search_backward(void) {
+  if (!search_.is_search()) return false;
+  int index = hist_use() + disp_rows() - 1, col = ring_cols();
+  int mrow = (search_.match_row() < 0) ? -1 : search_row_index(search_.match_row());
+  if (mrow >= 0) { index = mrow; col = search_.match_scol() - 1; }
+  for (; index>=0; index--, col=ring_cols()) {
+    int grow = (hist_use_srow() + index) % ring_rows();
+    search_.load_row(utf8_char_at_glob(grow, 0), ring_cols());
+    int scol, ecol;
+    if (search_.find_backward(col, scol, ecol))
+      { search_show(index, scol, ecol); return true; }
+  }
+  return false;
+}
+
+/**
+  Returns the position of the match last found by search_forward() or search_backward().
+
+  \p row is a global row like the rows of get_selection(), and can be used
+  with utf8_char_at_glob().
+
+  \param[out] row global row of the match
+  \param[out] scol, ecol first and last column of the match
+  \returns true if there is a current match, false if not.
+*/
+bool Fl_Terminal::search_match(int &row, int &scol, int &ecol) const {
+  if (!search_.is_search() || search_.match_row() < 0) return false;
+  int index = search_row_index(search_.match_row());
+  if (index < 0) return false;
+  row  = disp_srow() - hist_use() + index;
+  scol = search_.match_scol();
+  ecol = search_.match_ecol();
+  return true;
+}
+
+/**
+  Sets whether all matches of the search() pattern on the screen are highlighted.
+
+  Matches are drawn with searchfgcolor() and searchbgcolor(), the current
+  match with the mouse selection colors. Default is off.
+  \see search(), searchfgcolor(Fl_Color), searchbgcolor(Fl_Color)
+*/
+void Fl_Terminal::search_highlight_all(bool val) {
+  search_.highlight_all(val);
+  redraw();
+}
+
+/**
+  Returns true if all matches of the search() pattern on the screen are highlighted.
+  \see search_highlight_all(bool)
+*/
+bool Fl_Terminal::search_highlight_all(void) const {
+  return search_.highlight_all();
+}
+
 /**
   Scroll the display up(+) or down(-) the specified \p rows.
 
@@ -2224,6 +3087,8 @@ void Fl_Terminal::select_line(int grow) {
 void Fl_Terminal::scroll(int rows) {
   // Scroll the ring
   ring_.scroll(rows, *current_style_);
+  if (rows > 0) dirty_.scroll(rows, offset()); // scroll up? draw() can move rows up
+  else          dirty_.mark_all();             // all rows moved
   if (rows > 0) update_scrollbar();      // scroll up? changes hist, so scrollbar affected
   else          clear_mouse_selection(); // scroll dn? clear mouse select; it might wrap ring
 }
@@ -2297,8 +3162,9 @@ void Fl_Terminal::insert_char_eol(char c, int drow, int dcol, int rep) {
   rep = clamp(rep, 0, disp_cols());                     // sanity
   if (rep == 0) return;
   const CharStyle &style = *current_style_;
-  Utf8Char *src = u8c_disp_row(drow)+disp_cols()-1-rep; // start src at 'g'
-  Utf8Char *dst = u8c_disp_row(drow)+disp_cols()-1;     // start dst at 'j'
+  dirty_.mark(drow, dcol, disp_cols()-1);
+  Utf8Char *src = ring_.u8c_disp_row(drow)+disp_cols()-1-rep; // start src at 'g'
+  Utf8Char *dst = ring_.u8c_disp_row(drow)+disp_cols()-1;     // start dst at 'j'
   for (int col=(disp_cols()-1); col>=dcol; col--) {     // loop col in reverse: eol -> dcol
     if (col >= (dcol+rep)) *dst-- = *src--;             // let assignment do move
     else                   (dst--)->text_ascii(c,style);// assign chars displaced
@@ -2318,7 +3184,8 @@ void Fl_Terminal::delete_chars(int drow, int dcol, int rep) {
   rep = clamp(rep, 0, disp_cols());                // sanity
   if (rep == 0) return;
   const CharStyle &style = *current_style_;
-  Utf8Char *u8c = u8c_disp_row(drow);
+  dirty_.mark(drow, dcol, disp_cols()-1);
+  Utf8Char *u8c = ring_.u8c_disp_row(drow);
   for (int col=dcol; col<disp_cols(); col++)                      // delete left-to-right
     if (col+rep >= disp_cols()) u8c[col].text_ascii(' ', style);  // blanks
     else                        u8c[col] = u8c[col+rep];          // move
@@ -2336,14 +3203,10 @@ void Fl_Terminal::delete_chars(int rep) {
 void Fl_Terminal::clear_history(void) {
   // Adjust history use
   ring_.clear_hist();
+  dirty_.mark_all();
   scrollbar->value(0);   // zero scroll position
   // Clear entire history buffer
-  for (int hrow=0; hrow<hist_rows(); hrow++) {
-    Utf8Char *u8c = u8c_hist_row(hrow);          // walk history rows..
-    for (int hcol=0; hcol<hist_cols(); hcol++) { // ..and history cols
-      (u8c++)->clear(*current_style_);
-    }
-  }
+  ring_.clear_hist_rows(*current_style_);
   // Adjust scrollbar (hist_use changed)
   update_scrollbar();
 }
@@ -2647,6 +3510,27 @@ bool Fl_Terminal::is_printable(char c) {
   return ((c>=0x20) && (c<=0x7e));
 }
 
+// Return the number of printable ASCII chars (0x20 thru 0x7e) at the start of
+// 's', stopping at the first ctrl, DEL or high-bit (UTF-8) byte or at 'len'.
+//    Scans 8 bytes at a time; a word is all printable if no byte is < 0x20
+//    and no byte is > 0x7e, which is tested for all bytes at once.
+//
+int Fl_Terminal::printable_run(const char *s, int len) {
+  typedef unsigned long long Word;
+  const Word ones  = ~Word(0) / 0xff;          // 0x0101..01
+  const Word highs = ones * 0x80;              // 0x8080..80
+  int n = 0;
+  for ( ; n + 8 <= len; n += 8) {
+    Word w;
+    memcpy(&w, s + n, 8);
+    if ( ((w - ones * 0x20) & ~w & highs) |    // any byte < 0x20?
+         (((w + ones) | w) & highs) )          // any byte > 0x7e?
+      break;
+  }
+  while (n < len && is_printable(s[n])) ++n;
+  return n;
+}
+
 // Is char a ctrl character? (0x00 thru 0x1f)
 bool Fl_Terminal::is_ctrl(char c) {
   return ((c >= 0x00) && (c < 0x20)) ? true : false;
@@ -2973,7 +3857,7 @@ void Fl_Terminal::display_modified(void) {
   } else if (is_redraw_style(PER_WRITE)) {
     if (!redraw_modified_) {
       redraw_modified_ = true;
-      redraw();                      // only call redraw once
+      damage(FL_DAMAGE_USER1);       // only call redraw once, modified rows only
     }
   } else {                           // NO_REDRAW?
     // do nothing
@@ -2990,7 +3874,8 @@ void Fl_Terminal::display_modified(void) {
   - Does not trigger redraws
 */
 void Fl_Terminal::clear_char_at_disp(int drow, int dcol) {
-  Utf8Char *u8c = u8c_disp_row(drow) + dcol;
+  dirty_.mark(drow, dcol, dcol);
+  Utf8Char *u8c = ring_.u8c_disp_row(drow) + dcol;
   u8c->clear(*current_style_);
 }
 
@@ -3039,12 +3924,13 @@ const Fl_Terminal::Utf8Char* Fl_Terminal::utf8_char_at_glob(int grow, int gcol)
   \see handle_unknown_char()
 */
 void Fl_Terminal::plot_char(const char *text, int len, int drow, int dcol) {
-  Utf8Char *u8c = u8c_disp_row(drow) + dcol;
+  Utf8Char *u8c = ring_.u8c_disp_row(drow) + dcol;
   // text_utf8() warns we must do invalid checks first
   if (!text || len<1 || len>u8c->max_utf8() || len!=fl_utf8len(*text)) {
     handle_unknown_char(drow, dcol);
     return;
   }
+  dirty_.mark(drow, dcol, dcol);
   u8c->text_utf8(text, len, *current_style_);
 }
 
@@ -3071,7 +3957,8 @@ void Fl_Terminal::plot_char(char c, int drow, int dcol) {
     handle_unknown_char(drow, dcol);
     return;
   }
-  Utf8Char *u8c = u8c_disp_row(drow) + dcol;
+  dirty_.mark(drow, dcol, dcol);
+  Utf8Char *u8c = ring_.u8c_disp_row(drow) + dcol;
   u8c->text_ascii(c, *current_style_);
 }
 
@@ -3131,6 +4018,29 @@ void Fl_Terminal::print_char(char c) {
   }
 }
 
+// Print a run of \p len printable ASCII chars at the cursor, and advance the cursor.
+//    Same as calling print_char() for each char, but each part of the run that fits
+//    on the cursor's row is written in one step, and marked dirty once.
+//    Must not be used while an ESC sequence is being parsed.
+//
+void Fl_Terminal::print_ascii_run(const char *s, int len) {
+  while (len > 0) {
+    int drow = cursor_row();
+    int dcol = cursor_col();
+    int n = disp_cols() - dcol;                // room left on this row
+    if (n < 1) { cursor_crlf(); continue; }    // cursor beyond right edge? wrap
+    if (n > len) n = len;
+    Utf8Char *u8c = ring_.u8c_disp_row(drow) + dcol;
+    for (int i = 0; i < n; i++)
+      u8c[i].text_utf8(s + i, 1, *current_style_);
+    dirty_.mark(drow, dcol, dcol + n - 1);
+    s   += n;
+    len -= n;
+    cursor_.col(dcol + n);
+    if (cursor_col() >= disp_cols()) cursor_crlf(); // hit right edge? wrap and scroll
+  }
+}
+
 // Clear the Partial UTF-8 Buffer cache
 void Fl_Terminal::utf8_cache_clear(void) {
   pub_.clear();
@@ -3178,6 +4088,16 @@ void Fl_Terminal::append_utf8(const char *buf, int len/*=-1*/) {
   int clen;                                 // char length
   const char *p = buf;                      // ptr to walk buffer
   while (len>0) {
+    if (!escseq.parse_in_progress()) {      // not in ESC sequence? try fast path
+      clen = printable_run(p, len);         // run of printable ASCII?
+      if (clen > 0) {
+        print_ascii_run(p, clen);           // write it in bulk
+        p   += clen;
+        len -= clen;
+        mod |= 1;
+        continue;
+      }
+    }
     clen = fl_utf8len(*p);                  // how many bytes long is this char?
     if (clen == -1) {                       // not expecting bad UTF-8 here
       mod |= handle_unknown_char();
@@ -3209,7 +4129,12 @@ void Fl_Terminal::append_utf8(const char *buf, int len/*=-1*/) {
 */
 void Fl_Terminal::append_ascii(const char *s) {
   if (!s) return;
-  while ( *s ) print_char(*s++);            // handles display_modified()
+  const char *end = s + strlen(s);
+  while ( s < end ) {
+    int n = escseq.parse_in_progress() ? 0 : printable_run(s, int(end - s));
+    if (n > 0) { print_ascii_run(s, n); s += n; }    // printable run? write in bulk
+    else print_char(*s++);                  // handles display_modified()
+  }
   display_modified();
 }
 
@@ -3311,7 +4236,8 @@ int Fl_Terminal::handle_unknown_char(void) {
 int Fl_Terminal::handle_unknown_char(int drow, int dcol) {
   if (!show_unknown_) return 0;
   int len = (int)strlen(error_char_);
-  Utf8Char *u8c = u8c_disp_row(drow) + dcol;
+  dirty_.mark(drow, dcol, dcol);
+  Utf8Char *u8c = ring_.u8c_disp_row(drow) + dcol;
   u8c->text_utf8(error_char_, len, *current_style_);
   return 1;
 }
@@ -3324,6 +4250,23 @@ void Fl_Terminal::scrollbar_cb(Fl_Widget*, void* userdata) {
   o->redraw();
 }
 
+// Handle areas fl_scroll() couldn't copy when draw() scrolls the screen
+//    Note: the rows in the area are redrawn by draw_dirty_rows() after fl_scroll()
+//
+void Fl_Terminal::scroll_area_cb(void *data, int X, int Y, int W, int H) {
+  Fl_Terminal *o = (Fl_Terminal*)data;
+  o->scroll_area_cb2(X, Y, W, H);
+}
+
+void Fl_Terminal::scroll_area_cb2(int X, int Y, int W, int H) {
+  (void)X; (void)W;
+  const int rowheight = current_style_->fontheight();
+  int srow = (Y - scrn_.y()) / rowheight;
+  int erow = (Y + H - 1 - scrn_.y()) / rowheight;
+  for (int drow=clamp(srow, 0, disp_rows()-1); drow<=clamp(erow, 0, disp_rows()-1); drow++)
+    dirty_.mark_row(drow);
+}
+
 // Handle mouse selection autoscrolling
 void Fl_Terminal::autoscroll_timer_cb2(void) {
   // Move scrollbar
@@ -3365,7 +4308,7 @@ void Fl_Terminal::autoscroll_timer_cb(void *udata) {
 void Fl_Terminal::redraw_timer_cb2(void) {
   //DRAWDEBUG ::printf("--- UPDATE TICK %.02f\n", redraw_rate_); fflush(stdout);
   if (redraw_modified_) {
-    redraw();                                                // Timer triggered redraw
+    damage(FL_DAMAGE_USER1);                                 // Timer triggered redraw (modified rows only)
     redraw_modified_ = false;                                // acknowledge modified flag
     Fl::repeat_timeout(redraw_rate_, redraw_timer_cb, this); // restart timer
   } else {
@@ -3380,6 +4323,46 @@ void Fl_Terminal::redraw_timer_cb(void *udata) {
   tty->redraw_timer_cb2();
 }
 
+// Drain the output queue written by a worker thread
+//   Runs every redraw_rate() seconds while the queue has text, and appends
+//   what was queued in the meantime. If the queue filled up, the worker
+//   is waiting for room, so draining continues as soon as pending events
+//   and redraws were handled, instead of after redraw_rate(). Appending
+//   stops after half of redraw_rate(), so the UI stays responsive.
+//   Once the queue is empty, the timer stops until queue_append() wakes
+//   up the main thread.
+//
+void Fl_Terminal::queue_timer_cb2(void) {
+  Fl_Timestamp start = Fl::now();
+  double budget = redraw_rate_ / 2;
+  int drained = 0, len;
+  const char *s;
+  while ((s = queue_->peek(len)), len > 0) {
+    if (len > 64*1024) len = 64*1024;                  // check the time now and then
+    append(s, len);
+    queue_->skip(len);
+    drained += len;
+    if (Fl::seconds_since(start) >= budget) break;
+  }
+  bool backlog = (drained >= queue_->size() / 2);      // worker may be waiting for room
+  if (!backlog && queue_->empty() && !queue_->sleep()) return;
+  Fl::repeat_timeout(backlog ? 0.0 : redraw_rate_, queue_timer_cb, this);
+}
+
+void Fl_Terminal::queue_timer_cb(void *udata) {
+  Fl_Terminal *tty = (Fl_Terminal*)udata;
+  tty->queue_timer_cb2();
+}
+
+// Restart draining the queues that a worker woke up
+//   A queue needs it if it is no longer idle, but its timer was stopped.
+//
+void Fl_Terminal::queue_awake_cb(void*) {
+  for (Queue *q = Queue::first_; q; q = q->next_)
+    if (!q->idle() && !Fl::has_timeout(queue_timer_cb, q->term_))
+      Fl::add_timeout(q->term_->redraw_rate_, queue_timer_cb, q->term_);
+}
+
 /**
   The constructor for Fl_Terminal.
 
@@ -3454,6 +4437,7 @@ void Fl_Terminal::init_(int X,int Y,int W,int H,const char*L,int rows,int cols,i
   redraw_rate_     = 0.10f;             // maximum rate in seconds (1/10=10fps)
   redraw_modified_ = false;             // display 'modified' flag
   redraw_timer_    = false;
+  queue_           = 0;
   autoscroll_dir_  = 0;
   autoscroll_amt_  = 0;
 
@@ -3497,6 +4481,8 @@ Fl_Terminal::~Fl_Terminal(void) {
     { Fl::remove_timeout(autoscroll_timer_cb, this); autoscroll_dir_ = 0; }
   if (redraw_timer_)
     { Fl::remove_timeout(redraw_timer_cb, this); redraw_timer_ = false; }
+  if (queue_)
+    { Fl::remove_timeout(queue_timer_cb, this); delete queue_; queue_ = 0; }
   delete current_style_;
 }
 
@@ -3593,8 +4579,9 @@ void  Fl_Terminal::hscrollbar_style(ScrollbarStyle val) {
 
  \param[in] grow row number
  \param[in] X, Y top left corner of the row in FLTK coordinates
+ \param[in] scol, ecol draw only columns scol thru ecol, -1 for ecol is end of row
 */
-void Fl_Terminal::draw_row_bg(int grow, int X, int Y) const {
+void Fl_Terminal::draw_row_bg(int grow, int X, int Y, int scol, int ecol) const {
   int bg_h = current_style_->fontheight();
   int bg_y = Y;
   Fl_Color bg_col;
@@ -3610,8 +4597,12 @@ void Fl_Terminal::draw_row_bg(int grow, int X, int Y) const {
       lastattr = u8c->attrib();
     }
     pwidth = u8c->pwidth_int();
+    if (gcol < scol || (ecol >= 0 && gcol > ecol))       // outside columns to draw?
+      { X += pwidth; continue; }
     bg_col = is_inside_selection(grow, gcol)              // text in mouse select?
                ? select_.selectionbgcolor()               // ..use select bg color
+               : is_search_hilite(grow, gcol)             // text in search match?
+               ? search_.searchbgcolor()                  // ..use search bg color
                : (u8c->attrib() & Fl_Terminal::INVERSE)   // Inverse mode?
                  ? u8c->attr_fg_color(this)               // ..use fg color for bg
                  : u8c->attr_bg_color(this);              // ..use bg color for bg
@@ -3630,11 +4621,12 @@ void Fl_Terminal::draw_row_bg(int grow, int X, int Y) const {
 
  \param[in] grow row number
  \param[in] Y top position of characters in the row in FLTK coordinates
+ \param[in] scol, ecol draw only columns scol thru ecol, -1 for ecol is end of row
 */
-void Fl_Terminal::draw_row(int grow, int Y) const {
+void Fl_Terminal::draw_row(int grow, int Y, int scol, int ecol) const {
   // Draw background color spans, if any
   int X = scrn_.x();
-  draw_row_bg(grow, X, Y);
+  draw_row_bg(grow, X, Y, scol, ecol);
 
   // Draw forground text
   int  baseline = Y + current_style_->fontheight() - current_style_->fontdescent();
@@ -3663,6 +4655,8 @@ void Fl_Terminal::draw_row(int grow, int Y) const {
       lastattr = u8c->attrib();
     }
     int pwidth = u8c->pwidth_int();
+    if (gcol < scol || (ecol >= 0 && gcol > ecol))         // outside columns to draw?
+      { X += pwidth; continue; }
     // DRAW CURSOR BLOCK - TODO: support other cursor types?
     if (is_cursor) {
       int cx = X;
@@ -3678,6 +4672,8 @@ void Fl_Terminal::draw_row(int grow, int Y) const {
     if (is_cursor) fg = cursorfgcolor();                     // color for text under cursor
     else fg = is_inside_selection(grow, gcol)                // text in mouse selection?
       ? select_.selectionfgcolor()                           // ..use selection FG color
+      : is_search_hilite(grow, gcol)                         // text in search match?
+      ? search_.searchfgcolor()                              // ..use search FG color
       : (u8c->attrib() & Fl_Terminal::INVERSE)               // Inverse attrib?
         ? u8c->attr_bg_color(this)                           // ..use char's bg color for fg
         : u8c->attr_fg_color(this);                          // ..use char's fg color for fg
@@ -3718,10 +4714,94 @@ void Fl_Terminal::draw_buff(int Y) const {
   }
 }
 
+/**
+  Repaints only the display rows modified since the last draw().
+
+  Output to the terminal marks the columns it changes in each display row,
+  and draw() uses this instead of drawing the entire screen when only
+  the terminal's text changed, i.e. damage() is FL_DAMAGE_USER1, so the
+  cost of a redraw is proportional to the number of modified characters.
+  Each modified span is clipped, its background refilled, and its characters
+  redrawn, including one character on either side for glyphs that overhang.
+
+  If output scrolled the display up, the rows already on the screen are first
+  moved up with fl_scroll(), so only the rows scrolled in at the bottom and
+  the modified spans need to be drawn. This is only done if the screen can be
+  copied exactly: the display isn't scrolled back, the background is flat,
+  i.e. box() is a frame, and the scaling factor is a whole number. Any area
+  fl_scroll() can't copy, e.g. if the window is obscured, is redrawn.
+
+  Returns false if nothing was drawn because the view changed since the last
+  draw() (scrolling, resizing, etc), and the entire screen must be redrawn.
+*/
+bool Fl_Terminal::draw_dirty_rows(void) {
+  int vscroll = scrollbar->value();
+  int hscroll = hscrollbar->visible() ? hscrollbar->value() : 0;
+  if (dirty_.all() || dirty_.rows() != disp_rows() ||
+      !dirty_.is_view(vscroll, hscroll, offset(), disp_cols()))
+    return false;
+  const int rowheight = current_style_->fontheight();
+  // Output scrolled the display? Move the rows on the screen up
+  if (dirty_.scrolled()) {
+    float scale = Fl_Surface_Device::surface()->driver()->scale();
+    if (vscroll != 0 || !is_frame(box()) || scale != int(scale)) return false;
+    int H = disp_rows() * rowheight;
+    if (H > scrn_.h()) H = scrn_.h();
+    fl_scroll(scrn_.x(), scrn_.y(), scrn_.w(), H, 0, -dirty_.scrolled() * rowheight,
+              scroll_area_cb, (void*)this);
+  }
+  // Cursor moved? Erase it from the old position, draw at the new one
+  if (dirty_.cursor_row() >= 0)      // (not scrolled off the top)
+    dirty_.mark(dirty_.cursor_row(), dirty_.cursor_col(), dirty_.cursor_col());
+  dirty_.mark(cursor_.row(), cursor_.col(), cursor_.col());
+  if (dirty_.all()) return false;  // cursor was outside display
+  fl_push_clip(scrn_.x(), scrn_.y(), scrn_.w(), scrn_.h());
+  for (int drow=0; drow<disp_rows(); drow++) {
+    if (!dirty_.is_dirty(drow)) continue;
+    if (drow + vscroll >= disp_rows()) break;               // scrolled back? rest offscreen
+    int Y = scrn_.y() + (drow + vscroll) * rowheight;
+    int grow = disp_srow() + drow;
+    int scol = dirty_.scol(drow);
+    int ecol = dirty_.ecol(drow) < disp_cols() ? dirty_.ecol(drow) : disp_cols()-1;
+    if (search_.highlight_all() && search_.is_search())     // matches may change anywhere
+      { scol = 0; ecol = disp_cols()-1; dirty_.mark_row(drow); }
+    // Find pixel span of the modified columns
+    int X1 = scrn_.x(), X2 = scrn_.x();
+    const Utf8Char *u8c = utf8_char_at_glob(grow, hscroll);
+    uchar lastattr = -1;
+    for (int gcol=hscroll; gcol<=ecol; gcol++,u8c++) {
+      if (u8c->attrib() != lastattr)
+        { u8c->fl_font_set(*current_style_); lastattr = u8c->attrib(); }
+      if (gcol < scol) X1 += u8c->pwidth_int();
+      X2 += u8c->pwidth_int();
+    }
+    if (X2 <= X1) continue;                                 // scrolled off to the left
+    if (dirty_.ecol(drow) >= disp_cols()-1) X2 = scrn_.r(); // to last col? clear to edge
+    fl_push_clip(X1, Y, X2-X1, rowheight);
+    {
+      if (is_frame(box())) {
+        fl_color(Fl_Group::color());
+        fl_rectf(X1, Y, X2-X1, rowheight);
+      } else {
+        draw_box(box(), x(), y(), w(), h(), Fl_Group::color());
+      }
+      draw_row(grow, Y, scol-1, ecol+1);
+    }
+    fl_pop_clip();
+  }
+  fl_pop_clip();
+  dirty_.clear();
+  dirty_.view(vscroll, hscroll, offset(), disp_cols(), cursor_.row(), cursor_.col());
+  return true;
+}
+
 /**
   Draws the entire Fl_Terminal.
   Lets the group draw itself first (scrollbars should be only members),
   followed by the terminal's screen contents.
+
+  If only the terminal's text was modified, only the modified rows are
+  redrawn, see draw_dirty_rows().
 */
 void Fl_Terminal::draw(void) {
   // First time shown? Force deferred font size calculations here (issue 837)
@@ -3730,11 +4810,21 @@ void Fl_Terminal::draw(void) {
     current_style_->update();   // do deferred update here
     update_screen(true);        // update fonts
   }
+  search_.hilite_clear();       // text may have changed, find search matches again
   // Detect if Fl::scrollbar_size() was changed in size, recalc if so
   if (scrollbar_size_ == 0 &&
       ((scrollbar->visible() && scrollbar->w() != Fl::scrollbar_size()) ||
        (hscrollbar->visible() && hscrollbar->h() != Fl::scrollbar_size()))) {
     update_scrollbar();
+    dirty_.mark_all();
+  }
+  // Only text modified? Draw just the modified rows, and scrollbars if damaged
+  if (!(damage() & ~(FL_DAMAGE_USER1|FL_DAMAGE_CHILD)) && draw_dirty_rows()) {
+    if (damage() & FL_DAMAGE_CHILD) {
+      update_child(*scrollbar);
+      update_child(*hscrollbar);
+    }
+    return;
   }
   // Draw group first, terminal last
   Fl_Group::draw();
@@ -3769,6 +4859,11 @@ void Fl_Terminal::draw(void) {
     draw_buff(Y);
   }
   fl_pop_clip();
+  // Entire screen is up to date now
+  if (dirty_.rows() != disp_rows()) dirty_.resize(disp_rows());
+  dirty_.clear();
+  dirty_.view(scrollbar->value(), (hscrollbar->visible() ? hscrollbar->value() : 0),
+              offset(), disp_cols(), cursor_.row(), cursor_.col());
 }
 
 /**
@@ -3792,10 +4887,18 @@ int Fl_Terminal::h_to_row(int H) const {
   This may increase the column width of the widget if the width
   of the widget is made larger than it was.
 
-  \note Resizing currently does not rewrap existing text.
-  Currently enlarging makes room for longer lines, and shrinking
-  the size lets long lines run off the right edge of the display,
-  hidden from view. This behavior may change in the future to rewrap.
+  Only the rows that move into or out of the display are unpacked or
+  packed, and a change of width copies only the display rows; the text of
+  the scrollback history is neither copied nor repacked. The ring buffer
+  that holds the rows is reallocated when it becomes too small, or much
+  larger than needed. That step relinks every row of the history, so it
+  takes time proportional to history_rows(), though no text is copied.
+
+  \note Resizing does not rewrap existing text. The terminal doesn't record
+  where a line was wrapped at the right edge, so a wrapped line stays split
+  over the same rows. Enlarging makes room for longer lines, and shrinking
+  the width cuts off the text of the display rows beyond the new width.
+  This behavior may change in the future to rewrap.
 */
 void Fl_Terminal::resize(int X,int Y,int W,int H) {
   // Let group resize itself
@@ -4085,6 +5188,101 @@ void  Fl_Terminal::redraw_rate(float val) {
   redraw_rate_ = val;
 }
 
+/**
+  Returns the size of the output queue in bytes, 0 if there is none.
+  \see queue_size(int), queue_append()
+*/
+int Fl_Terminal::queue_size(void) const {
+  return queue_ ? queue_->size() : 0;
+}
+
+/**
+  Creates an output queue of at least \p val bytes for queue_append().
+
+  The size is rounded up to a power of 2. A larger queue lets the worker
+  thread run further ahead of the terminal, 64 KB is a good start.
+  Anything left in a previous queue is appended to the terminal first.
+  A value of 0 removes the queue.
+
+  This must be called on the main thread, after the worker thread
+  stopped calling queue_append(), which would otherwise write to the
+  deleted queue.
+
+  \see queue_append()
+*/
+void Fl_Terminal::queue_size(int val) {
+  if (queue_) {
+    int len;
+    const char *s;
+    while ((s = queue_->peek(len)), len > 0)
+      { append(s, len); queue_->skip(len); }
+    Fl::remove_timeout(queue_timer_cb, this);
+    delete queue_;
+    queue_ = 0;
+  }
+  if (val > 0) {
+    queue_ = new Queue(val, this);
+    Fl::add_timeout(redraw_rate_, queue_timer_cb, this);
+  }
+}
+
+/**
+  Appends text to the terminal from a worker thread, without locking.
+
+  The text is written into a lock-free queue, created with queue_size(int),
+  and the main thread appends the queued text to the terminal every
+  redraw_rate() seconds. Only one thread may call queue_append() at a time.
+  The worker does not call Fl::lock(), so a thread reading a pipe or a
+  serial port never waits for the main thread unless the queue is full.
+  While the queue is empty, the main thread does not check it, and the
+  worker wakes it up with Fl::awake(). So, as for any use of threads with
+  FLTK, the program must call Fl::lock() once before it starts the worker.
+  The text is handled as if it was passed to append(), and may end in the
+  middle of a UTF-8 character or an escape sequence.
+
+  If the queue is full and \p wait is true, the calling thread sleeps
+  until the main thread made enough room, which slows down a thread that
+  produces more output than the terminal can show. If \p wait is false,
+  the bytes that fit are queued, and the return value tells how many;
+  the caller should try the rest again later. Don't call this with
+  \p wait true on the main thread, which would wait forever for itself.
+
+  The worker thread must be stopped before the terminal is deleted, and
+  before queue_size(int) removes or replaces the queue. A queue_append()
+  that is still running would write to freed memory.
+
+  Example:
+  \code
+    // main thread
+    Fl::lock();
+    tty->queue_size(64*1024);
+    // worker thread
+    char buf[4096];
+    int n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+      tty->queue_append(buf, n);
+  \endcode
+
+  \param[in] s text to append
+  \param[in] len length of \p s in bytes, or -1 if \p s is NUL terminated
+  \param[in] wait if true, wait until all of \p s was queued
+  \returns number of bytes queued, or -1 if there is no queue
+  \see queue_size(int), append()
+*/
+int Fl_Terminal::queue_append(const char *s, int len, bool wait) {
+  if (!queue_) return -1;
+  if (len < 0) len = (int)strlen(s);
+  int done = 0;
+  for (;;) {
+    done += queue_->put(s + done, len - done);
+    if (queue_->wake())                              // main thread stopped draining?
+      Fl::awake_once(queue_awake_cb);
+    if (done >= len || !wait) break;
+    Fl::system_driver()->sleep_ms(1);                // full? let the main thread catch up
+  }
+  return done;
+}
+
 /**
   Return the "show unknown" flag.
   \see show_unknown(bool), error_char(const char*).
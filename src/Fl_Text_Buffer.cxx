@@ -20,9 +20,16 @@
 #include <FL/fl_string_functions.h>
 #include "flstring.h"
 #include <ctype.h>
+#include <limits.h>
 #include <FL/Fl.H>
 #include <FL/Fl_Text_Buffer.H>
 #include <FL/fl_ask.H>
+#include "Fl_System_Driver.H"
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <atomic>
 
 
 /*
@@ -66,6 +73,163 @@ static int min(int i1, int i2)
 
 #endif
 
+/*
+ Byte scanning kernels used for searching and counting.
+
+ They work on one contiguous part of the buffer, so callers handle the text
+ before and after the gap separately. SSE2 is part of every x86-64 CPU and is
+ used when the compiler targets it; otherwise a portable loop is used. Single
+ byte forward searches use memchr(), which C libraries already vectorize.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define USE_SSE2 1
+#endif
+
+static inline char ascii_lower(char c) { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; }
+static inline char ascii_upper(char c) { return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c; }
+
+// Return the first byte in [p, p+n) that is c1 or c2, or NULL.
+static const char *scan_forward(const char *p, int n, char c1, char c2)
+{
+  if (n <= 0)
+    return NULL;
+  if (c1 == c2)
+    return (const char *)memchr(p, c1, n);
+  const char *e = p + n;
+#ifdef USE_SSE2
+  const __m128i v1 = _mm_set1_epi8(c1), v2 = _mm_set1_epi8(c2);
+  for ( ; e - p >= 16; p += 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *)p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(b, v1), _mm_cmpeq_epi8(b, v2)));
+    if (mask) {
+      while (!(mask & 1)) { mask >>= 1; p++; }
+      return p;
+    }
+  }
+#endif
+  for ( ; p < e; p++)
+    if (*p == c1 || *p == c2)
+      return p;
+  return NULL;
+}
+
+// Return the last byte in [p, p+n) that is c1 or c2, or NULL.
+static const char *scan_backward(const char *p, int n, char c1, char c2)
+{
+  if (n <= 0)
+    return NULL;
+  const char *e = p + n;
+#ifdef USE_SSE2
+  const __m128i v1 = _mm_set1_epi8(c1), v2 = _mm_set1_epi8(c2);
+  for ( ; e - p >= 16; e -= 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *)(e - 16));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(b, v1), _mm_cmpeq_epi8(b, v2)));
+    if (mask) {
+      int i = 15;
+      while (!(mask & (1 << i))) i--;
+      return e - 16 + i;
+    }
+  }
+#endif
+  while (e > p) {
+    --e;
+    if (*e == c1 || *e == c2)
+      return e;
+  }
+  return NULL;
+}
+
+// Return the number of bytes in [p, p+n) that are c.
+static int count_bytes(const char *p, int n, char c)
+{
+  int count = 0;
+  const char *e = p + n;
+#ifdef USE_SSE2
+  const __m128i v = _mm_set1_epi8(c), zero = _mm_setzero_si128();
+  while (e - p >= 16) {
+    // each 8 bit lane can count 255 matches before the lanes are summed up
+    __m128i acc = zero;
+    const char *blockEnd = p + 16 * min((int)((e - p) / 16), 255);
+    for ( ; p < blockEnd; p += 16)
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), v));
+    __m128i sum = _mm_sad_epu8(acc, zero);
+    count += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+  }
+#endif
+  for ( ; p < e; p++)
+    if (*p == c)
+      count++;
+  return count;
+}
+
+// Compare n bytes, optionally ignoring the case of ASCII letters.
+static bool bytes_equal(const char *a, const char *b, int n, bool ignoreCase)
+{
+  if (!ignoreCase)
+    return memcmp(a, b, n) == 0;
+  for (int i = 0; i < n; i++)
+    if (ascii_lower(a[i]) != ascii_lower(b[i]))
+      return false;
+  return true;
+}
+
+// Return true if the string is pure ASCII.
+static bool is_ascii(const char *s)
+{
+  for ( ; *s; s++)
+    if (*s & 0x80)
+      return false;
+  return true;
+}
+
+// Return true if [p, p+n) is valid UTF-8, skipping ASCII runs quickly.
+static bool is_utf8(const char *p, size_t n)
+{
+  const char *e = p + n;
+  while (p < e) {
+#ifdef USE_SSE2
+    while (e - p >= 16 && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p)))
+      p += 16;
+    if (p == e)
+      break;
+#endif
+    if (*p & 0x80) {
+      int len;
+      fl_utf8decode(p, e, &len);
+      if (len < 2)
+        return false;
+      p += len;
+    } else {
+      p++;
+    }
+  }
+  return true;
+}
+
+
+/*
+ Return the size of the gap to allocate when the buffer must grow to insert
+ \p needed bytes.
+
+ A fixed size gap makes every large insertion (for instance each chunk read
+ by insertfile()) reallocate and copy the entire buffer, which is quadratic
+ when loading or pasting big documents. The gap therefore grows with the
+ buffer, so that reallocations become rare. The extra room is limited so
+ that the size of the buffer still fits into an int.
+
+ This only addresses the cost of reallocation. Moving the gap to a new edit
+ position is still a memmove() of the distance between the old and the new
+ position, so alternating edits at the two ends of a large buffer still cost
+ time proportional to the size of the buffer each. Buffers that are edited
+ like that can use Fl_Text_Buffer::piece_table() instead.
+ */
+static int grown_gap_size(int length, int needed, int preferredGapSize)
+{
+  int room = INT_MAX - length - needed;
+  return needed + max(min(max(preferredGapSize, length / 8), room), 0);
+}
+
 /*
  Undo/Redo is handled with Fl_Text_Undo_Action. The names of the class members
  relate to the original action.
@@ -123,6 +287,29 @@ public:
   bool empty() const {
     return (!undocut && !undoinsert);
   }
+
+  /*
+   Release the unused part of the undo buffer. Called when the action is
+   stored in a list, where it is not modified anymore.
+   */
+  void compact() {
+    int n = undocut > undoyankcut ? undocut : undoyankcut;
+    if (n == 0) {
+      if (undobuffer) ::free(undobuffer);
+      undobuffer = NULL;
+      undobufferlength = 0;
+    } else if (n < undobufferlength) {
+      undobuffer = (char *)realloc(undobuffer, n);
+      undobufferlength = n;
+    }
+  }
+
+  /*
+   Return the number of bytes of memory used by this action.
+   */
+  int bytes() const {
+    return (int)sizeof(Fl_Text_Undo_Action) + undobufferlength;
+  }
 };
 
 /*
@@ -139,18 +326,27 @@ public:
  current.
 
  A list can be locked to be protected from purging while running an undo event.
+
+ Actions are compacted when they are pushed, and the list keeps track of
+ the memory they use. If a byte budget is set, the oldest actions are
+ dropped until the list fits into the budget again. The most recent action
+ is always kept.
  */
 class Fl_Text_Undo_Action_List {
   Fl_Text_Undo_Action** list_;
   int list_size_;
   int list_capacity_;
   bool locked_;
+  int bytes_;
+  int budget_;
 public:
   Fl_Text_Undo_Action_List() :
   list_(NULL),
   list_size_(0),
   list_capacity_(0),
-  locked_(false)
+  locked_(false),
+  bytes_(0),
+  budget_(0)
   { }
 
   ~Fl_Text_Undo_Action_List() {
@@ -167,17 +363,45 @@ public:
       list_capacity_ += 25;
       list_ = (Fl_Text_Undo_Action**)realloc(list_, list_capacity_ * sizeof(Fl_Text_Undo_Action*));
     }
+    action->compact();
     list_[list_size_++] = action;
+    bytes_ += action->bytes();
+    trim();
   }
 
   Fl_Text_Undo_Action* pop() {
     if (list_size_ > 0) {
-      return list_[--list_size_];
+      Fl_Text_Undo_Action* action = list_[--list_size_];
+      bytes_ -= action->bytes();
+      return action;
     } else {
       return NULL;
     }
   }
 
+  int bytes() const {
+    return bytes_;
+  }
+
+  void budget(int n) {
+    budget_ = n;
+    trim();
+  }
+
+  /*
+   Drop the oldest actions until the list fits into the budget.
+   */
+  void trim() {
+    if (budget_ <= 0 || bytes_ <= budget_) return;
+    int n = 0;
+    while (n < list_size_ - 1 && bytes_ > budget_) {
+      bytes_ -= list_[n]->bytes();
+      delete list_[n++];
+    }
+    list_size_ -= n;
+    memmove(list_, list_ + n, list_size_ * sizeof(Fl_Text_Undo_Action*));
+  }
+
   void clear() {
     if (locked_) return;
     if (list_) {
@@ -189,6 +413,7 @@ public:
     list_ = NULL;
     list_size_ = 0;
     list_capacity_ = 0;
+    bytes_ = 0;
   }
 
   void lock() { locked_ = true; }
@@ -196,6 +421,561 @@ public:
 };
 
 
+/*
+ A transaction collects the modifications made between begin_transaction()
+ and end_transaction(). Instead of calling the modify and predelete
+ callbacks for every single change, it keeps track of the smallest range
+ that contains all changes, and of the original text of that range. Text
+ outside of the range is still unchanged, so the range can be extended by
+ copying from the buffer. The original text is kept in chunks, so that
+ extending the range at either end does not move the text collected so far.
+ */
+class Fl_Text_Transaction {
+public:
+  Fl_Text_Transaction() :
+    depth(1),
+    start(-1),
+    end(-1)
+  { }
+
+  int depth;                        // nesting level of begin_transaction()
+  int start, end;                   // changed range, or -1 if unchanged
+  std::vector<std::string> before;  // original text before the first change,
+                                    // last chunk is the leftmost one
+  std::string after;                // original text from the first change on
+
+  std::string original() const {
+    std::string s;
+    for (size_t i = before.size(); i > 0; i--)
+      s += before[i-1];
+    return s + after;
+  }
+};
+
+
+/*
+ The line index keeps the byte offset of every newline character in the
+ buffer, so that line numbers and line start positions can be found with a
+ binary search instead of scanning the text byte by byte.
+
+ Offsets are stored in blocks of a few hundred entries. Every block stores
+ its entries relative to a base offset, together with the number of newlines
+ in all blocks before it. An edit only modifies the entries of the block at
+ the edit position and adjusts the base offset and newline count of all
+ following blocks, so the index can be kept up to date in insert_() and
+ remove_() at a small fraction of the cost of rescanning the text.
+
+ The index is created on demand by Fl_Text_Buffer::line_index() when a line
+ based query is made on a buffer that is large enough to profit from it.
+ */
+class Fl_Text_Line_Index {
+
+  struct Block {
+    int base;               // offset that all entries in rel are relative to
+    int first;              // number of newlines in all previous blocks
+    std::vector<int> rel;   // ascending newline offsets, relative to base
+  };
+
+  enum { BLOCK_SIZE = 512 };
+
+  std::vector<Block> blocks_;
+
+  // Recalculate the newline count in front of each block, starting at block b.
+  void renumber(int b) {
+    if (b < 1) {
+      b = 0;
+      if (!blocks_.empty()) blocks_[0].first = 0;
+      b = 1;
+    }
+    for (int n = (int)blocks_.size(); b < n; b++)
+      blocks_[b].first = blocks_[b-1].first + (int)blocks_[b-1].rel.size();
+  }
+
+  // Append the absolute newline offset pos at the end of the index.
+  void push_back(int pos) {
+    if (blocks_.empty() || (int)blocks_.back().rel.size() >= BLOCK_SIZE) {
+      blocks_.push_back(Block());
+      blocks_.back().base = pos;
+      blocks_.back().first = 0;
+    }
+    blocks_.back().rel.push_back(pos - blocks_.back().base);
+  }
+
+  // Find the block b and the index i within that block of newline n.
+  // If n is count(), i is the size of the last block.
+  void locate(int n, int &b, int &i) const {
+    int lo = 0, hi = (int)blocks_.size() - 1;
+    while (lo < hi) {
+      int mid = (lo + hi + 1) / 2;
+      if (blocks_[mid].first <= n) lo = mid; else hi = mid - 1;
+    }
+    b = lo;
+    i = n - blocks_[lo].first;
+  }
+
+  // Add delta to all entries starting with entry i in block b.
+  void shift(int b, int i, int delta) {
+    std::vector<int> &rel = blocks_[b].rel;
+    for (int n = (int)rel.size(); i < n; i++)
+      rel[i] += delta;
+    for (int n = (int)blocks_.size(); ++b < n; )
+      blocks_[b].base += delta;
+  }
+
+  static void scan(std::vector<int> &out, const char *text, int len, int offset) {
+    const char *p = text, *e = text + len;
+    while (p < e) {
+      const char *q = (const char *)memchr(p, '\n', e - p);
+      if (!q) break;
+      out.push_back(offset + (int)(q - text));
+      p = q + 1;
+    }
+  }
+
+public:
+
+  // Index the text of a buffer.
+  void build(const Fl_Text_Buffer *buf) {
+    std::vector<int> nl;
+    const char *text;
+    blocks_.clear();
+    for (int pos = 0, n; (n = buf->read_chunk(pos, buf->length(), &text)); pos += n)
+      scan(nl, text, n, pos);
+    for (int i = 0, n = (int)nl.size(); i < n; i++)
+      push_back(nl[i]);
+    renumber(0);
+  }
+
+  // Number of newline characters in the buffer.
+  int count() const {
+    if (blocks_.empty()) return 0;
+    return blocks_.back().first + (int)blocks_.back().rel.size();
+  }
+
+  // Number of newline characters at an offset smaller than pos.
+  int rank(int pos) const {
+    int lo = 0, hi = (int)blocks_.size() - 1, b = -1;
+    while (lo <= hi) {
+      int mid = (lo + hi) / 2;
+      const Block &k = blocks_[mid];
+      if (k.base + k.rel[0] < pos) { b = mid; lo = mid + 1; } else hi = mid - 1;
+    }
+    if (b < 0) return 0;
+    const Block &k = blocks_[b];
+    return k.first + (int)(std::lower_bound(k.rel.begin(), k.rel.end(), pos - k.base) - k.rel.begin());
+  }
+
+  // Byte offset of newline n, counting from 0. n must be less than count().
+  int position(int n) const {
+    int b, i;
+    locate(n, b, i);
+    return blocks_[b].base + blocks_[b].rel[i];
+  }
+
+  // Update the index after len bytes of text were inserted at pos.
+  void inserted(int pos, const char *text, int len) {
+    if (len <= 0) return;
+    std::vector<int> nl;
+    scan(nl, text, len, pos);
+    if (blocks_.empty()) {
+      for (int j = 0, n = (int)nl.size(); j < n; j++)
+        push_back(nl[j]);
+      renumber(0);
+      return;
+    }
+    int b, i;
+    locate(rank(pos), b, i);
+    shift(b, i, len);
+    if (nl.empty()) return;
+    Block &k = blocks_[b];
+    if ((int)nl.size() <= BLOCK_SIZE) {
+      for (int j = 0, n = (int)nl.size(); j < n; j++)
+        nl[j] -= k.base;
+      k.rel.insert(k.rel.begin() + i, nl.begin(), nl.end());
+      if ((int)k.rel.size() > 2 * BLOCK_SIZE) {
+        Block tail;
+        tail.base = k.base;
+        tail.first = 0;
+        tail.rel.assign(k.rel.begin() + BLOCK_SIZE, k.rel.end());
+        k.rel.resize(BLOCK_SIZE);
+        blocks_.insert(blocks_.begin() + b + 1, tail);
+      }
+    } else {
+      // split block b at the insertion point and put new blocks in between
+      std::vector<Block> add;
+      for (int j = 0, n = (int)nl.size(); j < n; j += BLOCK_SIZE) {
+        add.push_back(Block());
+        Block &a = add.back();
+        a.base = nl[j];
+        a.first = 0;
+        for (int m = j; m < n && m < j + BLOCK_SIZE; m++)
+          a.rel.push_back(nl[m] - a.base);
+      }
+      if (i < (int)k.rel.size()) {
+        add.push_back(Block());
+        add.back().base = k.base;
+        add.back().first = 0;
+        add.back().rel.assign(k.rel.begin() + i, k.rel.end());
+        k.rel.resize(i);
+      }
+      bool empty = k.rel.empty();
+      blocks_.insert(blocks_.begin() + b + 1, add.begin(), add.end());
+      if (empty)
+        blocks_.erase(blocks_.begin() + b);
+    }
+    renumber(b);
+  }
+
+  // Update the index before the text between start and end is removed.
+  void removed(int start, int end) {
+    int len = end - start;
+    if (len <= 0 || blocks_.empty()) return;
+    int lo = rank(start), hi = rank(end);
+    int b1, i1, b2, i2;
+    if (hi > lo) {
+      locate(lo, b1, i1);
+      locate(hi, b2, i2);
+      if (b1 == b2) {
+        blocks_[b1].rel.erase(blocks_[b1].rel.begin() + i1, blocks_[b1].rel.begin() + i2);
+      } else {
+        blocks_[b2].rel.erase(blocks_[b2].rel.begin(), blocks_[b2].rel.begin() + i2);
+        blocks_[b1].rel.resize(i1);
+        blocks_.erase(blocks_.begin() + b1 + 1, blocks_.begin() + b2);
+      }
+      for (int b = b1 + 1; b >= b1; b--) {
+        if (b < (int)blocks_.size() && blocks_[b].rel.empty())
+          blocks_.erase(blocks_.begin() + b);
+      }
+      renumber(b1);
+    }
+    if (lo < count()) {
+      locate(lo, b1, i1);
+      shift(b1, i1, -len);
+    }
+  }
+};
+
+
+/*
+ The text of a buffer in piece table mode, see Fl_Text_Buffer::piece_table().
+
+ The text is a sequence of pieces, each of which points to a contiguous run
+ of bytes that is never modified: either the text that the buffer held when
+ it entered piece table mode (the two parts of its gap buffer, or a mapped
+ file), or text that was inserted since, which is appended to blocks that
+ are never moved. An edit only splits, adds, and drops pieces, so its cost
+ does not depend on the distance to the previous edit.
+
+ The pieces are kept in a treap: a binary tree in text order that every
+ piece also keeps in heap order of a random priority, which makes its
+ expected depth logarithmic. Each piece stores the number of bytes in its
+ subtree, so the piece at an offset is found in O(log n).
+
+ Typing at the same position extends the last piece instead of adding one.
+ The last piece that was found is remembered, so reading the text byte by
+ byte does not search the tree for every byte.
+ */
+class Fl_Text_Piece_Table {
+
+  struct Piece {
+    const char *text;       // the bytes of this piece
+    int len;                // number of bytes in this piece
+    int size;               // number of bytes in this piece and its subtrees
+    unsigned prio;          // heap order that keeps the tree balanced
+    Piece *left, *right;
+  };
+
+  enum { BLOCK_SIZE = 64 * 1024 };
+
+  Piece *root_;
+  unsigned seed_;
+  std::vector<char *> blocks_;  // inserted text, the last block is filled up
+  int used_, capacity_;         // bytes used and allocated in the last block
+  mutable int hitStart_, hitLen_; // offset and length of the last piece found
+  mutable const char *hitText_;
+
+  static int size(const Piece *p) { return p ? p->size : 0; }
+
+  static void update(Piece *p) { p->size = size(p->left) + p->len + size(p->right); }
+
+  Piece *make(const char *text, int len) {
+    Piece *p = new Piece;
+    seed_ ^= seed_ << 13; seed_ ^= seed_ >> 17; seed_ ^= seed_ << 5;
+    p->text = text;
+    p->len = p->size = len;
+    p->prio = seed_;
+    p->left = p->right = NULL;
+    return p;
+  }
+
+  static void destroy(Piece *p) {
+    while (p) {
+      destroy(p->left);
+      Piece *right = p->right;
+      delete p;
+      p = right;
+    }
+  }
+
+  // Split the tree t into the pieces before and after pos, which must be
+  // at the boundary of two pieces.
+  static void split(Piece *t, int pos, Piece *&l, Piece *&r) {
+    if (!t) {
+      l = r = NULL;
+    } else if (pos <= size(t->left)) {
+      split(t->left, pos, l, t->left);
+      update(t);
+      r = t;
+    } else {
+      split(t->right, pos - size(t->left) - t->len, t->right, r);
+      update(t);
+      l = t;
+    }
+  }
+
+  // Join two trees, all pieces of l come before the pieces of r.
+  static Piece *merge(Piece *l, Piece *r) {
+    if (!l) return r;
+    if (!r) return l;
+    if (l->prio > r->prio) {
+      l->right = merge(l->right, r);
+      update(l);
+      return l;
+    }
+    r->left = merge(l, r->left);
+    update(r);
+    return r;
+  }
+
+  // Insert piece p at pos, which must be at the boundary of two pieces.
+  static Piece *insert_piece(Piece *t, int pos, Piece *p) {
+    if (!t) return p;
+    if (p->prio > t->prio) {
+      split(t, pos, p->left, p->right);
+      update(p);
+      return p;
+    }
+    int ls = size(t->left);
+    if (pos <= ls)
+      t->left = insert_piece(t->left, pos, p);
+    else
+      t->right = insert_piece(t->right, pos - ls - t->len, p);
+    update(t);
+    return t;
+  }
+
+  // Shorten the piece that contains pos to end at pos. Returns the text after
+  // pos in that piece, or NULL if pos is already at a boundary.
+  static const char *shorten(Piece *t, int pos, int &len) {
+    if (!t) return NULL;
+    int ls = size(t->left);
+    const char *rest = NULL;
+    if (pos < ls) {
+      rest = shorten(t->left, pos, len);
+    } else if (pos > ls + t->len) {
+      rest = shorten(t->right, pos - ls - t->len, len);
+    } else if (pos > ls && pos < ls + t->len) {
+      rest = t->text + pos - ls;
+      len = ls + t->len - pos;
+      t->len = pos - ls;
+    }
+    if (rest)
+      t->size -= len;
+    return rest;
+  }
+
+  // Extend the piece that ends at pos by n bytes, if its text continues at text.
+  static bool extend(Piece *t, int pos, const char *text, int n) {
+    if (!t) return false;
+    int ls = size(t->left);
+    bool done;
+    if (pos <= ls)
+      done = extend(t->left, pos, text, n);
+    else if (pos > ls + t->len)
+      done = extend(t->right, pos - ls - t->len, text, n);
+    else
+      done = (pos == ls + t->len && t->text + t->len == text);
+    if (done) {
+      if (pos == ls + t->len) t->len += n;
+      t->size += n;
+    }
+    return done;
+  }
+
+  // Make pos the boundary of two pieces.
+  void cut(int pos) {
+    int len;
+    const char *rest = shorten(root_, pos, len);
+    if (rest)
+      root_ = insert_piece(root_, pos, make(rest, len));
+  }
+
+  // Copy text into the last block, unless it was already read there.
+  const char *store(const char *text, int len) {
+    if (blocks_.empty() || text != blocks_.back() + used_) {
+      char *p = reserve(len);
+      memcpy(p, text, len);
+      text = p;
+    }
+    used_ += len;
+    return text;
+  }
+
+public:
+
+  // Start with the text of a gap buffer, given as the two parts around the gap.
+  Fl_Text_Piece_Table(const char *s1, int n1, const char *s2, int n2) :
+    root_(NULL),
+    seed_(2463534242u),
+    used_(0),
+    capacity_(0),
+    hitStart_(0),
+    hitLen_(0),
+    hitText_(NULL)
+  {
+    if (n1 > 0) root_ = merge(root_, make(s1, n1));
+    if (n2 > 0) root_ = merge(root_, make(s2, n2));
+  }
+
+  ~Fl_Text_Piece_Table() {
+    destroy(root_);
+    for (size_t i = 0; i < blocks_.size(); i++)
+      ::free(blocks_[i]);
+  }
+
+  // Return memory at the end of the last block where len bytes can be
+  // written, and inserted without copying them again.
+  char *reserve(int len) {
+    if (blocks_.empty() || capacity_ - used_ < len) {
+      capacity_ = len > BLOCK_SIZE ? len : BLOCK_SIZE;
+      blocks_.push_back((char *)malloc(capacity_));
+      used_ = 0;
+    }
+    return blocks_.back() + used_;
+  }
+
+  // Insert len bytes of text at pos.
+  void insert(int pos, const char *text, int len) {
+    if (len <= 0) return;
+    text = store(text, len);
+    hitLen_ = 0;
+    if (!extend(root_, pos, text, len)) {
+      cut(pos);
+      root_ = insert_piece(root_, pos, make(text, len));
+    }
+  }
+
+  // Remove the text between start and end.
+  void remove(int start, int end) {
+    Piece *l, *m, *r;
+    if (start >= end) return;
+    hitLen_ = 0;
+    cut(start);
+    cut(end);
+    split(root_, start, l, m);
+    split(m, end - start, m, r);
+    destroy(m);
+    root_ = merge(l, r);
+  }
+
+  // Return the number of contiguous bytes at pos up to the end of its piece,
+  // and their address in text. pos must be less than the length of the text.
+  int at(int pos, const char **text) const {
+    if (pos < hitStart_ || pos >= hitStart_ + hitLen_) {
+      const Piece *p = root_;
+      int base = 0;
+      for (;;) {
+        int ls = size(p->left);
+        if (pos < base + ls) {
+          p = p->left;
+        } else if (pos >= base + ls + p->len) {
+          base += ls + p->len;
+          p = p->right;
+        } else {
+          break;
+        }
+      }
+      hitStart_ = base + size(p->left);
+      hitLen_ = p->len;
+      hitText_ = p->text;
+    }
+    *text = hitText_ + (pos - hitStart_);
+    return hitStart_ + hitLen_ - pos;
+  }
+
+  // Return the number of contiguous bytes before pos back to the start of
+  // their piece, and the address of the first one in text. pos must be
+  // greater than 0.
+  int before(int pos, const char **text) const {
+    at(pos - 1, text);
+    *text = hitText_;
+    return pos - hitStart_;
+  }
+};
+
+
+/*
+ A file that is read by loadfile_async() or written by savefile_async().
+
+ The file is processed in batches of a few chunks. Each batch runs on a
+ worker thread, or on the main thread from a timeout if the platform can't
+ create threads. While a batch runs, the worker owns all members except
+ `ready`, `cancelled`, and `done`, which the main thread may read for the
+ progress. When it is done, it sets `ready` and wakes up the main thread
+ with Fl::awake(). The main thread starts the next batch before
+ it inserts the text that was read, so reading the file overlaps with
+ updating the buffer and the displays.
+
+ The main thread also polls `ready` from a timeout, so that jobs finish
+ even if the program never called Fl::lock(), just more slowly.
+ */
+class Fl_Text_Async_Job {
+public:
+  Fl_Text_Async_Job(Fl_Text_Buffer *b, FILE *f, bool s, int len);
+  ~Fl_Text_Async_Job();
+
+  void detach();
+
+  static void start(Fl_Text_Async_Job *job);
+
+private:
+  enum { BATCH_CHUNKS = 8 };
+
+  Fl_Text_Buffer *buffer;     // NULL if the job was cancelled
+  Fl_Text_Async_Cb cb;
+  void *cbArg;
+  FILE *fp;
+  bool save;                  // writing, else reading
+  int buflen;                 // chunk size
+  double total;               // size of the file or of the text to write
+  std::atomic<double> done;   // bytes read or written so far
+  int error;                  // 2 on read or write error
+  bool eof;                   // all data was read or written
+  bool running;               // a batch was started and is not finished
+  std::atomic<int> ready;     // set by the worker when the batch is done
+  std::atomic<int> cancelled; // set by the main thread to stop the worker
+  std::string text;           // text read by the last batch
+  char line[100], *endline;   // transcoding state of input_filter()
+  int transcoded;             // input was not UTF-8
+  char *snapshot;             // copy of the text to write
+  Fl_Text_Async_Job *next;
+
+  static Fl_Text_Async_Job *first;
+
+  void run_batch();
+  void start_batch();
+  void finish_batch();
+  void finish(int status);
+
+  static void thread_cb(void *job);
+  static void poll();
+  static void schedule();
+  static void awake_cb(void *);
+  static void timeout_cb(void *);
+
+  friend class Fl_Text_Buffer;
+};
+
 static void def_transcoding_warning_action(Fl_Text_Buffer *text)
 {
   fl_alert("%s", text->file_encoding_warning_message);
@@ -229,6 +1009,16 @@ Fl_Text_Buffer::Fl_Text_Buffer(int requestedSize, int preferredGapSize)
   mUndo = new Fl_Text_Undo_Action();
   mUndoList = new Fl_Text_Undo_Action_List();
   mRedoList = new Fl_Text_Undo_Action_List();
+  mUndoBudget = 0;
+  mLineIndex = NULL;
+  mMappedSize = 0;
+  mPieces = NULL;
+  mPieceMode = 0;
+  mTransaction = NULL;
+  mTailLines = 0;
+  mTailBytes = 0;
+  mTailPendingLen = 0;
+  mAsyncJob = 0;
   input_file_was_transcoded = 0;
   transcoding_warning_action = def_transcoding_warning_action;
 }
@@ -239,7 +1029,7 @@ Fl_Text_Buffer::Fl_Text_Buffer(int requestedSize, int preferredGapSize)
  */
 Fl_Text_Buffer::~Fl_Text_Buffer()
 {
-  free(mBuf);
+  free_buffer_();
   if (mNModifyProcs != 0) {
     delete[]mModifyProcs;
     delete[]mCbArgs;
@@ -251,6 +1041,9 @@ Fl_Text_Buffer::~Fl_Text_Buffer()
   delete mUndo;
   delete mUndoList;
   delete mRedoList;
+  delete mLineIndex;
+  delete mTransaction;
+  if (mAsyncJob) mAsyncJob->detach();
 }
 
 
@@ -260,8 +1053,7 @@ Fl_Text_Buffer::~Fl_Text_Buffer()
  */
 char *Fl_Text_Buffer::text() const {
   char *t = (char *) malloc(mLength + 1);
-  memcpy(t, mBuf, mGapStart);
-  memcpy(t+mGapStart, mBuf+mGapEnd, mLength - mGapStart);
+  copy_range_(0, mLength, t);
   t[mLength] = '\0';
   return t;
 }
@@ -273,11 +1065,10 @@ char *Fl_Text_Buffer::text() const {
  */
 std::string Fl_Text_Buffer::text_str() const {
   std::string t;
-  if (mLength) {
-    t.reserve(mLength);
-    t.insert(0, mBuf, mGapStart);
-    t.insert(mGapStart, mBuf+mGapEnd, mLength - mGapStart);
-  }
+  const char *text;
+  t.reserve(mLength);
+  for (int pos = 0, n; (n = read_chunk(pos, mLength, &text)); pos += n)
+    t.append(text, n);
   return t;
 }
 
@@ -298,7 +1089,9 @@ void Fl_Text_Buffer::text(const char *t)
   /* Save information for redisplay, and get rid of the old buffer */
   const char *deletedText = text();
   int deletedLength = mLength;
-  free((void *) mBuf);
+  free_buffer_();
+  delete mLineIndex;
+  mLineIndex = NULL;
 
   /* Start a new buffer with a gap of mPreferredGapSize at the end */
   int insertedLength = (int) strlen(t);
@@ -323,6 +1116,302 @@ void Fl_Text_Buffer::text(const char *t)
 }
 
 
+/*
+ Replace the buffer contents with a memory mapped file.
+ */
+int Fl_Text_Buffer::mapfile(const char *file)
+{
+  size_t size;
+  char *map = Fl::system_driver()->map_file(file, &size);
+  if (!map)
+    return loadfile(file);
+  if (!is_utf8(map, size)) {
+    Fl::system_driver()->unmap_file(map, size);
+    return loadfile(file);
+  }
+
+  call_predelete_callbacks(0, mLength);
+
+  /* Save information for redisplay, and get rid of the old buffer */
+  char *deletedText = text();
+  int deletedLength = mLength;
+  free_buffer_();
+  delete mLineIndex;
+  mLineIndex = NULL;
+
+  /* The mapped text has an empty gap at its end, so the first insertion
+   will move the text into allocated memory */
+  mBuf = map;
+  mMappedSize = size;
+  mLength = (int)size;
+  mGapStart = mGapEnd = mLength;
+  input_file_was_transcoded = 0;
+
+  update_selections(0, deletedLength, 0);
+  call_modify_callbacks(0, deletedLength, mLength, 0, deletedText);
+  free(deletedText);
+
+  if (mCanUndo) {
+    mUndo->clear();
+    mUndoList->clear();
+    mRedoList->clear();
+  }
+  return 0;
+}
+
+
+
+/**
+ \brief Select the piece table storage engine for this buffer.
+
+ By default the text is stored in a gap buffer: a single block of memory
+ with a gap at the last edit position. Edits next to each other are fast,
+ but an edit far from the previous one moves all text in between, which
+ takes a noticeable time in buffers of hundreds of megabytes.
+
+ In piece table mode, the text that the buffer holds when it is first
+ edited is kept unchanged, and the buffer is described as a sequence of
+ pieces of that text and of the text that was inserted since. The pieces are
+ kept in a balanced tree, so an edit takes O(log n) time wherever it
+ happens, plus the time to copy the inserted text. Switching to piece table
+ mode is instant, and together with mapfile() a large file can be viewed
+ and edited without ever copying all of its text.
+
+ The cost is that reading the text byte by byte is slower, and that removed
+ text is not freed until the buffer gets new text or leaves piece table
+ mode. Functions that return text without copying it, like spans(),
+ for_each_span(), and read_chunk(), return more and shorter parts. The
+ non-const version of address() returns memory that can be modified, so
+ it copies the text back into a gap buffer. The buffer returns to piece
+ table mode with the next edit.
+
+ \param on 1 to select the piece table, 0 to copy the text back into a
+    gap buffer
+ \see piece_table() const, mapfile()
+ */
+void Fl_Text_Buffer::piece_table(int on)
+{
+  mPieceMode = on ? 1 : 0;
+  if (!mPieceMode)
+    flatten_();
+}
+
+
+/*
+ Start using the current text as the original text of the piece table,
+ if piece table mode was selected. The text stays where it is.
+ */
+void Fl_Text_Buffer::enter_pieces_()
+{
+  if (mPieceMode && !mPieces)
+    mPieces = new Fl_Text_Piece_Table(mBuf, mGapStart, mBuf + mGapEnd, mLength - mGapStart);
+}
+
+
+/*
+ Copy the text from the piece table into a new gap buffer.
+ */
+void Fl_Text_Buffer::flatten_()
+{
+  if (!mPieces)
+    return;
+  char *buf = (char *) malloc(mLength + mPreferredGapSize);
+  copy_range_(0, mLength, buf);
+  free_buffer_();
+  mBuf = buf;
+  mGapStart = mLength;
+  mGapEnd = mLength + mPreferredGapSize;
+}
+
+
+/**
+ \brief Limit the size of the buffer to the most recent lines of text.
+
+ This is meant for buffers that text is continuously appended to, like log
+ monitors. When text is appended to the end of the buffer, complete lines
+ are removed from its start until it has no more than \p maxLines lines
+ and \p maxBytes bytes. A single line that is longer than \p maxBytes is
+ cut at a character boundary.
+
+ Lines are removed in batches: the buffer may grow up to an eighth larger
+ than the limits before it is trimmed. Each trim moves the text that
+ remains to the start of the buffer once, and the gap stays at the end,
+ so appending costs about eight times the size of the appended text in
+ copies. In piece table mode the remaining text is not moved at all. A
+ text display attached to the buffer keeps showing the same text, unless
+ that text is removed.
+
+ Removed text is not recorded in the undo history, and the history is
+ cleared whenever text is removed, because it refers to text positions
+ that no longer exist.
+
+ \param maxLines maximum number of lines, 0 for no limit
+ \param maxBytes maximum number of bytes, 0 for no limit
+ \see append_fd()
+ */
+void Fl_Text_Buffer::tail_limit(int maxLines, int maxBytes)
+{
+  mTailLines = maxLines > 0 ? maxLines : 0;
+  mTailBytes = maxBytes > 0 ? maxBytes : 0;
+  trim_tail_();
+}
+
+
+/*
+ Remove complete lines from the start of the buffer when it is over the
+ tail mode limits by more than an eighth.
+ */
+void Fl_Text_Buffer::trim_tail_()
+{
+  int cut = 0;
+  if (mTailLines > 0) {
+    int lines = count_lines(0, mLength);
+    if (mLength > 0 && byte_at(mLength - 1) != '\n')
+      lines++;
+    int excess = lines - mTailLines;
+    if (excess > mTailLines / 8)
+      cut = skip_lines(0, excess);
+  }
+  if (mTailBytes > 0 && mLength - cut > mTailBytes + mTailBytes / 8) {
+    int pos = mLength - mTailBytes;
+    int next = (byte_at(pos - 1) == '\n') ? pos : skip_lines(pos, 1);
+    if (next >= mLength)
+      next = utf8_align(pos);
+    cut = max(cut, next);
+  }
+  if (cut <= 0)
+    return;
+
+  char canUndo = mCanUndo;
+  mCanUndo = 0;
+  remove(0, cut);
+  mCanUndo = canUndo;
+  if (mCanUndo) {
+    mUndo->clear();
+    mUndoList->clear();
+    mRedoList->clear();
+  }
+}
+
+
+/**
+ \brief Append text that is available from a file descriptor.
+
+ Reads up to \p maxBytes bytes with a single read call, directly into the
+ memory at the end of the buffer, and appends them. This does not block if
+ the descriptor was reported readable, so it can be called from a
+ callback installed with Fl::add_fd(). If the text ends with an incomplete
+ UTF-8 sequence, the sequence is kept until the rest of it is read by the
+ next call. If the file ends or an error occurs instead, the incomplete
+ sequence is appended as the replacement character U+FFFD.
+
+ The text must be UTF-8 encoded. It is not transcoded.
+
+ The incomplete sequence is kept in the buffer, not per descriptor, so all
+ text appended with append_fd() must come from the same descriptor. Use one
+ buffer for each descriptor that is read.
+
+ On Windows, Fl::add_fd() only supports sockets, and \p fd must be a socket.
+
+ \param fd file descriptor or socket to read from
+ \param maxBytes maximum number of bytes to read
+ \return the number of bytes read, 0 at the end of the file, -1 on error,
+    or -2 if \p fd is non-blocking and no data is available right now
+ \see append_fd_cb(), tail_limit()
+ */
+int Fl_Text_Buffer::append_fd(int fd, int maxBytes)
+{
+  if (maxBytes <= 0)
+    return 0;
+
+  /* Make room for the text at the end of the buffer */
+  int pending = mTailPendingLen;
+  char *text;
+  enter_pieces_();
+  if (mPieces) {
+    text = mPieces->reserve(pending + maxBytes);
+  } else {
+    if (pending + maxBytes > mGapEnd - mGapStart)
+      reallocate_with_gap(mLength, grown_gap_size(mLength, pending + maxBytes, mPreferredGapSize));
+    else if (mGapStart != mLength)
+      move_gap(mLength);
+    text = mBuf + mGapStart;
+  }
+  memcpy(text, mTailPending, pending);
+  int n = Fl::system_driver()->read_fd(fd, text + pending, maxBytes);
+  if (n == -2)
+    return n;
+  if (n <= 0) {
+    /* The rest of an incomplete UTF-8 sequence will never arrive */
+    if (pending) {
+      mTailPendingLen = 0;
+      insert(mLength, "\xef\xbf\xbd");
+    }
+    return n < 0 ? -1 : 0;
+  }
+
+  /* Keep an incomplete UTF-8 sequence at the end for the next call */
+  int len = pending + n, keep = 0;
+  for (int i = len - 1; i >= 0 && i >= len - 4; i--) {
+    unsigned char c = (unsigned char)text[i];
+    if ((c & 0xc0) != 0x80) {
+      if (c >= 0xc0 && fl_utf8len1(c) > len - i)
+        keep = len - i;
+      break;
+    }
+  }
+  memcpy(mTailPending, text + len - keep, keep);
+  mTailPendingLen = keep;
+
+  /* The text is already in place at the start of the gap, or at the end
+   of the inserted text in piece table mode */
+  if (len > keep)
+    insert(mLength, text, len - keep);
+  return n;
+}
+
+
+/**
+ \brief Callback for Fl::add_fd() that appends text to a buffer.
+
+ Install it with
+ \code
+   Fl::add_fd(fd, FL_READ, Fl_Text_Buffer::append_fd_cb, buffer);
+ \endcode
+ to append everything that is read from \p fd to \p buffer as it becomes
+ available. At the end of the file, or if an error occurs, the callback
+ removes itself with Fl::remove_fd(). It stays installed if \p fd is
+ non-blocking and was reported readable without data. Closing \p fd is left to the caller.
+
+ \param fd file descriptor or socket to read from
+ \param buffer the Fl_Text_Buffer to append to
+ \see append_fd()
+ */
+void Fl_Text_Buffer::append_fd_cb(FL_SOCKET fd, void *buffer)
+{
+  Fl_Text_Buffer *buf = (Fl_Text_Buffer *)buffer;
+  int n = buf->append_fd((int)fd);
+  if (n == 0 || n == -1)
+    Fl::remove_fd((int)fd);
+}
+
+/*
+ Release the text memory. The caller must set mBuf to a new buffer.
+ */
+void Fl_Text_Buffer::free_buffer_()
+{
+  delete mPieces;
+  mPieces = NULL;
+  if (mMappedSize) {
+    Fl::system_driver()->unmap_file(mBuf, mMappedSize);
+    mMappedSize = 0;
+  } else {
+    free(mBuf);
+  }
+  mBuf = NULL;
+}
+
+
 /*
  Creates a range of text to a new buffer and copies verbose from around the gap.
  */
@@ -349,21 +1438,189 @@ char *Fl_Text_Buffer::text_range(int start, int end) const {
     end = mLength;
   int copiedLength = end - start;
   s = (char *) malloc(copiedLength + 1);
-
-  /* Copy the text from the buffer to the returned string */
-  if (end <= mGapStart) {
-    memcpy(s, mBuf + start, copiedLength);
-  } else if (start >= mGapStart) {
-    memcpy(s, mBuf + start + (mGapEnd - mGapStart), copiedLength);
-  } else {
-    int part1Length = mGapStart - start;
-    memcpy(s, mBuf + start, part1Length);
-    memcpy(s + part1Length, mBuf + mGapEnd, copiedLength - part1Length);
-  }
+  copy_range_(start, end, s);
   s[copiedLength] = '\0';
   return s;
 }
 
+
+/*
+ Copy the text between start and end to dst, which is not null-terminated.
+ */
+void Fl_Text_Buffer::copy_range_(int start, int end, char *dst) const
+{
+  const char *text;
+  for (int n; start < end; start += n, dst += n) {
+    n = min(chunk_at_(start, &text), end - start);
+    memcpy(dst, text, n);
+  }
+}
+
+
+/*
+ Return the number of contiguous bytes from pos to the gap, the end of the
+ piece in piece table mode, or the end of the text, and their address in text.
+ Pos must be less than the length of the text.
+ */
+int Fl_Text_Buffer::chunk_at_(int pos, const char **text) const
+{
+  if (mPieces)
+    return mPieces->at(pos, text);
+  *text = (pos < mGapStart) ? mBuf + pos : mBuf + pos + (mGapEnd - mGapStart);
+  return (pos < mGapStart ? mGapStart : mLength) - pos;
+}
+
+
+/*
+ Return the number of contiguous bytes before pos back to the gap, the start
+ of the piece in piece table mode, or the start of the text, and the address
+ of the first one in text. Pos must be greater than 0.
+ */
+int Fl_Text_Buffer::chunk_before_(int pos, const char **text) const
+{
+  if (mPieces)
+    return mPieces->before(pos, text);
+  int start = (pos > mGapStart) ? mGapStart : 0;
+  *text = (pos > mGapStart) ? mBuf + mGapEnd : mBuf;
+  return pos - start;
+}
+
+
+/*
+ Return the address of the text at pos in piece table mode.
+ */
+const char *Fl_Text_Buffer::piece_address_(int pos) const
+{
+  const char *text = "";
+  if (pos < mLength) {
+    mPieces->at(pos, &text);
+  } else if (mLength > 0) {
+    int n = mPieces->before(mLength, &text);
+    text += n;
+  }
+  return text;
+}
+
+
+/**
+ \brief Get the text of a range without copying it.
+
+ The text of the buffer is stored in two parts, before and after the gap
+ where text is inserted. This returns pointers to the at most two
+ contiguous parts that cover the range \p start to \p end. Unused parts
+ are returned as NULL with a length of 0. Both parts start and end at a
+ character boundary, and the text is not null-terminated.
+
+ In piece table mode (see piece_table()) the range can be stored in more
+ than two parts. Then the first two parts are returned, and the return
+ value is greater than 2. Use for_each_span() or read_chunk() to read all
+ parts, or text_range() to copy the range.
+
+ The pointers are valid until the buffer is modified.
+
+ \code
+   const char *t1, *t2;
+   int n1, n2;
+   buf->spans(start, end, &t1, &n1, &t2, &n2);
+   fwrite(t1, 1, n1, f);
+   fwrite(t2, 1, n2, f);
+ \endcode
+
+ \param start byte offset to first character
+ \param end byte offset after last character in range
+ \param[out] text1, len1 the first part of the range
+ \param[out] text2, len2 the second part of the range, if it spans the gap
+ \return the number of parts, 0 if the range is empty, or 3 if there are
+    more than two parts
+ \see for_each_span(), read_chunk(), text_range()
+ */
+int Fl_Text_Buffer::spans(int start, int end, const char **text1, int *len1,
+                          const char **text2, int *len2) const
+{
+  *text1 = *text2 = NULL;
+  *len1 = *len2 = 0;
+  if (start < 0) start = 0;
+  if (end > mLength) end = mLength;
+  int n = 0;
+  for (int pos = start, len; pos < end && n < 3; pos += len, n++) {
+    const char *text;
+    len = min(chunk_at_(pos, &text), end - pos);
+    if (n == 0) {
+      *text1 = text;
+      *len1 = len;
+    } else if (n == 1) {
+      *text2 = text;
+      *len2 = len;
+    }
+  }
+  return n;
+}
+
+
+/**
+ \brief Call a function for the contiguous parts of a range of text.
+
+ The callback is called once for each contiguous part of the range, without
+ copying the text: at most twice for the parts before and after the gap,
+ or once for each piece in piece table mode. See spans().
+ The buffer must not be modified by the callback.
+
+ \param start byte offset to first character
+ \param end byte offset after last character in range
+ \param cb function to call
+ \param cbArg argument passed to the callback
+ \return the value returned by the callback if it stopped early, or 0
+ */
+int Fl_Text_Buffer::for_each_span(int start, int end, Fl_Text_Span_Cb cb, void *cbArg) const
+{
+  const char *text;
+  for (int pos = max(start, 0), n; (n = read_chunk(pos, end, &text)); pos += n) {
+    int ret = cb(pos, text, n, cbArg);
+    if (ret)
+      return ret;
+  }
+  return 0;
+}
+
+
+/**
+ \brief Read the text of a range in contiguous chunks without copying it.
+
+ Returns a pointer to the text at \p pos and the number of bytes that can
+ be read there, up to \p end, the gap (the end of the piece in piece table
+ mode), or \p maxLen. If the chunk is
+ limited by \p maxLen, it ends at a character boundary. Read a whole range
+ like this:
+ \code
+   const char *text;
+   for (int pos = start, n; (n = buf->read_chunk(pos, end, &text, 64*1024)); pos += n)
+     consume(text, n);
+ \endcode
+
+ \param pos byte offset to first character
+ \param end byte offset after last character in range
+ \param[out] text the text at \p pos, valid until the buffer is modified
+ \param maxLen maximum size of the chunk, or 0 for no limit
+ \return the number of bytes at \p text, 0 at \p end
+ */
+int Fl_Text_Buffer::read_chunk(int pos, int end, const char **text, int maxLen) const
+{
+  if (pos < 0) pos = 0;
+  if (end > mLength) end = mLength;
+  *text = NULL;
+  if (pos >= end)
+    return 0;
+  int n = min(chunk_at_(pos, text), end - pos);
+  if (maxLen > 0 && n > maxLen) {
+    n = maxLen;
+    // don't split a character, unless it is longer than maxLen
+    int m = n;
+    while (m > 0 && ((*text)[m] & 0xc0) == 0x80) m--;
+    if (m > 0) n = m;
+  }
+  return n;
+}
+
 /*
  Return a UCS-4 character at the given index.
  Pos must be at a character boundary.
@@ -374,8 +1631,9 @@ unsigned int Fl_Text_Buffer::char_at(int pos) const {
 
   IS_UTF8_ALIGNED2(this, (pos))
 
-  const char *src = address(pos);
-  return fl_utf8decode(src, 0, 0);
+  const char *src;
+  int n = chunk_at_(pos, &src);
+  return fl_utf8decode(src, src + n, 0);
 }
 
 
@@ -418,6 +1676,10 @@ void Fl_Text_Buffer::insert(int pos, const char *text, int insertedLength)
   mCursorPosHint = pos + nInserted;
   IS_UTF8_ALIGNED2(this, (mCursorPosHint))
   call_modify_callbacks(pos, 0, nInserted, 0, NULL);
+
+  /* in tail mode, appending text may push old lines out */
+  if ((mTailLines || mTailBytes) && pos + nInserted == mLength)
+    trim_tail_();
 }
 
 
@@ -543,13 +1805,28 @@ void Fl_Text_Buffer::copy(Fl_Text_Buffer * fromBuf, int fromStart,
 
   int copiedLength = fromEnd - fromStart;
 
+  enter_pieces_();
+  if (mPieces || fromBuf->mPieces) {
+    char *text = fromBuf->text_range(fromStart, fromEnd);
+    if (mPieces)
+      mPieces->insert(toPos, text, copiedLength);
+    else
+      insert_gap_(toPos, text, copiedLength);
+    if (mLineIndex)
+      mLineIndex->inserted(toPos, text, copiedLength);
+    free(text);
+    mLength += copiedLength;
+    update_selections(toPos, 0, copiedLength);
+    return;
+  }
+
   /* Prepare the buffer to receive the new text.  If the new text fits in
    the current buffer, just move the gap (if necessary) to where
    the text should be inserted.  If the new text is too large, reallocate
    the buffer with a gap large enough to accomodate the new text and a
-   gap of mPreferredGapSize */
+   gap that grows with the buffer size */
   if (copiedLength > mGapEnd - mGapStart)
-    reallocate_with_gap(toPos, copiedLength + mPreferredGapSize);
+    reallocate_with_gap(toPos, grown_gap_size(mLength, copiedLength, mPreferredGapSize));
   else if (toPos != mGapStart)
     move_gap(toPos);
 
@@ -566,6 +1843,8 @@ void Fl_Text_Buffer::copy(Fl_Text_Buffer * fromBuf, int fromStart,
     memcpy(&mBuf[toPos + part1Length],
            &fromBuf->mBuf[fromBuf->mGapEnd], copiedLength - part1Length);
   }
+  if (mLineIndex)
+    mLineIndex->inserted(toPos, &mBuf[toPos], copiedLength);
   mGapStart += copiedLength;
   mLength += copiedLength;
   update_selections(toPos, 0, copiedLength);
@@ -682,22 +1961,117 @@ bool Fl_Text_Buffer::can_redo() const {
   return (mCanUndo && mRedoList->size());
 }
 
+/**
+ \brief Limit the memory used by the undo and redo history.
+
+ When the undo history uses more than \p bytes, the oldest undo actions
+ are discarded. The same limit applies to the redo history. The most recent
+ action is always kept, even if it is larger than the limit.
+
+ \param bytes maximum size of the history in bytes, 0 for no limit
+ \see undo_bytes()
+ */
+void Fl_Text_Buffer::undo_budget(int bytes)
+{
+  mUndoBudget = bytes < 0 ? 0 : bytes;
+  mUndoList->budget(mUndoBudget);
+  mRedoList->budget(mUndoBudget);
+}
+
+/**
+ \brief Return the memory used by the undo and redo history in bytes.
+ */
+int Fl_Text_Buffer::undo_bytes() const
+{
+  return mUndoList->bytes() + mRedoList->bytes();
+}
+
 /*
  Set a flag if undo function will work.
  */
-void Fl_Text_Buffer::canUndo(char flag)
+void Fl_Text_Buffer::canUndo(char flag)
+{
+  if (flag) {
+    if (!mCanUndo) {
+      mUndo = new Fl_Text_Undo_Action();
+    }
+  } else {
+    if (mCanUndo) {
+      delete mUndo;
+      mUndo = NULL;
+    }
+  }
+  mCanUndo = flag;
+}
+
+
+/*
+ Start collecting modifications in a transaction.
+ */
+void Fl_Text_Buffer::begin_transaction()
+{
+  if (mTransaction)
+    mTransaction->depth++;
+  else
+    mTransaction = new Fl_Text_Transaction();
+}
+
+
+/*
+ Report all modifications of the transaction as a single replacement.
+ */
+void Fl_Text_Buffer::end_transaction()
 {
-  if (flag) {
-    if (!mCanUndo) {
-      mUndo = new Fl_Text_Undo_Action();
-    }
-  } else {
-    if (mCanUndo) {
-      delete mUndo;
-      mUndo = NULL;
-    }
+  Fl_Text_Transaction *t = mTransaction;
+  if (!t || --t->depth > 0)
+    return;
+
+  int start = t->start, end = t->end;
+  if (start < 0) {
+    mTransaction = NULL;
+    delete t;
+    return;
   }
-  mCanUndo = flag;
+
+  std::string orig = t->original();
+  int origLength = (int)orig.size();
+  char *text = text_range(start, end);
+
+  if (end - start == origLength && !memcmp(text, orig.data(), origLength)) {
+    /* The text did not change, but the layout may have (see tab_distance()) */
+    mTransaction = NULL;
+    delete t;
+    call_predelete_callbacks(start, origLength);
+    call_modify_callbacks(start, origLength, origLength, 0, orig.c_str());
+    free(text);
+    return;
+  }
+
+  /* Put the original text back without recording undo information or
+   calling the callbacks, then apply all changes as one replacement. This
+   calls every callback once and records a single undo action. The
+   selections were already updated by the individual changes. */
+  Fl_Text_Selection primary = mPrimary;
+  Fl_Text_Selection secondary = mSecondary;
+  Fl_Text_Selection highlight = mHighlight;
+  remove_(start, end);
+  insert_(start, orig.c_str(), origLength);
+  mTransaction = NULL;
+  delete t;
+
+  /* Don't merge the replacement into the previous undo action */
+  Fl_Text_Undo_Action *previous = mCanUndo ? mUndo : NULL;
+  int previousAt = previous ? previous->undoat : 0;
+  if (previous)
+    previous->undoat = -1;
+  replace(start, start + origLength, text, end - start);
+  if (previous)
+    previous->undoat = previousAt;
+
+  mPrimary = primary;
+  mSecondary = secondary;
+  mHighlight = highlight;
+  free(text);
 }
 
 
@@ -1042,6 +2416,23 @@ void Fl_Text_Buffer::remove_predelete_callback(Fl_Text_Predelete_Cb bufPreDelete
 }
 
 
+/*
+ Return the line index of this buffer, creating it if needed.
+
+ Small buffers are scanned quickly enough, so no index is created for them
+ until a line based query is made while the buffer is reasonably large. Once
+ created, the index is updated with every change to the buffer.
+ */
+Fl_Text_Line_Index *Fl_Text_Buffer::line_index() const
+{
+  if (!mLineIndex && mLength >= 32 * 1024) {
+    mLineIndex = new Fl_Text_Line_Index();
+    mLineIndex->build(this);
+  }
+  return mLineIndex;
+}
+
+
 /*
  Return a copy of the line that contains a given index.
  Pos must be at a character boundary.
@@ -1056,6 +2447,11 @@ char *Fl_Text_Buffer::line_text(int pos) const {
  */
 int Fl_Text_Buffer::line_start(int pos) const
 {
+  const Fl_Text_Line_Index *index = line_index();
+  if (index) {
+    int n = index->rank(min(pos, mLength));
+    return n ? index->position(n - 1) + 1 : 0;
+  }
   if (!findchar_backward(pos, '\n', &pos))
     return 0;
   return pos + 1;
@@ -1066,6 +2462,11 @@ int Fl_Text_Buffer::line_start(int pos) const
  Find the end of the line.
  */
 int Fl_Text_Buffer::line_end(int pos) const {
+  const Fl_Text_Line_Index *index = line_index();
+  if (index) {
+    int n = index->rank(max(pos, 0));
+    return (n < index->count()) ? index->position(n) : mLength;
+  }
   if (!findchar_forward(pos, '\n', &pos))
     pos = mLength;
   return pos;
@@ -1161,24 +2562,15 @@ int Fl_Text_Buffer::count_lines(int startPos, int endPos) const {
   IS_UTF8_ALIGNED2(this, (startPos))
   IS_UTF8_ALIGNED2(this, (endPos))
 
-  int gapLen = mGapEnd - mGapStart;
-  int lineCount = 0;
+  if (startPos < 0) startPos = 0;
+  if (endPos < startPos || endPos > mLength) endPos = mLength;
+  if (startPos >= endPos)
+    return 0;
 
-  int pos = startPos;
-  while (pos < mGapStart)
-  {
-    if (pos == endPos)
-      return lineCount;
-    if (mBuf[pos++] == '\n')
-      lineCount++;
-  }
-  while (pos < mLength) {
-    if (pos == endPos)
-      return lineCount;
-    if (mBuf[pos++ + gapLen] == '\n')
-      lineCount++;
-  }
-  return lineCount;
+  const Fl_Text_Line_Index *index = line_index();
+  if (index)
+    return index->rank(endPos) - index->rank(startPos);
+  return count_bytes_(startPos, endPos, '\n');
 }
 
 /**
@@ -1191,34 +2583,23 @@ int Fl_Text_Buffer::estimate_lines(int startPos, int endPos, int lineLen) const
   IS_UTF8_ALIGNED2(this, (startPos))
   IS_UTF8_ALIGNED2(this, (endPos))
 
-  int gapLen = mGapEnd - mGapStart;
   int lineCount = 0;
   int softLineBreaks = 0, softLineBreakCount = lineLen;
 
-  int pos = startPos;
-  while (pos < mGapStart)
-  {
-    if (pos == endPos)
-      return lineCount + softLineBreaks;
-    if (mBuf[pos++] == '\n') {
-      softLineBreakCount = lineLen;
-      lineCount++;
-    }
-    if (--softLineBreakCount == 0) {
-      softLineBreakCount = lineLen;
-      softLineBreaks++;
-    }
-  }
-  while (pos < mLength) {
-    if (pos == endPos)
-      return lineCount + softLineBreaks;
-    if (mBuf[pos++ + gapLen] == '\n') {
-      softLineBreakCount = lineLen;
-      lineCount++;
-    }
-    if (--softLineBreakCount == 0) {
-      softLineBreakCount = lineLen;
-      softLineBreaks++;
+  if (endPos < startPos || endPos > mLength)
+    endPos = mLength;
+  const char *text;
+  for (int pos = max(startPos, 0), n; pos < endPos; pos += n) {
+    n = min(chunk_at_(pos, &text), endPos - pos);
+    for (int i = 0; i < n; i++) {
+      if (text[i] == '\n') {
+        softLineBreakCount = lineLen;
+        lineCount++;
+      }
+      if (--softLineBreakCount == 0) {
+        softLineBreakCount = lineLen;
+        softLineBreaks++;
+      }
     }
   }
   return lineCount + softLineBreaks;
@@ -1236,29 +2617,22 @@ int Fl_Text_Buffer::skip_lines(int startPos, int nLines)
   if (nLines == 0)
     return startPos;
 
-  int gapLen = mGapEnd - mGapStart;
+  const Fl_Text_Line_Index *index = line_index();
+  if (index && nLines > 0 && startPos >= 0 && startPos < mLength) {
+    int n = index->rank(startPos) + nLines - 1;
+    return (n < index->count()) ? index->position(n) + 1 : mLength;
+  }
+
   int pos = startPos;
   int lineCount = 0;
-  while (pos < mGapStart) {
-    if (mBuf[pos++] == '\n') {
-      lineCount++;
-      if (lineCount == nLines) {
-        IS_UTF8_ALIGNED2(this, (pos))
-        return pos;
-      }
-    }
-  }
-  while (pos < mLength) {
-    if (mBuf[pos++ + gapLen] == '\n') {
-      lineCount++;
-      if (lineCount >= nLines) {
-        IS_UTF8_ALIGNED2(this, (pos))
-        return pos;
-      }
+  while ((pos = scan_forward_(pos, mLength, '\n', '\n')) >= 0) {
+    pos++;
+    if (++lineCount >= nLines) {
+      IS_UTF8_ALIGNED2(this, (pos))
+      return pos;
     }
   }
-  IS_UTF8_ALIGNED2(this, (pos))
-  return pos;
+  return max(startPos, mLength);
 }
 
 
@@ -1275,23 +2649,17 @@ int Fl_Text_Buffer::rewind_lines(int startPos, int nLines)
   if (pos <= 0)
     return 0;
 
-  int gapLen = mGapEnd - mGapStart;
-  int lineCount = -1;
-  while (pos >= mGapStart) {
-    if (mBuf[pos + gapLen] == '\n') {
-      if (++lineCount >= nLines) {
-        IS_UTF8_ALIGNED2(this, (pos+1))
-        return pos + 1;
-      }
-    }
-    pos--;
+  const Fl_Text_Line_Index *index = line_index();
+  if (index) {
+    int n = index->rank(min(startPos, mLength)) - 1 - max(nLines, 0);
+    return (n >= 0) ? index->position(n) + 1 : 0;
   }
-  while (pos >= 0) {
-    if (mBuf[pos] == '\n') {
-      if (++lineCount >= nLines) {
-        IS_UTF8_ALIGNED2(this, (pos+1))
-        return pos + 1;
-      }
+
+  int lineCount = -1;
+  while ((pos = scan_backward_(0, pos + 1, '\n', '\n')) >= 0) {
+    if (++lineCount >= nLines) {
+      IS_UTF8_ALIGNED2(this, (pos+1))
+      return pos + 1;
     }
     pos--;
   }
@@ -1310,6 +2678,24 @@ int Fl_Text_Buffer::search_forward(int startPos, const char *searchString,
 
   if (!searchString)
     return 0;
+
+  /* Fast path: scan for the first byte of the string, then compare */
+  if (*searchString && (matchCase || is_ascii(searchString))) {
+    int len = (int) strlen(searchString);
+    bool ignoreCase = !matchCase;
+    char c1 = ignoreCase ? ascii_lower(*searchString) : *searchString;
+    char c2 = ignoreCase ? ascii_upper(*searchString) : *searchString;
+    for (int pos = max(startPos, 0); ; pos++) {
+      pos = scan_forward_(pos, mLength - len + 1, c1, c2);
+      if (pos < 0)
+        return 0;
+      if (match_at_(pos, searchString, len, ignoreCase)) {
+        *foundPos = pos;
+        return 1;
+      }
+    }
+  }
+
   int bp;
   const char *sp;
   if (matchCase) {
@@ -1362,6 +2748,25 @@ int Fl_Text_Buffer::search_backward(int startPos, const char *searchString,
 
   if (!searchString)
     return 0;
+
+  /* Fast path: scan back for the first byte of the string, then compare */
+  if (*searchString && (matchCase || is_ascii(searchString))) {
+    int len = (int) strlen(searchString);
+    bool ignoreCase = !matchCase;
+    char c1 = ignoreCase ? ascii_lower(*searchString) : *searchString;
+    char c2 = ignoreCase ? ascii_upper(*searchString) : *searchString;
+    for (int pos = min(startPos, mLength - len); pos >= 0; pos--) {
+      pos = scan_backward_(0, pos + 1, c1, c2);
+      if (pos < 0)
+        return 0;
+      if (match_at_(pos, searchString, len, ignoreCase)) {
+        *foundPos = pos;
+        return 1;
+      }
+    }
+    return 0;
+  }
+
   int bp;
   const char *sp;
   if (matchCase) {
@@ -1408,6 +2813,120 @@ int Fl_Text_Buffer::search_backward(int startPos, const char *searchString,
 
 
 
+/*
+ Find all non-overlapping occurrences of a string.
+ */
+int Fl_Text_Buffer::find_all(const char *searchString, std::vector<int> &foundPositions,
+                             int matchCase) const
+{
+  IS_UTF8_ALIGNED(searchString)
+
+  foundPositions.clear();
+  if (!searchString || !*searchString)
+    return 0;
+
+  int len = (int) strlen(searchString);
+  if (matchCase || is_ascii(searchString)) {
+    bool ignoreCase = !matchCase;
+    char c1 = ignoreCase ? ascii_lower(*searchString) : *searchString;
+    char c2 = ignoreCase ? ascii_upper(*searchString) : *searchString;
+    for (int pos = 0; ; ) {
+      pos = scan_forward_(pos, mLength - len + 1, c1, c2);
+      if (pos < 0)
+        break;
+      if (match_at_(pos, searchString, len, ignoreCase)) {
+        foundPositions.push_back(pos);
+        pos += len;
+      } else {
+        pos++;
+      }
+    }
+  } else {
+    // case folding may change the length of a match, so walk it character by character
+    int nChars = fl_utf_nb_char((const unsigned char *)searchString, len);
+    for (int pos = 0, found; search_forward(pos, searchString, &found, 0); ) {
+      foundPositions.push_back(found);
+      pos = found;
+      for (int i = 0; i < nChars && pos < mLength; i++)
+        pos += max(fl_utf8len1(byte_at(pos)), 1);
+    }
+  }
+  return (int) foundPositions.size();
+}
+
+
+/*
+ Return the position of the first byte c1 or c2 in [start, end), or -1.
+ */
+int Fl_Text_Buffer::scan_forward_(int start, int end, char c1, char c2) const
+{
+  if (start < 0) start = 0;
+  if (end > mLength) end = mLength;
+  const char *text;
+  for (int n; start < end; start += n) {
+    n = min(chunk_at_(start, &text), end - start);
+    const char *p = scan_forward(text, n, c1, c2);
+    if (p)
+      return start + (int) (p - text);
+  }
+  return -1;
+}
+
+
+/*
+ Return the position of the last byte c1 or c2 in [start, end), or -1.
+ */
+int Fl_Text_Buffer::scan_backward_(int start, int end, char c1, char c2) const
+{
+  if (start < 0) start = 0;
+  if (end > mLength) end = mLength;
+  const char *text;
+  for (int n; end > start; end -= n) {
+    n = chunk_before_(end, &text);
+    if (n > end - start) {
+      text += n - (end - start);
+      n = end - start;
+    }
+    const char *p = scan_backward(text, n, c1, c2);
+    if (p)
+      return end - n + (int) (p - text);
+  }
+  return -1;
+}
+
+
+/*
+ Count the bytes c in [start, end).
+ */
+int Fl_Text_Buffer::count_bytes_(int start, int end, char c) const
+{
+  int count = 0;
+  const char *text;
+  for (int n; start < end; start += n) {
+    n = min(chunk_at_(start, &text), end - start);
+    count += count_bytes(text, n, c);
+  }
+  return count;
+}
+
+
+/*
+ Return true if the string s of len bytes is found at pos.
+ */
+bool Fl_Text_Buffer::match_at_(int pos, const char *s, int len, bool ignoreCase) const
+{
+  if (pos < 0 || pos + len > mLength)
+    return false;
+  const char *text;
+  for (int n; len > 0; pos += n, s += n, len -= n) {
+    n = min(chunk_at_(pos, &text), len);
+    if (!bytes_equal(text, s, n, ignoreCase))
+      return false;
+  }
+  return true;
+}
+
+
 /*
  Insert a string into the buffer.
  Pos must be at a character boundary. Text must be a correct UTF-8 string.
@@ -1419,23 +2938,18 @@ int Fl_Text_Buffer::insert_(int pos, const char *text, int insertedLength)
 
   if (insertedLength == -1) insertedLength = (int) strlen(text);
 
-  /* Prepare the buffer to receive the new text.  If the new text fits in
-   the current buffer, just move the gap (if necessary) to where
-   the text should be inserted.  If the new text is too large, reallocate
-   the buffer with a gap large enough to accomodate the new text and a
-   gap of mPreferredGapSize */
-  if (insertedLength > mGapEnd - mGapStart)
-    reallocate_with_gap(pos, insertedLength + mPreferredGapSize);
-  else if (pos != mGapStart)
-    move_gap(pos);
-
-  /* Insert the new text (pos now corresponds to the start of the gap) */
-  memcpy(&mBuf[pos], text, insertedLength);
-  mGapStart += insertedLength;
+  enter_pieces_();
+  if (mPieces)
+    mPieces->insert(pos, text, insertedLength);
+  else
+    insert_gap_(pos, text, insertedLength);
+  if (mLineIndex)
+    mLineIndex->inserted(pos, text, insertedLength);
   mLength += insertedLength;
   update_selections(pos, 0, insertedLength);
 
-  if (mCanUndo) {
+  /* changes within a transaction are recorded as a whole when it ends */
+  if (mCanUndo && !mTransaction) {
     if (mUndo->undoat == pos && mUndo->undoinsert) {
       // continue inserting text at the given cursor position
       mUndo->undoinsert += insertedLength;
@@ -1460,6 +2974,30 @@ int Fl_Text_Buffer::insert_(int pos, const char *text, int insertedLength)
 }
 
 
+/*
+ Insert text into the gap buffer, which grows if needed.
+ Pos must be at a character boundary. Does not update the length.
+ */
+void Fl_Text_Buffer::insert_gap_(int pos, const char *text, int insertedLength)
+{
+  /* Prepare the buffer to receive the new text.  If the new text fits in
+   the current buffer, just move the gap (if necessary) to where
+   the text should be inserted.  If the new text is too large, reallocate
+   the buffer with a gap large enough to accomodate the new text and a
+   gap that grows with the buffer size */
+  if (insertedLength > mGapEnd - mGapStart)
+    reallocate_with_gap(pos, grown_gap_size(mLength, insertedLength, mPreferredGapSize));
+  else if (pos != mGapStart)
+    move_gap(pos);
+
+  /* Insert the new text (pos now corresponds to the start of the gap),
+   unless it was read there by append_fd() */
+  if (text != &mBuf[pos])
+    memcpy(&mBuf[pos], text, insertedLength);
+  mGapStart += insertedLength;
+}
+
+
 /*
  Remove a string from the buffer.
  Unicode safe. Start and end must be at a character boundary.
@@ -1468,12 +3006,23 @@ int Fl_Text_Buffer::insert_(int pos, const char *text, int insertedLength)
 void Fl_Text_Buffer::remove_(int start, int end)
 {
   if (start >= end) return;
-  if (mCanUndo) {
+  if (mLineIndex)
+    mLineIndex->removed(start, end);
+  /* changes within a transaction are recorded as a whole when it ends */
+  bool recordUndo = mCanUndo && !mTransaction;
+  char *undoText = NULL;  // where the removed text is saved
+  if (recordUndo) {
     if (mUndo->undoat == end && mUndo->undocut) {
       // continue to remove text at the same cursor position
       mUndo->undobuffersize(mUndo->undocut + end - start + 1);
       memmove(mUndo->undobuffer + end - start, mUndo->undobuffer, mUndo->undocut);
       mUndo->undocut += end - start;
+      undoText = mUndo->undobuffer;
+    } else if (mUndo->undoat == start && mUndo->undocut) {
+      // continue to remove text after the cursor position
+      mUndo->undobuffersize(mUndo->undocut + end - start + 1);
+      undoText = mUndo->undobuffer + mUndo->undocut;
+      mUndo->undocut += end - start;
     } else {
       // remove text at a new position, so generate a new undo action
       mRedoList->clear();
@@ -1481,32 +3030,34 @@ void Fl_Text_Buffer::remove_(int start, int end)
       mUndo = new Fl_Text_Undo_Action();
       mUndo->undocut = end - start;
       mUndo->undobuffersize(mUndo->undocut);
+      undoText = mUndo->undobuffer;
     }
     mUndo->undoat = start;
     mUndo->undoinsert = 0;
     mUndo->undoyankcut = 0;
   }
 
-  if (start > mGapStart) {
-    if (mCanUndo)
-      memcpy(mUndo->undobuffer, mBuf + (mGapEnd - mGapStart) + start,
-             end - start);
-    move_gap(start);
-  } else if (end < mGapStart) {
-    if (mCanUndo)
-      memcpy(mUndo->undobuffer, mBuf + start, end - start);
-    move_gap(end);
+  if (recordUndo)
+    copy_range_(start, end, undoText);
+
+  enter_pieces_();
+  if (mPieces) {
+    mPieces->remove(start, end);
+  } else if (start == 0 && mGapStart == mLength) {
+    /* removing the start of text that is appended to, e.g. by tail_limit():
+     move the rest to the start of the buffer, so the gap stays at its end */
+    memmove(mBuf, mBuf + end, mLength - end);
+    mGapStart -= end;
   } else {
-    int prelen = mGapStart - start;
-    if (mCanUndo) {
-      memcpy(mUndo->undobuffer, mBuf + start, prelen);
-      memcpy(mUndo->undobuffer + prelen, mBuf + mGapEnd, end - start - prelen);
-    }
-  }
+    if (start > mGapStart)
+      move_gap(start);
+    else if (end < mGapStart)
+      move_gap(end);
 
-  /* expand the gap to encompass the deleted characters */
-  mGapEnd += end - mGapStart;
-  mGapStart = start;
+    /* expand the gap to encompass the deleted characters */
+    mGapEnd += end - mGapStart;
+    mGapStart = start;
+  }
 
   /* update the length */
   mLength -= end - start;
@@ -1648,6 +3199,10 @@ void Fl_Text_Buffer::call_modify_callbacks(int pos, int nDeleted,
                                            int nInserted, int nRestyled,
                                            const char *deletedText) const {
   IS_UTF8_ALIGNED2(this, pos)
+  if (mTransaction && (nInserted || nDeleted)) {
+    mTransaction->end += nInserted - nDeleted;
+    return;
+  }
   for (int i = 0; i < mNModifyProcs; i++)
     (*mModifyProcs[i]) (pos, nInserted, nDeleted, nRestyled,
                         deletedText, mCbArgs[i]);
@@ -1659,6 +3214,26 @@ void Fl_Text_Buffer::call_modify_callbacks(int pos, int nDeleted,
  Unicode safe.
  */
 void Fl_Text_Buffer::call_predelete_callbacks(int pos, int nDeleted) const {
+  if (mTransaction) {
+    /* extend the range of the transaction to cover this modification */
+    Fl_Text_Transaction *t = mTransaction;
+    int end = pos + nDeleted;
+    if (t->start < 0)
+      t->start = t->end = pos;
+    if (pos < t->start) {
+      char *s = text_range(pos, t->start);
+      t->before.push_back(std::string(s, t->start - pos));
+      free(s);
+      t->start = pos;
+    }
+    if (end > t->end) {
+      char *s = text_range(t->end, end);
+      t->after.append(s, end - t->end);
+      free(s);
+      t->end = end;
+    }
+    return;
+  }
   for (int i = 0; i < mNPredeleteProcs; i++)
     (*mPredeleteProcs[i]) (pos, nDeleted, mPredeleteCbArgs[i]);
 }
@@ -1759,7 +3334,7 @@ void Fl_Text_Buffer::reallocate_with_gap(int newGapStart, int newGapLen)
            &mBuf[mGapEnd + newGapStart - mGapStart],
            mLength - newGapStart);
   }
-  free((void *) mBuf);
+  free_buffer_();
   mBuf = newBuf;
   mGapStart = newGapStart;
   mGapEnd = newGapEnd;
@@ -1827,6 +3402,12 @@ int Fl_Text_Buffer::findchar_forward(int startPos, unsigned searchChar,
   if (startPos<0)
     startPos = 0;
 
+  if (searchChar < 0x80) {
+    int pos = scan_forward_(startPos, mLength, (char)searchChar, (char)searchChar);
+    *foundPos = (pos < 0) ? mLength : pos;
+    return (pos >= 0);
+  }
+
   for ( ; startPos<mLength; startPos = next_char(startPos)) {
     if (searchChar == char_at(startPos)) {
       *foundPos = startPos;
@@ -1853,6 +3434,12 @@ int Fl_Text_Buffer::findchar_backward(int startPos, unsigned int searchChar,
   if (startPos > mLength)
     startPos = mLength;
 
+  if (searchChar < 0x80) {
+    int pos = scan_backward_(0, startPos, (char)searchChar, (char)searchChar);
+    *foundPos = (pos < 0) ? 0 : pos;
+    return (pos >= 0);
+  }
+
   for (startPos = prev_char(startPos); startPos>=0; startPos = prev_char(startPos)) {
     if (searchChar == char_at(startPos)) {
       *foundPos = startPos;
@@ -2009,6 +3596,25 @@ static int utf8_input_filter(char *buffer,              // result buffer we fill
   return (int) (q - buffer);
 }
 
+/*
+ Fill buffer with up to buflen bytes of UTF-8 text read from fp, using
+ the input filter that insertfile() and loadfile_async() are built with.
+ */
+static int input_filter(char *buffer, int buflen, char *line, int sline,
+                        char* &endline, FILE *fp, int *input_was_changed)
+{
+#ifdef EXAMPLE_ENCODING
+  // example of 16-bit encoding: UTF-16
+  *input_was_changed = true;
+  return general_input_filter(buffer, buflen, line, sline, endline,
+                              utf16toucs, // use cp1252toucs to read CP1252-encoded files
+                              fp);
+#else
+  return utf8_input_filter(buffer, buflen, line, sline, endline,
+                           fp, input_was_changed);
+#endif
+}
+
 const char *Fl_Text_Buffer::file_encoding_warning_message =
     "Displayed text contains the UTF-8 transcoding\n"
     "of the input file which was not UTF-8 encoded.\n"
@@ -2031,17 +3637,8 @@ const char *Fl_Text_Buffer::file_encoding_warning_message =
   input_file_was_transcoded = false;
   endline = line;
   while (true) {
-#ifdef EXAMPLE_ENCODING
-    // example of 16-bit encoding: UTF-16
-    len = general_input_filter(buffer, buflen,
-                               line, sizeof(line), endline,
-                               utf16toucs, // use cp1252toucs to read CP1252-encoded files
-                               fp);
-    input_file_was_transcoded = true;
-#else
-    len = utf8_input_filter(buffer, buflen, line, sizeof(line), endline,
-                            fp, &input_file_was_transcoded);
-#endif
+    len = input_filter(buffer, buflen, line, sizeof(line), endline,
+                       fp, &input_file_was_transcoded);
     if (len == 0) break;
     buffer[len] = 0;
     insert(pos, buffer);
@@ -2067,11 +3664,9 @@ int Fl_Text_Buffer::outputfile(const char *file,
   FILE *fp;
   if (!(fp = fl_fopen(file, "w")))
     return 1;
-  for (int n; (n = min(end - start, buflen)); start += n) {
-    const char *p = text_range(start, start + n);
-    int r = (int) fwrite(p, 1, n, fp);
-    free((void *) p);
-    if (r != n)
+  const char *p;
+  for (int n; (n = read_chunk(start, end, &p, buflen)); start += n) {
+    if ((int) fwrite(p, 1, n, fp) != n)
       break;
   }
 
@@ -2081,6 +3676,306 @@ int Fl_Text_Buffer::outputfile(const char *file,
 }
 
 
+Fl_Text_Async_Job *Fl_Text_Async_Job::first = 0;
+
+Fl_Text_Async_Job::Fl_Text_Async_Job(Fl_Text_Buffer *b, FILE *f, bool s, int len) :
+  buffer(b),
+  cb(0),
+  cbArg(0),
+  fp(f),
+  save(s),
+  buflen(len > 0 ? len : 128*1024),
+  total(0),
+  done(0),
+  error(0),
+  eof(false),
+  running(false),
+  ready(0),
+  cancelled(0),
+  endline(line),
+  transcoded(0),
+  snapshot(0),
+  next(0)
+{ }
+
+Fl_Text_Async_Job::~Fl_Text_Async_Job() {
+  if (fp) fclose(fp);
+  free(snapshot);
+}
+
+/*
+ Registers a new job and starts its first batch.
+ */
+void Fl_Text_Async_Job::start(Fl_Text_Async_Job *job) {
+  job->next = first;
+  first = job;
+  job->start_batch();
+}
+
+/*
+ Disconnects the job from its buffer. The job is deleted as soon as the
+ worker has stopped.
+ */
+void Fl_Text_Async_Job::detach() {
+  buffer->mAsyncJob = 0;
+  buffer = 0;
+  cancelled = 1;
+  if (!running) finish(3);
+}
+
+/*
+ Reads or writes one batch. Runs on the worker thread.
+ */
+void Fl_Text_Async_Job::run_batch() {
+  if (save) {
+    double pos = done;
+    for (int i = 0; i < BATCH_CHUNKS && !eof && !cancelled; i++) {
+      int n = (int)(total - pos < buflen ? total - pos : buflen);
+      if ((int)fwrite(snapshot + (size_t)pos, 1, n, fp) != n) {
+        error = 2;
+        break;
+      }
+      pos += n;
+      done = pos;
+      eof = (pos >= total);
+    }
+  } else {
+    text.resize((size_t)buflen * BATCH_CHUNKS);
+    int len = 0;
+    for (int i = 0; i < BATCH_CHUNKS && !cancelled; i++) {
+      int n = input_filter(&text[len], buflen, line, sizeof(line), endline,
+                           fp, &transcoded);
+      if (n == 0) {
+        eof = true;
+        if (ferror(fp)) error = 2;
+        break;
+      }
+      len += n;
+    }
+    text.resize(len);
+    long pos = ftell(fp);
+    if (pos > 0) done = (double)pos;
+  }
+}
+
+void Fl_Text_Async_Job::thread_cb(void *data) {
+  Fl_Text_Async_Job *job = (Fl_Text_Async_Job*)data;
+  job->run_batch();
+  job->ready = 1;
+  Fl::awake_once(awake_cb, 0);
+}
+
+/*
+ Starts the next batch on a worker thread, or runs it right away if no
+ thread can be created.
+ */
+void Fl_Text_Async_Job::start_batch() {
+  running = true;
+  if (Fl::system_driver()->create_thread(thread_cb, this) < 0) {
+    run_batch();
+    ready = 1;
+  }
+  schedule();
+}
+
+/*
+ Delivers the result of a batch. Runs on the main thread.
+ */
+void Fl_Text_Async_Job::finish_batch() {
+  if (!buffer) {
+    running = false;
+    finish(3);
+    return;
+  }
+  std::string chunk;
+  chunk.swap(text);
+  bool last = eof || error;
+  if (!last) start_batch();
+  // 'running' is still set, so a modify callback that cancels the job
+  // does not delete it
+  Fl_Text_Buffer *buf = buffer;
+  if (!chunk.empty())
+    buf->insert(buf->length(), chunk.data(), (int)chunk.size());
+  if (last) {
+    running = false;
+    if (!buffer) {
+      finish(3);
+      return;
+    }
+    if (fclose(fp) != 0 && save) error = 2;
+    fp = 0;
+    finish(error);
+  } else if (buffer && cb) {
+    cb(buf, -1, total > 0 ? done / total : 0.0, cbArg);
+  }
+}
+
+/*
+ Unregisters and deletes the job, and reports the result.
+ */
+void Fl_Text_Async_Job::finish(int status) {
+  Fl_Text_Async_Job **p = &first;
+  while (*p && *p != this) p = &(*p)->next;
+  if (*p) *p = next;
+  Fl_Text_Buffer *buf = buffer;
+  Fl_Text_Async_Cb c = cb;
+  void *arg = cbArg;
+  if (buf) {
+    buf->mAsyncJob = 0;
+    if (!save) {
+      buf->input_file_was_transcoded = transcoded;
+      if (!status && transcoded && buf->transcoding_warning_action)
+        buf->transcoding_warning_action(buf);
+    }
+  }
+  delete this;
+  if (buf && c) c(buf, status, 1.0, arg);
+}
+
+/*
+ Delivers all batches that are done. Callbacks may start or cancel jobs,
+ so the jobs are collected first. Jobs that are running are not deleted.
+ */
+void Fl_Text_Async_Job::poll() {
+  std::vector<Fl_Text_Async_Job*> done;
+  for (Fl_Text_Async_Job *job = first; job; job = job->next)
+    if (job->running && job->ready) {
+      job->ready = 0;
+      done.push_back(job);
+    }
+  for (size_t i = 0; i < done.size(); i++)
+    done[i]->finish_batch();
+}
+
+/*
+ Makes sure that the main thread checks the running jobs again soon.
+ */
+void Fl_Text_Async_Job::schedule() {
+  if (Fl::has_timeout(timeout_cb))
+    return;
+  for (Fl_Text_Async_Job *job = first; job; job = job->next)
+    if (job->running) {
+      Fl::add_timeout(job->ready ? 0.0 : 0.05, timeout_cb);
+      return;
+    }
+}
+
+void Fl_Text_Async_Job::awake_cb(void *) {
+  poll();
+}
+
+void Fl_Text_Async_Job::timeout_cb(void *) {
+  poll();
+  schedule();
+}
+
+
+/**
+ \brief Loads a text file into the buffer without blocking the user interface.
+
+ The buffer is cleared, and the file is read and transcoded to UTF-8 in
+ chunks on a worker thread, like loadfile() would read it. The main thread
+ appends each chunk to the buffer as it arrives, so the text can be viewed
+ and scrolled while the rest of the file is still loading. Every chunk
+ calls \p cb with the progress, and the last call reports the result.
+ input_file_was_transcoded and transcoding_warning_action work as for
+ loadfile() when the file is complete.
+
+ The chunks are passed to the main thread with Fl::awake(). As for any
+ use of threads with FLTK, the program should call Fl::lock() once before
+ it shows its first window. Otherwise the file is still loaded, but the
+ main thread only checks for new chunks a few times per second. On
+ platforms without thread support, the file is read from a timeout on the
+ main thread, one batch of chunks at a time.
+
+ Only one file can be loaded or saved asynchronously per buffer at a time.
+ A pending operation is cancelled first.
+
+ \param file UTF-8 encoded file name
+ \param cb called on the main thread with the progress and the result, or NULL
+ \param cbArg passed to \p cb
+ \param buflen size of the chunks in bytes
+ \return 0 if loading was started, 1 if the file could not be opened
+ \see cancel_async(), Fl_Text_Async_Cb
+ */
+int Fl_Text_Buffer::loadfile_async(const char *file, Fl_Text_Async_Cb cb,
+                                   void *cbArg, int buflen)
+{
+  cancel_async();
+  FILE *fp = fl_fopen(file, "r");
+  if (!fp)
+    return 1;
+  select(0, length());
+  remove_selection();
+  Fl_Text_Async_Job *job = new Fl_Text_Async_Job(this, fp, false, buflen);
+  job->cb = cb;
+  job->cbArg = cbArg;
+  if (fseek(fp, 0, SEEK_END) == 0) {
+    long size = ftell(fp);
+    if (size > 0) job->total = (double)size;
+    rewind(fp);
+  }
+  mAsyncJob = job;
+  Fl_Text_Async_Job::start(job);
+  return 0;
+}
+
+
+/**
+ \brief Saves the buffer to a text file without blocking the user interface.
+
+ The text is copied once, and the copy is written in chunks on a worker
+ thread. Changes made to the buffer after this call are not saved. Every
+ chunk calls \p cb with the progress, and the last call reports the result
+ as savefile() would return it. The notes about Fl::lock() and platforms
+ without thread support of loadfile_async() apply.
+
+ \param file UTF-8 encoded file name
+ \param cb called on the main thread with the progress and the result, or NULL
+ \param cbArg passed to \p cb
+ \param buflen size of the chunks in bytes
+ \return 0 if saving was started, 1 if the file could not be opened
+ \see cancel_async(), Fl_Text_Async_Cb
+ */
+int Fl_Text_Buffer::savefile_async(const char *file, Fl_Text_Async_Cb cb,
+                                   void *cbArg, int buflen)
+{
+  cancel_async();
+  FILE *fp = fl_fopen(file, "w");
+  if (!fp)
+    return 1;
+  Fl_Text_Async_Job *job = new Fl_Text_Async_Job(this, fp, true, buflen);
+  job->cb = cb;
+  job->cbArg = cbArg;
+  job->snapshot = text();
+  job->total = mLength;
+  job->eof = (mLength == 0);
+  mAsyncJob = job;
+  Fl_Text_Async_Job::start(job);
+  return 0;
+}
+
+
+/**
+ \brief Cancels loadfile_async() or savefile_async().
+
+ No more text is added to the buffer or written to the file. The callback
+ is called once more, with status 3. The text that was already loaded stays
+ in the buffer, and a partially written file is not removed.
+ */
+void Fl_Text_Buffer::cancel_async()
+{
+  Fl_Text_Async_Job *job = mAsyncJob;
+  if (!job)
+    return;
+  Fl_Text_Async_Cb cb = job->cb;
+  void *cbArg = job->cbArg;
+  double progress = job->total > 0 ? job->done / job->total : 0.0;
+  job->detach();
+  if (cb) cb(this, 3, progress, cbArg);
+}
+
+
 /**
  As prev_char() but returns 0 if the beginning of the buffer is reached.
  */
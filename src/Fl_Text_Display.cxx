@@ -25,10 +25,13 @@
 #include <limits.h>
 #include <ctype.h>
 #include <string.h>
+#include <vector>
+#include <map>
 #include <FL/Fl.H>
 #include <FL/platform.H>
 #include <FL/Fl_Text_Buffer.H>
 #include <FL/Fl_Text_Display.H>
+#include <FL/Fl_Device.H>
 #include <FL/Fl_Window.H>
 #include <FL/Fl_Menu_Item.H>
 #include <FL/Fl_Input.H>
@@ -95,6 +98,224 @@ static Fl_Menu_Item rmb_menu[] = {
 // CET - FIXME
 #define TMPFONTWIDTH 6
 
+/*
+ Advance widths of the characters U+0000 to U+00FF in the fonts used by a
+ text display, measured as they are needed, so that measuring text one
+ character at a time doesn't call into the font backend for every
+ character. There is one entry per style, plus one for textfont().
+ An entry is measured again when the graphics driver changes, e.g. while
+ printing, because other devices have their own metrics.
+
+ A font where all printable ASCII characters have the same advance and
+ runs of them are not kerned is marked as monospaced. The width of ASCII
+ text in such a font is computed without measuring it at all.
+ */
+class Fl_Text_Advance_Cache {
+public:
+  struct Font {
+    Fl_Graphics_Driver *driver;
+    Fl_Font font;
+    Fl_Fontsize size;
+    float scale;
+    int monospace;          // 1 if the font is monospaced
+    double mono;            // advance of all ASCII characters if monospace
+    double advance[256];    // negative if not measured yet
+
+    Font() : driver(0), font(0), size(0), scale(0.0f), monospace(0), mono(0.0) { }
+
+    double width(unsigned c, const char *s, int len) {
+      if (advance[c] < 0) {
+        fl_font(font, size);
+        advance[c] = fl_width(s, len);
+      }
+      return advance[c];
+    }
+  };
+  std::vector<Font> fonts;
+  std::vector<int> ends;    // scratch for find_x(), reused to avoid allocations
+
+  // Return the entry for a style slot, resetting it if the font or driver changed.
+  Font *get(int slot, Fl_Font font, Fl_Fontsize size) {
+    if (slot >= (int)fonts.size())
+      fonts.resize(slot + 1);
+    Font *f = &fonts[slot];
+    float scale = fl_graphics_driver->scale();
+    if (f->driver != fl_graphics_driver || f->font != font ||
+        f->size != size || f->scale != scale) {
+      f->driver = fl_graphics_driver;
+      f->font = font;
+      f->size = size;
+      f->scale = scale;
+      for (int i = 0; i < 256; i++)
+        f->advance[i] = -1.0;
+      fl_font(font, size);
+      double w = fl_width("W", 1);
+      f->monospace = (fl_width("i", 1) == w && fl_width(" ", 1) == w &&
+                      fl_width(".", 1) == w && fl_width("iW .mi", 6) == 6 * w);
+      f->mono = w;
+    }
+    return f;
+  }
+};
+
+/*
+ Number of visual lines of every buffer line in continuous wrap mode.
+
+ Entry i is the number of visual lines that buffer line i adds to the
+ display, i.e. count_lines() from its start to the start of the next line.
+ Lines that were not measured yet hold an estimate based on their length
+ and are measured lazily or during idle time. A Fenwick tree over the
+ entries returns the visual line number of any buffer line in O(log n),
+ which makes counting and skipping wrapped lines independent of the
+ distance from the start of the buffer.
+ */
+class Fl_Text_Wrap_Cache {
+public:
+  std::vector<int> count;             // visual lines per buffer line
+  std::vector<unsigned char> known;   // 1 if count[i] was measured
+  std::vector<int> tree;              // Fenwick tree over count[]
+  bool stale;                         // tree must be rebuilt
+  int nUnknown;                       // number of estimated entries
+  int next;                           // first line the idle task checks
+  int avgChars;                       // characters per visual line estimate
+  // layout the entries were computed for
+  int width, tabs, length, nStyles;
+  Fl_Font font;
+  Fl_Fontsize size;
+  const Fl_Text_Display::Style_Table_Entry *styles;
+
+  Fl_Text_Wrap_Cache()
+  : stale(true), nUnknown(0), next(0), avgChars(1), width(-1), tabs(0),
+    length(-1), nStyles(0), font(0), size(0), styles(0) { }
+
+  int lines() const { return (int)count.size(); }
+
+  int estimate(int len, bool newline) const {
+    return len / avgChars + (newline ? 1 : (len > 0));
+  }
+
+  void build() {
+    int n = lines();
+    tree.assign(n + 1, 0);
+    for (int i = 1; i <= n; i++) {
+      tree[i] += count[i-1];
+      int j = i + (i & -i);
+      if (j <= n) tree[j] += tree[i];
+    }
+    stale = false;
+  }
+
+  void set(int i, int n, bool exact) {
+    if (exact && !known[i]) { known[i] = 1; nUnknown--; }
+    int delta = n - count[i];
+    count[i] = n;
+    if (stale || !delta) return;
+    for (int j = i + 1; j < (int)tree.size(); j += j & -j)
+      tree[j] += delta;
+  }
+
+  // number of visual lines before buffer line i
+  int prefix(int i) {
+    if (stale) build();
+    int n = 0;
+    for (; i > 0; i -= i & -i)
+      n += tree[i];
+    return n;
+  }
+
+  // last buffer line that starts at or before visual line v
+  int find(int v) {
+    if (stale) build();
+    int n = lines(), i = 0, step = 1;
+    while (step * 2 <= n) step *= 2;
+    for (; step; step >>= 1) {
+      if (i + step <= n && tree[i + step] <= v) {
+        i += step;
+        v -= tree[i];
+      }
+    }
+    return i < n ? i : n - 1;
+  }
+
+  // measure entry i again, its count is kept as the estimate
+  void forget(int i) {
+    if (known[i]) { known[i] = 0; nUnknown++; }
+    if (next > i) next = i;
+  }
+
+  // replace nOld entries at first by nNew unknown entries
+  void replace(int first, int nOld, int nNew) {
+    for (int i = first; i < first + nOld; i++)
+      if (!known[i]) nUnknown--;
+    count.erase(count.begin() + first, count.begin() + first + nOld);
+    known.erase(known.begin() + first, known.begin() + first + nOld);
+    count.insert(count.begin() + first, nNew, 0);
+    known.insert(known.begin() + first, nNew, 0);
+    nUnknown += nNew;
+    if (next > first) next = first;
+    stale = true;
+  }
+};
+
+/*
+ Pixel width of every buffer line, used for the horizontal scroll range
+ when lines are not wrapped.
+
+ Entries of lines that were edited are replaced and measured right away,
+ up to a limit; all other lines are measured lazily or during idle time.
+ The measured widths are also counted in a sorted map, so the width of the
+ longest line is always known without looking at the other lines again.
+ */
+class Fl_Text_Width_Cache {
+public:
+  std::vector<int> width;             // width per buffer line, -1 if unknown
+  std::map<int, int> widths;          // number of lines with each known width
+  int nUnknown;                       // number of entries that are -1
+  int next;                           // all lines before this one are known
+  bool uniform;                       // all styles use the same font
+  // layout the entries were computed for
+  int tabs, length, nStyles;
+  Fl_Font font;
+  Fl_Fontsize size;
+  const Fl_Text_Display::Style_Table_Entry *styles;
+
+  Fl_Text_Width_Cache()
+  : nUnknown(0), next(0), uniform(true), tabs(0), length(-1), nStyles(0),
+    font(0), size(0), styles(0) { }
+
+  int lines() const { return (int)width.size(); }
+
+  int longest() const { return widths.empty() ? 0 : widths.rbegin()->first; }
+
+  void forget(int i) {
+    if (width[i] < 0) return;
+    std::map<int, int>::iterator it = widths.find(width[i]);
+    if (--it->second == 0) widths.erase(it);
+    width[i] = -1;
+    nUnknown++;
+    if (next > i) next = i;
+  }
+
+  void set(int i, int w) {
+    forget(i);
+    width[i] = w;
+    widths[w]++;
+    nUnknown--;
+  }
+
+  // replace nOld entries at first by nNew unknown entries
+  void replace(int first, int nOld, int nNew) {
+    for (int i = first; i < first + nOld; i++)
+      forget(i);
+    nUnknown += nNew - nOld;
+    if (nOld > nNew)
+      width.erase(width.begin() + first + nNew, width.begin() + first + nOld);
+    else if (nNew > nOld)
+      width.insert(width.begin() + first + nOld, nNew - nOld, -1);
+    if (next > first) next = first;
+  }
+};
+
 
 
 /**
@@ -146,6 +367,10 @@ Fl_Text_Display::Fl_Text_Display(int X, int Y, int W, int H, const char* l)
   mUnfinishedStyle = 0;
   mUnfinishedHighlightCB = 0;
   mHighlightCBArg = 0;
+  mHighlightEngineCB = 0;
+  mHighlightEngineArg = 0;
+  mHighlightFrom = mHighlightTo = -1;
+  mHighlightAhead = -1;
   mMaxsize = 0;
   mSuppressResync = 0;
   mNLinesDeleted = 0;
@@ -161,6 +386,9 @@ Fl_Text_Display::Fl_Text_Display(int X, int Y, int W, int H, const char* l)
   mVScrollBar->callback((Fl_Callback*)v_scrollbar_cb, this);
 
   display_needs_recalc_ = false;
+  mWrapCache = 0;
+  mWidthCache = 0;
+  mAdvanceCache = 0;
 
   scrollbar_width_ = 0;         // 0: default from Fl::scrollbar_size()
   scrollbar_align_ = FL_ALIGN_BOTTOM_RIGHT;
@@ -220,6 +448,10 @@ Fl_Text_Display::~Fl_Text_Display() {
     mBuffer->remove_modify_callback(buffer_modified_cb, this);
     mBuffer->remove_predelete_callback(buffer_predelete_cb, this);
   }
+  wrap_cache_clear();
+  width_cache_clear();
+  delete mAdvanceCache;
+  Fl::remove_idle(highlight_idle_cb, this);
   if (mLineStarts) delete[] mLineStarts;
   if (linenumber_format_) {
     free((void*)linenumber_format_);
@@ -370,6 +602,8 @@ void Fl_Text_Display::buffer( Fl_Text_Buffer *buf ) {
   /* If the text display is already displaying a buffer, clear it off
    of the display and remove our callback from it */
   if ( buf == mBuffer) return;
+  wrap_cache_clear();
+  width_cache_clear();
   if ( mBuffer != 0 ) {
     // we must provide a copy of the buffer that we are deleting!
     char *deletedText = mBuffer->text();
@@ -455,6 +689,52 @@ void Fl_Text_Display::highlight_data(Fl_Text_Buffer *styleBuffer,
   damage(FL_DAMAGE_EXPOSE);
 }
 
+/**
+ \brief Highlight the text incrementally in the background.
+
+ Instead of styling the whole buffer whenever the text changes, the display
+ runs \p highlightCB on the lines that may have changed their style, in
+ short time slices from an idle callback. The visible text is styled first
+ when it is far from the position where the text was modified. Styling
+ continues with the following lines until the style at the end of a slice
+ is the same as before, which means that the rest of the buffer is still
+ styled correctly.
+
+ The style buffer and style table must be set with highlight_data() first.
+ While the engine is active, the display inserts and removes style bytes in
+ the style buffer as the text buffer is modified, so no modify callback is
+ needed to keep both buffers in sync. New text gets the style of the
+ character in front of it until it is styled.
+
+ \param highlightCB the highlighter, or NULL to stop highlighting
+ \param cbArg an optional argument for the highlighter
+
+ \see highlight_data(), Highlight_Cb
+ */
+void Fl_Text_Display::highlight_engine(Highlight_Cb highlightCB, void *cbArg) {
+  mHighlightEngineCB = highlightCB;
+  mHighlightEngineArg = cbArg;
+  mHighlightFrom = mHighlightTo = -1;
+  mHighlightAhead = -1;
+  Fl::remove_idle(highlight_idle_cb, this);
+  if (!highlightCB || !mBuffer || !mStyleBuffer)
+    return;
+
+  int length = mBuffer->length();
+  if (mStyleBuffer->length() != length) {
+    char *style = (char *)malloc(length + 1);
+    memset(style, 'A', length);
+    style[length] = 0;
+    highlight_replace(0, mStyleBuffer->length(), style, length);
+    free(style);
+  }
+  mHighlightFrom = 0;
+  mHighlightTo = length;
+  Fl::add_idle(highlight_idle_cb, this);
+}
+
+
+
 /**
  \brief Find the longest line of all visible lines.
 
@@ -467,6 +747,26 @@ int Fl_Text_Display::longest_vline() const {
   return longest;
 }
 
+/**
+ \brief Find the longest line of the buffer.
+
+ If lines are not wrapped, the width of every buffer line is kept in the
+ width cache, so this is the exact width of the whole document. Lines that
+ were not measured yet are measured in the background; until then, the
+ longest visible line is taken into account as well. In continuous wrap
+ mode, this is the same as longest_vline().
+
+ \return the width of the longest line in pixels
+ */
+int Fl_Text_Display::longest_line() const {
+  Fl_Text_Width_Cache *c = width_cache();
+  if (!c)
+    return longest_vline();
+  if (c->nUnknown == 0)
+    return c->longest();
+  return max(c->longest(), longest_vline());
+}
+
 /**
  \brief Change the size of the displayed text area.
 
@@ -637,7 +937,7 @@ void Fl_Text_Display::recalc_display() {
 
       if (!mHScrollBar->visible() &&
           scrollbar_align() & (FL_ALIGN_TOP|FL_ALIGN_BOTTOM) &&
-          (mVScrollBar->visible() || longest_vline() > text_area.w))
+          (mVScrollBar->visible() || longest_line() > text_area.w))
       {
         char wrap_at_bounds = mContinuousWrap && (mWrapMarginPix<text_area.w);
         if (!wrap_at_bounds) {
@@ -718,7 +1018,7 @@ void Fl_Text_Display::recalc_display() {
     display_insert();
 
   // in case horizontal offset is now greater than longest line
-  int maxhoffset = max(0, longest_vline()-text_area.w);
+  int maxhoffset = max(0, longest_line()-text_area.w);
   if (mHorizOffset > maxhoffset)
     scroll_(mTopLineNumHint, maxhoffset);
 
@@ -1455,49 +1755,14 @@ int Fl_Text_Display::count_lines(int startPos, int endPos,
    of every segment of text for every line change and style change and find
    potential soft line breaks.
 
-   Most of the resulting information is needed for calculating the vertical
-   scroll bar size. After a certain text length, the scroll bar size is no
-   longer very precise anyway, so we optimize line count for all lines but
-   the visible ones (plus minus a few lines for rounding).
-
-   The optimized code is several magnitudes faster and makes scrolling and
-   window resizing of long texts quite responsive. There is a slight but IMHO
-   tollerable drawback: when walking huge files using arrow up and down, the
-   text display sometimes jumps 2 or 3 lines instead of 1, but the overall
-   buffer stays intact as well as the scroll position.
+   For large buffers the number of visual lines of every buffer line is
+   kept in the wrap cache. Lines are measured as they are needed and in the
+   background; until then an estimate based on the line length is used, so
+   the vertical scroll bar size converges to the exact value over time.
    */
-  if (buffer()->length() > 16384) {
-    // Optimized line counting
-    int nLines = 0;
-    int firstVisibleChar = buffer()->rewind_lines(mFirstChar, 3);
-    int lastVisibleChar = buffer()->skip_lines(mLastChar, 3);
-    // Calculate the averga number of characters up to a soft line break
-    if (mColumnScale==0.0) x_to_col(1.0);
-    int avgCharsPerLine = mWrapMarginPix;
-    if (!avgCharsPerLine) avgCharsPerLine = text_area.w;
-    avgCharsPerLine = (int)(avgCharsPerLine / mColumnScale) + 1;
-
-    // first segment, lines up to display, count fast
-    if (startPos < firstVisibleChar) {
-      int tmpEnd = endPos<firstVisibleChar ? endPos : firstVisibleChar;
-      nLines += buffer()->estimate_lines(startPos, tmpEnd, avgCharsPerLine);
-      startPos = tmpEnd;
-    }
-    // second segement, count displayed liens
-    if (startPos < endPos && startPos < mLastChar) {
-      // Precisse line counting only for visible text:
-      int tmpEnd = endPos<lastVisibleChar ? endPos : lastVisibleChar;
-      wrapped_line_counter(buffer(), startPos, tmpEnd, INT_MAX,
-                           startPosIsLineStart, 0, &retPos, &retLines, &retLineStart,
-                           &retLineEnd);
-      nLines += retLines;
-      startPos = tmpEnd;
-    }
-    // third segement is everything after displayed lines
-    if (startPos < endPos && startPos >= lastVisibleChar) {
-      nLines += buffer()->estimate_lines(startPos, endPos, avgCharsPerLine);
-    }
-    return nLines;
+  if (wrap_cache()) {
+    int nLines = wrap_cache_vline(endPos) - wrap_cache_vline(startPos);
+    return nLines > 0 ? nLines : 0;
   } else {
     // Precise line counting only for small text buffer sizes:
     wrapped_line_counter(buffer(), startPos, endPos, INT_MAX,
@@ -1542,6 +1807,10 @@ int Fl_Text_Display::skip_lines(int startPos, int nLines,
   if (nLines == 0)
     return startPos;
 
+  /* long jumps in large buffers go through the wrap cache */
+  if (nLines > mNVisibleLines && wrap_cache())
+    return wrap_cache_vline_start(wrap_cache_vline(startPos) + nLines);
+
   /* use the common line counting routine to count forward */
   wrapped_line_counter(buffer(), startPos, buffer()->length(),
                        nLines, startPosIsLineStart, 0,
@@ -1645,6 +1914,12 @@ int Fl_Text_Display::rewind_lines(int startPos, int nLines) {
   if (!mContinuousWrap)
     return buf->rewind_lines(startPos, nLines);
 
+  /* long jumps in large buffers go through the wrap cache */
+  if (nLines > mNVisibleLines && wrap_cache()) {
+    int vline = wrap_cache_vline(startPos) - nLines;
+    return wrap_cache_vline_start(vline > 0 ? vline : 0);
+  }
+
   pos = startPos;
   for (;;) {
     lineStart = buf->line_start(pos);
@@ -1662,6 +1937,610 @@ int Fl_Text_Display::rewind_lines(int startPos, int nLines) {
 
 
 
+/**
+ \brief Return the wrap cache for the current buffer and layout.
+
+ The cache is only used in continuous wrap mode for buffers larger than
+ 16k. It is rebuilt with estimated line counts whenever the wrap width,
+ fonts or tab distance have changed since it was filled.
+
+ \return the wrap cache, or NULL if it is not used
+ */
+Fl_Text_Wrap_Cache *Fl_Text_Display::wrap_cache() const {
+  Fl_Text_Buffer *buf = mBuffer;
+  if (!mContinuousWrap || !buf || buf->length() <= 16384) {
+    wrap_cache_clear();
+    return NULL;
+  }
+  Fl_Text_Wrap_Cache *c = mWrapCache;
+  if (!c)
+    c = mWrapCache = new Fl_Text_Wrap_Cache;
+  int width = mWrapMarginPix ? mWrapMarginPix : text_area.w;
+  if (c->width != width || c->length != buf->length() ||
+      c->tabs != buf->tab_distance() || c->font != textfont_ ||
+      c->size != textsize_ || c->styles != mStyleTable ||
+      c->nStyles != mNStyles) {
+    c->width = width;
+    c->length = buf->length();
+    c->tabs = buf->tab_distance();
+    c->font = textfont_;
+    c->size = textsize_;
+    c->styles = mStyleTable;
+    c->nStyles = mNStyles;
+    if (mColumnScale == 0.0) x_to_col(1.0);
+    c->avgChars = (int)(width / mColumnScale) + 1;
+    int n = buf->count_lines(0, buf->length()) + 1;
+    c->count.resize(n);
+    c->known.assign(n, 0);
+    for (int i = 0, pos = 0; i < n; i++) {
+      int end = buf->line_end(pos);
+      c->count[i] = c->estimate(end - pos, end < buf->length());
+      pos = end + 1;
+    }
+    c->nUnknown = n;
+    c->next = 0;
+    c->stale = true;
+  }
+  if (c->nUnknown && !Fl::has_idle(wrap_cache_idle_cb, (void*)this))
+    Fl::add_idle(wrap_cache_idle_cb, (void*)this);
+  return c;
+}
+
+
+
+/**
+ \brief Release the wrap cache and stop measuring lines in the background.
+ */
+void Fl_Text_Display::wrap_cache_clear() const {
+  if (!mWrapCache) return;
+  Fl::remove_idle(wrap_cache_idle_cb, (void*)this);
+  delete mWrapCache;
+  mWrapCache = NULL;
+}
+
+
+
+/**
+ \brief Measure a buffer line and store its number of visual lines.
+
+ \param line index of the line in the buffer, first line is 0
+ \param lineStart index of the first character of the line
+ */
+void Fl_Text_Display::wrap_cache_measure(int line, int lineStart) const {
+  Fl_Text_Buffer *buf = mBuffer;
+  int retPos, retLines, retLineStart, retLineEnd;
+  int end = buf->line_end(lineStart);
+  bool last = (end == buf->length());
+  wrapped_line_counter(buf, lineStart, end, INT_MAX, true, 0,
+                       &retPos, &retLines, &retLineStart, &retLineEnd, last);
+  mWrapCache->set(line, last ? retLines : retLines + 1, true);
+}
+
+
+
+/**
+ \brief Return the number of visual lines before a buffer position.
+
+ The buffer line containing \p pos is measured if \p pos is not at its
+ start, so that partial counts never exceed the cached line count.
+
+ \param pos index into the buffer
+ \return visual line number of \p pos, first line is 0
+ */
+int Fl_Text_Display::wrap_cache_vline(int pos) const {
+  Fl_Text_Buffer *buf = mBuffer;
+  Fl_Text_Wrap_Cache *c = mWrapCache;
+  int line = buf->count_lines(0, pos);
+  int lineStart = buf->line_start(pos);
+  int nLines = c->prefix(line);
+  if (pos > lineStart) {
+    if (!c->known[line])
+      wrap_cache_measure(line, lineStart);
+    if (pos == buf->length()) {
+      nLines += c->count[line];
+    } else {
+      int retPos, retLines, retLineStart, retLineEnd;
+      wrapped_line_counter(buf, lineStart, pos, INT_MAX, true, 0,
+                           &retPos, &retLines, &retLineStart, &retLineEnd);
+      nLines += retLines;
+    }
+  }
+  return nLines;
+}
+
+
+
+/**
+ \brief Return the start of a visual line.
+
+ \param vline visual line number, first line is 0
+ \return index of the first character of that line, or the buffer length
+ */
+int Fl_Text_Display::wrap_cache_vline_start(int vline) const {
+  Fl_Text_Buffer *buf = mBuffer;
+  Fl_Text_Wrap_Cache *c = mWrapCache;
+  int retPos, retLines, retLineStart, retLineEnd;
+  for (;;) {
+    int line = c->find(vline);
+    int lineStart = line ? buf->skip_lines(0, line) : 0;
+    if (!c->known[line]) {
+      /* measuring may move the line, look it up again */
+      wrap_cache_measure(line, lineStart);
+      continue;
+    }
+    int nLines = vline - c->prefix(line);
+    if (nLines <= 0)
+      return lineStart;
+    wrapped_line_counter(buf, lineStart, buf->length(), nLines, true, 0,
+                         &retPos, &retLines, &retLineStart, &retLineEnd);
+    return retPos;
+  }
+}
+
+
+
+/**
+ \brief Update the wrap cache after a buffer modification.
+
+ The buffer lines touched by the modification are replaced. A limited number
+ of them is measured right away, the rest is estimated and measured in the
+ background.
+
+ \param pos starting index of modification
+ \param nInserted number of bytes inserted
+ \param nDeleted number of bytes deleted
+ \param deletedText the deleted text, must not be NULL if nDeleted is set
+ */
+void Fl_Text_Display::wrap_cache_modified(int pos, int nInserted, int nDeleted,
+                                          const char *deletedText) {
+  Fl_Text_Buffer *buf = mBuffer;
+  Fl_Text_Wrap_Cache *c = mWrapCache;
+  int line = buf->count_lines(0, pos);
+  int nNew = nInserted ? buf->count_lines(pos, pos + nInserted) : 0;
+  int nOld = nDeleted ? countlines(deletedText) : 0;
+  c->replace(line, nOld + 1, nNew + 1);
+  c->length = buf->length();
+  int lineStart = buf->line_start(pos);
+  for (int i = 0; i <= nNew; i++) {
+    int end = buf->line_end(lineStart);
+    if (i < 64)
+      wrap_cache_measure(line + i, lineStart);
+    else
+      c->count[line + i] = c->estimate(end - lineStart, end < buf->length());
+    lineStart = end + 1;
+  }
+}
+
+
+
+/**
+ \brief Measure lines that changed their style again.
+
+ The counts of the lines are kept as estimates until they are measured.
+
+ \param start, end range of text that changed its style
+ */
+void Fl_Text_Display::wrap_cache_restyled(int start, int end) {
+  Fl_Text_Wrap_Cache *c = mWrapCache;
+  if (c->length != mBuffer->length())
+    return;
+  int first = mBuffer->count_lines(0, start);
+  int last = first + mBuffer->count_lines(start, end);
+  for (int i = first; i <= last && i < c->lines(); i++)
+    c->forget(i);
+  if (c->nUnknown && !Fl::has_idle(wrap_cache_idle_cb, (void*)this))
+    Fl::add_idle(wrap_cache_idle_cb, (void*)this);
+}
+
+
+
+/**
+ \brief Renumber the top line and the buffer line count from the wrap cache.
+
+ Measuring lines changes the visual line numbers of everything below them,
+ so this is needed after the cache was updated.
+ */
+void Fl_Text_Display::wrap_cache_sync() {
+  if (!wrap_cache()) return;
+  mTopLineNum = wrap_cache_vline(mFirstChar) + 1;
+  mNBufferLines = wrap_cache_vline(mBuffer->length());
+}
+
+
+
+/**
+ \brief Idle callback that measures the estimated lines of the wrap cache.
+
+ Every call measures lines for a few milliseconds, then updates the
+ vertical scrollbar. The callback removes itself when all lines are known
+ or the widget is not visible.
+
+ \param d the text display
+ */
+void Fl_Text_Display::wrap_cache_idle_cb(void *d) {
+  Fl_Text_Display *textD = (Fl_Text_Display *)d;
+  Fl_Text_Wrap_Cache *c = textD->wrap_cache();
+  if (!c || !c->nUnknown || !textD->visible_r()) {
+    Fl::remove_idle(wrap_cache_idle_cb, d);
+    return;
+  }
+  Fl_Text_Buffer *buf = textD->mBuffer;
+  Fl_Timestamp start = Fl::now();
+  int n = c->lines(), line = c->next;
+  int pos = line ? buf->skip_lines(0, line) : 0;
+  for (int i = 1; line < n; line++, i++) {
+    if (!c->known[line])
+      textD->wrap_cache_measure(line, pos);
+    pos = buf->line_end(pos) + 1;
+    if (!(i & 63) && Fl::seconds_since(start) > 0.005) {
+      line++;
+      break;
+    }
+  }
+  c->next = line < n ? line : 0;
+  int topLineNum = textD->mTopLineNum, nBufferLines = textD->mNBufferLines;
+  textD->wrap_cache_sync();
+  if (topLineNum != textD->mTopLineNum || nBufferLines != textD->mNBufferLines)
+    textD->update_v_scrollbar();
+}
+
+
+
+/**
+ \brief Return the width cache for the current buffer and layout.
+
+ The cache is only used if lines are not wrapped. It is reset whenever the
+ fonts or the tab distance have changed since it was filled. Lines that
+ were edited are measured here, and so are all lines of small buffers. The
+ other lines of large buffers are measured during idle time.
+
+ \return the width cache, or NULL if it is not used
+ */
+Fl_Text_Width_Cache *Fl_Text_Display::width_cache() const {
+  Fl_Text_Buffer *buf = mBuffer;
+  if (mContinuousWrap || !buf) {
+    width_cache_clear();
+    return NULL;
+  }
+  Fl_Text_Width_Cache *c = mWidthCache;
+  if (!c)
+    c = mWidthCache = new Fl_Text_Width_Cache;
+  if (c->length != buf->length() || c->tabs != buf->tab_distance() ||
+      c->font != textfont_ || c->size != textsize_ ||
+      c->styles != mStyleTable || c->nStyles != mNStyles) {
+    c->length = buf->length();
+    c->tabs = buf->tab_distance();
+    c->font = textfont_;
+    c->size = textsize_;
+    c->styles = mStyleTable;
+    c->nStyles = mNStyles;
+    c->uniform = true;
+    for (int i = 0; i < mNStyles; i++)
+      if (mStyleTable[i].font != mStyleTable[0].font ||
+          mStyleTable[i].size != mStyleTable[0].size)
+        c->uniform = false;
+    int n = buf->count_lines(0, buf->length()) + 1;
+    c->width.assign(n, -1);
+    c->widths.clear();
+    c->nUnknown = n;
+    c->next = 0;
+  }
+  if (c->nUnknown)
+    width_cache_scan(buf->length() <= 16384 ? INT_MAX : 64);
+  if (c->nUnknown && !Fl::has_idle(width_cache_idle_cb, (void*)this))
+    Fl::add_idle(width_cache_idle_cb, (void*)this);
+  return c;
+}
+
+
+
+/**
+ \brief Release the width cache and stop measuring lines in the background.
+ */
+void Fl_Text_Display::width_cache_clear() const {
+  if (!mWidthCache) return;
+  Fl::remove_idle(width_cache_idle_cb, (void*)this);
+  delete mWidthCache;
+  mWidthCache = NULL;
+}
+
+
+
+/**
+ \brief Measure a buffer line and store its width.
+
+ \param line index of the line in the buffer, first line is 0
+ \param lineStart index of the first character of the line
+ */
+void Fl_Text_Display::width_cache_measure(int line, int lineStart) const {
+  int lineLen = mBuffer->line_end(lineStart) - lineStart;
+  int w = lineLen ? handle_vline(GET_WIDTH, lineStart, lineLen, 0, 0, 0, 0, 0, 0) : 0;
+  mWidthCache->set(line, w);
+}
+
+
+
+/**
+ \brief Measure unknown lines of the width cache, in buffer order.
+
+ Lines before Fl_Text_Width_Cache::next are all known, so this continues
+ with the first line that may need to be measured.
+
+ \param maxLines maximum number of lines to measure
+ */
+void Fl_Text_Display::width_cache_scan(int maxLines) const {
+  Fl_Text_Buffer *buf = mBuffer;
+  Fl_Text_Width_Cache *c = mWidthCache;
+  int n = c->lines(), line = c->next;
+  int pos = line ? buf->skip_lines(0, line) : 0;
+  for (; line < n && maxLines > 0; line++) {
+    if (c->width[line] < 0) {
+      width_cache_measure(line, pos);
+      maxLines--;
+    }
+    pos = buf->line_end(pos) + 1;
+  }
+  while (line < n && c->width[line] >= 0)
+    line++;
+  c->next = line;
+}
+
+
+
+/**
+ \brief Update the width cache after a buffer modification.
+
+ The buffer lines touched by the modification are replaced by unknown
+ entries. They are measured by the next call of width_cache(), when the
+ style buffer was updated as well, or in the background.
+
+ \param pos starting index of modification
+ \param nInserted number of bytes inserted
+ \param nDeleted number of bytes deleted
+ \param deletedText the deleted text, must not be NULL if nDeleted is set
+ */
+void Fl_Text_Display::width_cache_modified(int pos, int nInserted, int nDeleted,
+                                           const char *deletedText) {
+  Fl_Text_Buffer *buf = mBuffer;
+  Fl_Text_Width_Cache *c = mWidthCache;
+  int line = buf->count_lines(0, pos);
+  int nNew = nInserted ? buf->count_lines(pos, pos + nInserted) : 0;
+  int nOld = nDeleted ? countlines(deletedText) : 0;
+  c->replace(line, nOld + 1, nNew + 1);
+  c->length = buf->length();
+}
+
+
+
+/**
+ \brief Forget the widths of lines that changed their style.
+
+ This is only needed if the styles use different fonts or sizes.
+
+ \param start, end range of text that changed its style
+ */
+void Fl_Text_Display::width_cache_restyled(int start, int end) {
+  Fl_Text_Width_Cache *c = mWidthCache;
+  if (c->uniform || c->length != mBuffer->length())
+    return;
+  int first = mBuffer->count_lines(0, start);
+  int last = first + mBuffer->count_lines(start, end);
+  for (int i = first; i <= last && i < c->lines(); i++)
+    c->forget(i);
+  if (c->nUnknown && !Fl::has_idle(width_cache_idle_cb, (void*)this))
+    Fl::add_idle(width_cache_idle_cb, (void*)this);
+}
+
+
+
+/**
+ \brief Idle callback that measures the unknown lines of the width cache.
+
+ Every call measures lines for a few milliseconds. If the longest line
+ changed, the horizontal scrollbar is updated. The callback removes itself
+ when all lines are known or the widget is not visible.
+
+ \param d the text display
+ */
+void Fl_Text_Display::width_cache_idle_cb(void *d) {
+  Fl_Text_Display *textD = (Fl_Text_Display *)d;
+  Fl_Text_Width_Cache *c = textD->width_cache();
+  if (!c || !c->nUnknown || !textD->visible_r()) {
+    Fl::remove_idle(width_cache_idle_cb, d);
+    return;
+  }
+  int longest = c->longest();
+  Fl_Timestamp start = Fl::now();
+  while (c->nUnknown && Fl::seconds_since(start) < 0.005)
+    textD->width_cache_scan(64);
+  if (c->longest() != longest) {
+    if (!textD->mHScrollBar->visible() && c->longest() > textD->text_area.w)
+      textD->display_needs_recalc();
+    else
+      textD->update_h_scrollbar();
+  }
+}
+
+
+
+/**
+ \brief Replace a range of the style buffer without recording undo.
+
+ Style bytes written by the highlight engine are derived from the text, so
+ they must not end up in the undo history, even if the application enabled
+ undo on the style buffer.
+
+ \param start, end range of style bytes to replace
+ \param style new style bytes
+ \param n number of new style bytes
+ */
+void Fl_Text_Display::highlight_replace(int start, int end,
+                                        const char *style, int n) {
+  char canUndo = mStyleBuffer->mCanUndo;
+  mStyleBuffer->mCanUndo = 0;
+  mStyleBuffer->replace(start, end, style, n);
+  mStyleBuffer->mCanUndo = canUndo;
+}
+
+
+
+/**
+ \brief Keep the style buffer in sync with a modification of the text.
+
+ \param pos starting index of modification
+ \param nInserted number of bytes inserted
+ \param nDeleted number of bytes deleted
+ */
+void Fl_Text_Display::highlight_modified(int pos, int nInserted, int nDeleted) {
+  Fl_Text_Buffer *buf = mBuffer;
+  char fill = pos > 0 ? mStyleBuffer->byte_at(buf->prev_char(pos)) : 'A';
+  if (!fill) fill = 'A';
+  char *style = (char *)malloc(nInserted + 1);
+  memset(style, fill, nInserted);
+  style[nInserted] = 0;
+  highlight_replace(pos, pos + nDeleted, style, nInserted);
+  free(style);
+
+  /* Extend the range of outdated styles, and keep styling until the end
+   of the range, even if the styles converge earlier */
+  int lineStart = buf->line_start(pos);
+  if (mHighlightFrom < 0) {
+    mHighlightFrom = lineStart;
+    mHighlightTo = pos + nInserted;
+  } else {
+    if (mHighlightTo >= pos + nDeleted)
+      mHighlightTo += nInserted - nDeleted;
+    else if (mHighlightTo > pos)
+      mHighlightTo = pos;
+    mHighlightFrom = min(mHighlightFrom, lineStart);
+    mHighlightTo = max(mHighlightTo, pos + nInserted);
+  }
+  mHighlightAhead = -1;
+  if (!Fl::has_idle(highlight_idle_cb, this))
+    Fl::add_idle(highlight_idle_cb, this);
+}
+
+
+
+/**
+ \brief Run the highlighter on a range of text.
+
+ \param start start of a line
+ \param end start of a line or the end of the buffer
+ \param[in,out] changedStart, changedEnd extended to include all bytes that
+    changed their style
+ \return 1 if the last byte in the range kept its style
+ */
+int Fl_Text_Display::highlight_range(int start, int end,
+                                     int *changedStart, int *changedEnd) {
+  int n = end - start;
+  if (n <= 0)
+    return 1;
+  char *text = mBuffer->text_range(start, end);
+  char *old = mStyleBuffer->text_range(start, end);
+  char *style = (char *)malloc(n + 1);
+  memcpy(style, old, n + 1);
+  char context = start > 0 ? mStyleBuffer->byte_at(start - 1) : 0;
+  (*mHighlightEngineCB)(text, style, n, context, mHighlightEngineArg);
+
+  /* Only replace the part of the style buffer that changed */
+  int a = 0, b = n;
+  while (a < b && style[a] == old[a]) a++;
+  while (b > a && style[b-1] == old[b-1]) b--;
+  if (a < b) {
+    while (a > 0 && (text[a] & 0xc0) == 0x80) a--;
+    while (b < n && (text[b] & 0xc0) == 0x80) b++;
+    highlight_replace(start + a, start + b, style + a, b - a);
+    *changedStart = min(*changedStart, start + a);
+    *changedEnd = max(*changedEnd, start + b);
+  }
+  int same = (style[n-1] == old[n-1]);
+  free(text);
+  free(old);
+  free(style);
+  return same;
+}
+
+
+
+/**
+ \brief Style the next part of the outdated text.
+
+ Styles text for a few milliseconds and redisplays everything that
+ changed its style and is visible at once.
+
+ \return 1 if there is more text to style
+ */
+int Fl_Text_Display::highlight_slice() {
+  Fl_Text_Buffer *buf = mBuffer;
+  if (!buf || !mStyleBuffer || !mHighlightEngineCB || mHighlightFrom < 0)
+    return 0;
+  int length = buf->length();
+  if (mStyleBuffer->length() != length) {
+    /* someone else modified the style buffer, give up */
+    mHighlightFrom = -1;
+    return 0;
+  }
+
+  int changedStart = INT_MAX, changedEnd = -1;
+  const int chunk = 16384;
+
+  /* Style the visible text right away if the background pass is far from
+   it, with the styles in front of it as they are. The background pass
+   fixes it up when it gets there. */
+  int first = buf->line_start(mFirstChar);
+  if (first - mHighlightFrom > chunk && first != mHighlightAhead) {
+    int last = buf->line_end(mLastChar);
+    if (last < length) last++;
+    highlight_range(first, last, &changedStart, &changedEnd);
+    mHighlightAhead = first;
+    mHighlightTo = max(mHighlightTo, last);
+  }
+
+  Fl_Timestamp started = Fl::now();
+  int more = 1;
+  while (more && Fl::seconds_since(started) < 0.005) {
+    int start = mHighlightFrom, end = start + chunk;
+    if (end < length) {
+      end = buf->line_end(end);
+      if (end < length) end++;
+    } else {
+      end = length;
+    }
+    int same = highlight_range(start, end, &changedStart, &changedEnd);
+    mHighlightFrom = end;
+    if (end >= length || (same && end >= mHighlightTo)) {
+      mHighlightFrom = mHighlightTo = -1;
+      mHighlightAhead = -1;
+      more = 0;
+    }
+  }
+
+  if (changedStart < changedEnd && mWrapCache)
+    wrap_cache_restyled(changedStart, changedEnd);
+  if (changedStart < changedEnd && mWidthCache)
+    width_cache_restyled(changedStart, changedEnd);
+  if (changedStart < changedEnd && changedEnd > mFirstChar &&
+      changedStart <= mLastChar)
+    redisplay_range(max(changedStart, mFirstChar), min(changedEnd, length));
+  return more;
+}
+
+
+
+/**
+ \brief Idle callback of the incremental highlighting engine.
+
+ \param d the text display
+ */
+void Fl_Text_Display::highlight_idle_cb(void *d) {
+  Fl_Text_Display *textD = (Fl_Text_Display *)d;
+  if (!textD->highlight_slice())
+    Fl::remove_idle(highlight_idle_cb, d);
+}
+
+
+
 /**
  \brief Moves the current insert position right one word.
  */
@@ -1772,6 +2651,17 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
   if ( nInserted != 0 || nDeleted != 0 )
     textD->mCursorPreferredXPos = -1;
 
+  /* Keep the style buffer of the highlighting engine in step with the buffer */
+  if (textD->mHighlightEngineCB && textD->mStyleBuffer &&
+      (nInserted != 0 || nDeleted != 0))
+    textD->highlight_modified(pos, nInserted, nDeleted);
+
+  /* Keep the wrap cache and the width cache in step with the buffer */
+  if (textD->mWrapCache && (nInserted != 0 || nDeleted != 0))
+    textD->wrap_cache_modified(pos, nInserted, nDeleted, deletedText);
+  if (textD->mWidthCache && (nInserted != 0 || nDeleted != 0))
+    textD->width_cache_modified(pos, nInserted, nDeleted, deletedText);
+
   /* Count the number of lines inserted and deleted, and in the case
    of continuous wrap mode, how much has changed */
   if (textD->mContinuousWrap) {
@@ -1808,6 +2698,8 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
 
   /* Update the line count for the whole buffer */
   textD->mNBufferLines += linesInserted - linesDeleted;
+  if (textD->mWrapCache && (nInserted != 0 || nDeleted != 0))
+    textD->wrap_cache_sync();
 
   /* Update the cursor position */
   if ( textD->mCursorToHint != NO_HINT ) {
@@ -2070,13 +2962,21 @@ int Fl_Text_Display::handle_vline(
    change vs. a change in highlighting only.
    */
   int i, X, startIndex, startStyle, style, charStyle;
-  char *lineStr;
+  const char *lineStr;
+  char *lineCopy = NULL;
   double startX, styleX;
 
   if ( lineStartPos == -1 ) {
     lineStr = NULL;
   } else {
-    lineStr = mBuffer->text_range( lineStartPos, lineStartPos + lineLen );
+    // read the line in place, unless it is split by the gap of the buffer
+    const char *text2;
+    int len1, len2;
+    int n = mBuffer->spans(lineStartPos, lineStartPos + lineLen, &lineStr, &len1, &text2, &len2);
+    if (n == 0)
+      lineStr = "";
+    else if (n > 1)
+      lineStr = lineCopy = mBuffer->text_range( lineStartPos, lineStartPos + lineLen );
   }
 
   // STR #2788
@@ -2123,6 +3023,7 @@ int Fl_Text_Display::handle_vline(
       currChar = lineStr[i]; // one byte is enough to handele tabs and other cases
       int len = fl_utf8len1(currChar);
       if (len<=0) len = 1; // OUCH!
+      if (i+len>lineLen) len = lineLen-i; // don't read past a truncated character
       charStyle = position_style(lineStartPos, lineLen, i);
       if (charStyle!=style || currChar=='\t' || prevChar=='\t') {
         // draw a segment whenever the style changes or a Tab is found
@@ -2137,7 +3038,7 @@ int Fl_Text_Display::handle_vline(
             draw_string( style|BG_ONLY_MASK, int(startX), Y, int(startX+w), 0, 0 );
           if (mode==FIND_INDEX && startX+w>rightClip) {
             // find x pos inside block
-            free(lineStr);
+            free(lineCopy);
             if (cursor_pos && (startX+w/2<rightClip))  // STR #2788
               return lineStartPos + startIndex + 1;  // STR #2788
             return lineStartPos + startIndex;
@@ -2168,7 +3069,7 @@ int Fl_Text_Display::handle_vline(
               di = find_x(lineStr+startIndex, i-startIndex, style, -int(rightClip-startX)); // STR #2788
               di = lineStartPos + startIndex + di;
             }
-            free(lineStr);
+            free(lineCopy);
             IS_UTF8_ALIGNED2(buffer(), (lineStartPos+startIndex+di))
             return di;
           }
@@ -2194,7 +3095,7 @@ int Fl_Text_Display::handle_vline(
         draw_string( style|BG_ONLY_MASK, int(startX), Y, int(startX+w), 0, 0 );
       if (mode==FIND_INDEX) {
         // find x pos inside block
-        free(lineStr);
+        free(lineCopy);
         if (cursor_pos) // STR #2788
           return lineStartPos + startIndex + ( rightClip-startX>w/2 ? 1 : 0 ); // STR #2788
         return lineStartPos + startIndex + ( rightClip-startX>w ? 1 : 0 );
@@ -2221,13 +3122,13 @@ int Fl_Text_Display::handle_vline(
           di = find_x(lineStr+startIndex, i-startIndex, style, -int(rightClip-startX)); // STR #2788
           di = lineStartPos + startIndex + di;
         }
-        free(lineStr);
+        free(lineCopy);
         IS_UTF8_ALIGNED2(buffer(), (lineStartPos+startIndex+di))
         return di;
       }
     }
     if (mode==GET_WIDTH) {
-      free(lineStr);
+      free(lineCopy);
       return int(startX+w);
     }
 
@@ -2238,7 +3139,7 @@ int Fl_Text_Display::handle_vline(
       draw_string( style|BG_ONLY_MASK, int(startX), Y, text_area.x+text_area.w, lineStr, lineLen );
   }
 
-  free(lineStr);
+  free(lineCopy);
   IS_UTF8_ALIGNED2(buffer(), (lineStartPos+lineLen))
   return lineStartPos + lineLen;
 }
@@ -2259,21 +3160,32 @@ int Fl_Text_Display::find_x(const char *s, int len, int style, int x) const {
   int cursor_pos = x<0; // STR #2788
   x = x<0 ? -x : x;     // STR #2788
 
-  // TODO: use binary search which may be quicker.
-  int i = 0;
-  int last_w = 0;       // STR #2788
-  while (i<len) {
-    const char *next = fl_utf8_next_composed_char(s + i, s + len);
-    int cl = next - (s+i);
-    int w = int( string_width(s, i+cl, style) );
-    if (w>x) {
-      if (cursor_pos && (w-x < x-last_w)) return i+cl; // STR #2788
-      return i;
-    }
-    last_w = w;        // STR #2788
-    i += cl;
+  // Binary search for the first character whose right edge lies beyond x.
+  // The width of the text up to a character boundary grows with the number
+  // of characters, so only O(log n) prefixes need to be measured.
+  if (!mAdvanceCache) mAdvanceCache = new Fl_Text_Advance_Cache;
+  std::vector<int> &ends = mAdvanceCache->ends;
+  ends.clear();
+  for (int i = 0; i < len; ) {
+    i = int(fl_utf8_next_composed_char(s + i, s + len) - s);
+    ends.push_back(i);
+  }
+  int lo = 0, hi = (int)ends.size();
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (int( string_width(s, ends[mid], style) ) > x) hi = mid;
+    else lo = mid + 1;
+  }
+  if (lo == (int)ends.size())
+    return len;
+
+  int start = lo ? ends[lo-1] : 0;
+  if (cursor_pos) {                                     // STR #2788
+    int w = int( string_width(s, ends[lo], style) );
+    int last_w = lo ? int( string_width(s, start, style) ) : 0;
+    if (w-x < x-last_w) return ends[lo];
   }
-  return len;
+  return start;
 }
 
 
@@ -2721,6 +3633,7 @@ double Fl_Text_Display::string_width( const char *string, int length, int style
 
   Fl_Font font;
   Fl_Fontsize fsize;
+  int slot = 0;
 
   if ( mNStyles && (style & STYLE_LOOKUP_MASK) ) {
     int si = (style & STYLE_LOOKUP_MASK) - 'A';
@@ -2729,11 +3642,34 @@ double Fl_Text_Display::string_width( const char *string, int length, int style
 
     font  = mStyleTable[si].font;
     fsize = mStyleTable[si].size;
+    slot  = si + 1;
   } else {
     font  = textfont();
     fsize = textsize();
   }
+
+  // Callers draw with the font that was measured last, so it is selected
+  // even if the width comes from the cache.
   fl_font( font, fsize );
+
+  // Single characters and ASCII runs in monospaced fonts are measured from
+  // the advance cache of the current graphics driver.
+  if (length > 0) {
+    if (!mAdvanceCache) mAdvanceCache = new Fl_Text_Advance_Cache;
+    Fl_Text_Advance_Cache::Font *f = mAdvanceCache->get(slot, font, fsize);
+    unsigned char c = (unsigned char)string[0];
+    if (length == 1 && c < 0x80)
+      return f->width(c, string, 1);
+    if (length == 2 && (c & 0xfe) == 0xc2)      // U+0080 to U+00FF
+      return f->width(((c & 0x1f) << 6) | (string[1] & 0x3f), string, 2);
+    if (f->monospace) {
+      int i = 0;
+      while (i < length && string[i] >= ' ' && string[i] < 0x7f) i++;
+      if (i == length)
+        return length * f->mono;
+    }
+  }
+
   return fl_width( string, length );
 }
 
@@ -3092,8 +4028,9 @@ int Fl_Text_Display::scroll_(int topLineNum, int horizOffset) {
     topLineNum = mNBufferLines + 3 - mNVisibleLines;
   if (topLineNum < 1) topLineNum = 1;
 
-  if (horizOffset > longest_vline() - text_area.w)
-    horizOffset = longest_vline() - text_area.w;
+  int longest = longest_line();
+  if (horizOffset > longest - text_area.w)
+    horizOffset = longest - text_area.w;
   if (horizOffset < 0) horizOffset = 0;
 
   /* Do nothing if scroll position hasn't actually changed or there's no
@@ -3144,7 +4081,7 @@ void Fl_Text_Display::update_v_scrollbar() {
  for the horizontal scrollbar.
  */
 void Fl_Text_Display::update_h_scrollbar() {
-  int sliderMax = max(longest_vline(), text_area.w + mHorizOffset);
+  int sliderMax = max(longest_line(), text_area.w + mHorizOffset);
   mHScrollBar->value( mHorizOffset, text_area.w, 0, sliderMax );
 }
 
@@ -3622,6 +4559,9 @@ void Fl_Text_Display::wrapped_line_counter(Fl_Text_Buffer *buf, int startPos,
   IS_UTF8_ALIGNED2(buf, startPos)
   IS_UTF8_ALIGNED2(buf, maxPos)
 
+  // the text is only read, which keeps a buffer in piece table mode as it is
+  const Fl_Text_Buffer *text = buf;
+
   int lineStart, newLineStart = 0, b, p, colNum, wrapMarginPix;
   int i, foundBreak;
   double width;
@@ -3675,7 +4615,7 @@ void Fl_Text_Display::wrapped_line_counter(Fl_Text_Buffer *buf, int startPos,
       colNum = 0;
       width = 0;
     } else {
-      const char *s = buf->address(p);
+      const char *s = text->address(p);
       colNum++;
       // FIXME: it is not a good idea to simply add character widths because on
       // some platforms, the width is a floating point value and depends on the
@@ -3694,7 +4634,7 @@ void Fl_Text_Display::wrapped_line_counter(Fl_Text_Buffer *buf, int startPos,
           width = 0;
           int iMax = buf->next_char(p);
           for (i=buf->next_char(b); i<iMax; i = buf->next_char(i)) {
-            width += measure_proportional_character(buf->address(i), (int)width,
+            width += measure_proportional_character(text->address(i), (int)width,
                                                     i+styleBufOffset);
             colNum++;
           }
@@ -3709,7 +4649,7 @@ void Fl_Text_Display::wrapped_line_counter(Fl_Text_Buffer *buf, int startPos,
         if (b >= buf->length()) { // STR #2730
           width = 0;
         } else {
-          const char *s = buf->address(b);
+          const char *s = text->address(b);
           width = measure_proportional_character(s, 0, p+styleBufOffset);
         }
       }
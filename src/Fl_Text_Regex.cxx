@@ -0,0 +1,933 @@
+//
+// Regular expression search for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 2026 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     https://www.fltk.org/COPYING.php
+//
+// Please see the following page on how to report bugs and issues:
+//
+//     https://www.fltk.org/bugs.php
+//
+
+#include <FL/Fl_Text_Regex.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/fl_utf8.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+ Instructions of a compiled expression, see Russ Cox, "Regular Expression
+ Matching: the Virtual Machine Approach". Character instructions consume
+ one UTF-8 character, all others are followed without consuming any text.
+ */
+enum {
+  RX_CHAR,        // the character c (lower case if the case is ignored)
+  RX_ANY,         // any character except newline
+  RX_CLASS,       // a character in ranges[x] to ranges[y], or not if c is set
+  RX_BOL,         // start of a line
+  RX_EOL,         // end of a line
+  RX_WORDB,       // word boundary
+  RX_NWORDB,      // not a word boundary
+  RX_SPLIT,       // continue at x and at y
+  RX_JMP,         // continue at x
+  RX_MATCH        // a match ends here
+};
+
+struct Fl_Text_Regex_Inst {
+  int op;
+  unsigned c;
+  int x, y;
+};
+
+/*
+ A compiled expression and what is known about the start of its matches.
+ */
+class Fl_Text_Regex_Program {
+public:
+  std::vector<Fl_Text_Regex_Inst> code;
+  std::vector<unsigned> ranges;   // pairs of first and last character
+  bool ignoreCase;
+  bool nullable;                  // an empty match is possible
+  bool first[256];                // the bytes that a match can start with
+  std::string prefix;             // literal text that every match starts with
+
+  bool in_class(const Fl_Text_Regex_Inst &in, unsigned c) const {
+    bool found = false;
+    for (int i = in.x; i < in.y && !found; i += 2)
+      found = (c >= ranges[i] && c <= ranges[i+1]);
+    if (!found && ignoreCase) {
+      unsigned l = (unsigned)fl_tolower(c), u = (unsigned)fl_toupper(c);
+      for (int i = in.x; i < in.y && !found; i += 2)
+        found = (l >= ranges[i] && l <= ranges[i+1]) || (u >= ranges[i] && u <= ranges[i+1]);
+    }
+    return found != (in.c != 0);
+  }
+
+  bool step(const Fl_Text_Regex_Inst &in, unsigned c) const {
+    switch (in.op) {
+      case RX_CHAR:  return (ignoreCase ? (unsigned)fl_tolower(c) : c) == in.c;
+      case RX_ANY:   return c != '\n';
+      case RX_CLASS: return in_class(in, c);
+    }
+    return false;
+  }
+
+  void analyze();
+};
+
+/*
+ Parse tree of an expression.
+ */
+enum { RN_EMPTY, RN_CHAR, RN_ANY, RN_CLASS, RN_ASSERT, RN_CAT, RN_ALT, RN_REPEAT };
+
+struct Fl_Text_Regex_Node {
+  int type;
+  unsigned c;     // character, assertion, or negated class
+  int a, b;       // children, or range of a class
+  int min, max;   // repeat count, max is -1 if unlimited
+  int height;     // depth of the recursion of compile() for this node
+};
+
+static const int RX_MAX_REPEAT = 1000;
+static const int RX_MAX_CODE = 100000;
+static const int RX_MAX_DEPTH = 1000;
+
+/*
+ Recursive descent parser that builds the parse tree, and compiler that
+ generates the instructions from it.
+ */
+class Fl_Text_Regex_Parser {
+public:
+  const char *p;
+  const char *error;
+  int depth;
+  std::vector<Fl_Text_Regex_Node> nodes;
+  Fl_Text_Regex_Program *prog;
+
+  Fl_Text_Regex_Parser(const char *pattern, Fl_Text_Regex_Program *program)
+  : p(pattern), error(0), depth(0), prog(program) { }
+
+  int node(int type, unsigned c = 0, int a = -1, int b = -1) {
+    Fl_Text_Regex_Node n;
+    n.type = type; n.c = c; n.a = a; n.b = b; n.min = n.max = 0;
+    // the left operands of sequences and alternatives are compiled in a loop
+    n.height = 1;
+    if (type == RN_CAT || type == RN_ALT)
+      n.height = std::max(nodes[a].height, nodes[b].height + 1);
+    else if (type == RN_REPEAT)
+      n.height = nodes[a].height + 1;
+    nodes.push_back(n);
+    return (int)nodes.size() - 1;
+  }
+
+  int fail(const char *msg) {
+    if (!error) error = msg;
+    return -1;
+  }
+
+  unsigned next_char() {
+    int len;
+    unsigned c = fl_utf8decode(p, p + strlen(p), &len);
+    p += len;
+    return c;
+  }
+
+  void add_range(unsigned lo, unsigned hi) {
+    prog->ranges.push_back(lo);
+    prog->ranges.push_back(hi);
+  }
+
+  // add the ranges of \d, \w or \s, or of their complement for \D, \W, \S
+  bool add_escape_class(char e) {
+    static const unsigned digit[] = { '0', '9' };
+    static const unsigned word[] = { '0', '9', 'A', 'Z', '_', '_', 'a', 'z' };
+    static const unsigned space[] = { '\t', '\r', ' ', ' ' };
+    const unsigned *r;
+    int n;
+    switch (e) {
+      case 'd': case 'D': r = digit; n = 2; break;
+      case 'w': case 'W': r = word; n = 8; break;
+      case 's': case 'S': r = space; n = 4; break;
+      default: return false;
+    }
+    if (e >= 'a') {
+      for (int i = 0; i < n; i += 2) add_range(r[i], r[i+1]);
+    } else {
+      unsigned lo = 0;
+      for (int i = 0; i < n; i += 2) {
+        if (r[i] > lo) add_range(lo, r[i] - 1);
+        lo = r[i+1] + 1;
+      }
+      add_range(lo, 0x7fffffff);
+    }
+    return true;
+  }
+
+  // character after a backslash, or 0 if the escape is not a character
+  unsigned escape_char(unsigned e) {
+    switch (e) {
+      case 'n': return '\n';
+      case 't': return '\t';
+      case 'r': return '\r';
+      case 'f': return '\f';
+      case 'v': return '\v';
+      case 'e': return 27;
+    }
+    if ((e < 0x80 && !isalnum(e)) || e >= 0x80) return e;
+    return 0;
+  }
+
+  int parse_class() {
+    int neg = (*p == '^');
+    if (neg) p++;
+    int start = (int)prog->ranges.size();
+    bool firstItem = true;
+    for (;;) {
+      if (!*p) return fail("missing ]");
+      if (*p == ']' && !firstItem) { p++; break; }
+      firstItem = false;
+      unsigned lo;
+      if (*p == '\\') {
+        p++;
+        if (!*p) return fail("trailing \\");
+        if (add_escape_class(*p)) { p++; continue; }
+        lo = escape_char(next_char());
+        if (!lo) return fail("unknown escape in []");
+      } else {
+        lo = next_char();
+      }
+      unsigned hi = lo;
+      if (p[0] == '-' && p[1] && p[1] != ']') {
+        p++;
+        if (*p == '\\') {
+          p++;
+          if (!*p) return fail("trailing \\");
+          hi = escape_char(next_char());
+          if (!hi) return fail("unknown escape in []");
+        } else {
+          hi = next_char();
+        }
+        if (hi < lo) return fail("invalid range in []");
+      }
+      add_range(lo, hi);
+    }
+    return node(RN_CLASS, neg, start, (int)prog->ranges.size());
+  }
+
+  int parse_atom() {
+    unsigned c;
+    switch (*p) {
+      case '(': {
+        p++;
+        if (++depth > RX_MAX_DEPTH) return fail("expression too complex");
+        int n = parse_alt();
+        depth--;
+        if (n < 0) return n;
+        if (*p != ')') return fail("missing )");
+        p++;
+        return n;
+      }
+      case '[':
+        p++;
+        return parse_class();
+      case '.':
+        p++;
+        return node(RN_ANY);
+      case '^':
+        p++;
+        return node(RN_ASSERT, RX_BOL);
+      case '$':
+        p++;
+        return node(RN_ASSERT, RX_EOL);
+      case '*': case '+': case '?': case '{':
+        return fail("nothing to repeat");
+      case '\\':
+        p++;
+        if (!*p) return fail("trailing \\");
+        if (*p == 'b' || *p == 'B')
+          return node(RN_ASSERT, *p++ == 'b' ? RX_WORDB : RX_NWORDB);
+        if (strchr("dDwWsS", *p)) {
+          int start = (int)prog->ranges.size();
+          char e = *p++;
+          add_escape_class((char)(e | 0x20));
+          return node(RN_CLASS, e < 'a', start, (int)prog->ranges.size());
+        }
+        c = escape_char(next_char());
+        if (!c) return fail("unknown escape");
+        return node(RN_CHAR, c);
+    }
+    return node(RN_CHAR, next_char());
+  }
+
+  int parse_number() {
+    int n = 0;
+    if (*p < '0' || *p > '9') return -1;
+    while (*p >= '0' && *p <= '9') {
+      n = n * 10 + (*p++ - '0');
+      if (n > RX_MAX_REPEAT) return RX_MAX_REPEAT + 1;
+    }
+    return n;
+  }
+
+  int parse_repeat() {
+    int n = parse_atom();
+    while (n >= 0) {
+      int min, max;
+      if (*p == '*') { min = 0; max = -1; p++; }
+      else if (*p == '+') { min = 1; max = -1; p++; }
+      else if (*p == '?') { min = 0; max = 1; p++; }
+      else if (*p == '{') {
+        p++;
+        min = max = parse_number();
+        if (min < 0) return fail("invalid {}");
+        if (*p == ',') {
+          p++;
+          max = (*p == '}') ? -1 : parse_number();
+          if (max == -1 && *p != '}') return fail("invalid {}");
+        }
+        if (*p != '}') return fail("missing }");
+        p++;
+        if (min > RX_MAX_REPEAT || max > RX_MAX_REPEAT) return fail("repeat count too large");
+        if (max >= 0 && max < min) return fail("invalid {}");
+      } else
+        break;
+      if (nodes[n].type == RN_ASSERT) return fail("nothing to repeat");
+      int r = node(RN_REPEAT, 0, n);
+      // stacked repeats like "a???" nest without parentheses
+      if (nodes[r].height > RX_MAX_DEPTH) return fail("expression too complex");
+      nodes[r].min = min;
+      nodes[r].max = max;
+      n = r;
+    }
+    return n;
+  }
+
+  int parse_cat() {
+    int n = -1;
+    while (*p && *p != '|' && *p != ')') {
+      int m = parse_repeat();
+      if (m < 0) return m;
+      n = (n < 0) ? m : node(RN_CAT, 0, n, m);
+    }
+    return n < 0 ? node(RN_EMPTY) : n;
+  }
+
+  int parse_alt() {
+    int n = parse_cat();
+    while (n >= 0 && *p == '|') {
+      p++;
+      int m = parse_cat();
+      if (m < 0) return m;
+      n = node(RN_ALT, 0, n, m);
+    }
+    return n;
+  }
+
+  int emit(int op, unsigned c = 0, int x = 0, int y = 0) {
+    Fl_Text_Regex_Inst in;
+    in.op = op; in.c = c; in.x = x; in.y = y;
+    prog->code.push_back(in);
+    return (int)prog->code.size() - 1;
+  }
+
+  bool compile(int n) {
+    if ((int)prog->code.size() > RX_MAX_CODE) {
+      fail("expression too large");
+      return false;
+    }
+    const Fl_Text_Regex_Node nd = nodes[n];
+    std::vector<Fl_Text_Regex_Inst> &code = prog->code;
+    switch (nd.type) {
+      case RN_EMPTY:
+        break;
+      case RN_CHAR:
+        emit(RX_CHAR, prog->ignoreCase ? (unsigned)fl_tolower(nd.c) : nd.c);
+        break;
+      case RN_ANY:
+        emit(RX_ANY);
+        break;
+      case RN_CLASS:
+        emit(RX_CLASS, nd.c, nd.a, nd.b);
+        break;
+      case RN_ASSERT:
+        emit((int)nd.c);
+        break;
+      case RN_CAT: {
+        // long sequences are left-deep trees, compile them without recursion
+        std::vector<int> parts;
+        int k = n;
+        for (; nodes[k].type == RN_CAT; k = nodes[k].a)
+          parts.push_back(nodes[k].b);
+        parts.push_back(k);
+        for (size_t i = parts.size(); i > 0; i--)
+          if (!compile(parts[i-1])) return false;
+        break;
+      }
+      case RN_ALT: {
+        std::vector<int> parts, jumps;
+        int k = n;
+        for (; nodes[k].type == RN_ALT; k = nodes[k].a)
+          parts.push_back(nodes[k].b);
+        parts.push_back(k);
+        for (size_t i = parts.size(); i > 1; i--) {
+          int s = emit(RX_SPLIT);
+          code[s].x = s + 1;
+          if (!compile(parts[i-1])) return false;
+          jumps.push_back(emit(RX_JMP));
+          code[s].y = (int)code.size();
+        }
+        if (!compile(parts[0])) return false;
+        for (size_t i = 0; i < jumps.size(); i++)
+          code[jumps[i]].x = (int)code.size();
+        break;
+      }
+      case RN_REPEAT: {
+        for (int i = 0; i < nd.min; i++)
+          if (!compile(nd.a)) return false;
+        if (nd.max < 0) {
+          int s = emit(RX_SPLIT);
+          code[s].x = s + 1;
+          if (!compile(nd.a)) return false;
+          emit(RX_JMP, 0, s);
+          code[s].y = (int)code.size();
+        } else {
+          std::vector<int> splits;
+          for (int i = nd.min; i < nd.max; i++) {
+            int s = emit(RX_SPLIT);
+            code[s].x = s + 1;
+            splits.push_back(s);
+            if (!compile(nd.a)) return false;
+          }
+          for (size_t i = 0; i < splits.size(); i++)
+            code[splits[i]].y = (int)code.size();
+        }
+        break;
+      }
+    }
+    return true;
+  }
+};
+
+
+/*
+ Find the bytes that a match can start with, whether a match can be empty,
+ and the literal text at the start of every match.
+ */
+void Fl_Text_Regex_Program::analyze()
+{
+  memset(first, 0, sizeof(first));
+  nullable = false;
+  std::vector<char> seen(code.size(), 0);
+  std::vector<int> todo(1, 0);
+  while (!todo.empty()) {
+    int pc = todo.back();
+    todo.pop_back();
+    if (seen[pc]) continue;
+    seen[pc] = 1;
+    const Fl_Text_Regex_Inst &in = code[pc];
+    switch (in.op) {
+      case RX_JMP:
+        todo.push_back(in.x);
+        break;
+      case RX_SPLIT:
+        todo.push_back(in.x);
+        todo.push_back(in.y);
+        break;
+      case RX_BOL: case RX_EOL: case RX_WORDB: case RX_NWORDB:
+        todo.push_back(pc + 1);
+        break;
+      case RX_MATCH:
+        nullable = true;
+        break;
+      case RX_CHAR: {
+        char buf[8];
+        unsigned v[3] = { in.c, (unsigned)fl_toupper(in.c), (unsigned)fl_tolower(in.c) };
+        for (int i = 0; i < (ignoreCase ? 3 : 1); i++) {
+          fl_utf8encode(v[i], buf);
+          first[(unsigned char)buf[0]] = true;
+        }
+        break;
+      }
+      case RX_ANY: case RX_CLASS: {
+        for (int b = 0; b < 256; b++) {
+          if (b >= 0x80) first[b] = true;
+          else if (!first[b]) first[b] = step(in, (unsigned)b);
+        }
+        break;
+      }
+    }
+  }
+  // in a case independent search the prefix is found with a search that
+  // compares ASCII letters only
+  prefix.clear();
+  for (size_t pc = 0; pc < code.size() && code[pc].op == RX_CHAR; pc++) {
+    if (ignoreCase && code[pc].c >= 0x80) break;
+    char buf[8];
+    int n = fl_utf8encode(code[pc].c, buf);
+    prefix.append(buf, n);
+  }
+}
+
+
+/*
+ The text of a buffer, read in place on both sides of the gap. A buffer in
+ piece table mode is copied, because its text can be in any number of parts.
+ */
+struct Fl_Text_Regex_Text {
+  const char *p1, *p2;
+  int n1, len;
+  char *copy;
+
+  Fl_Text_Regex_Text(const Fl_Text_Buffer *buf) : copy(NULL) {
+    const char *t2;
+    int n2;
+    len = buf->length();
+    if (buf->spans(0, len, &p1, &n1, &t2, &n2) > 2) {
+      p1 = copy = buf->text();
+      n1 = len;
+      t2 = NULL;
+    }
+    p2 = t2 ? t2 - n1 : p1;   // p2[pos] is the byte at pos after the gap
+  }
+
+  Fl_Text_Regex_Text(const char *text, int n)
+  : p1(text), p2(text), n1(n), len(n), copy(NULL) { }
+
+  ~Fl_Text_Regex_Text() { free(copy); }
+
+  unsigned char byte(int pos) const {
+    return (unsigned char)(pos < n1 ? p1[pos] : p2[pos]);
+  }
+
+  unsigned decode(int pos, int *n) const {
+    unsigned char c = byte(pos);
+    if (c < 0x80) { *n = 1; return c; }
+    char buf[4];
+    int m = 0;
+    while (m < 4 && pos + m < len) { buf[m] = (char)byte(pos + m); m++; }
+    return fl_utf8decode(buf, buf + m, n);
+  }
+
+  bool word(int pos) const {
+    if (pos < 0 || pos >= len) return false;
+    unsigned char c = byte(pos);
+    return c >= 0x80 || c == '_' || isalnum(c);
+  }
+
+  // first position in [from, to) that holds the byte c1 or c2, or -1
+  int find(int from, int to, unsigned char c1, unsigned char c2) const {
+    if (to > len) to = len;
+    for (int pos = from; pos < to; ) {
+      const char *p = pos < n1 ? p1 : p2;
+      int end = (pos < n1 && to > n1) ? n1 : to;
+      if (c1 == c2) {
+        const void *q = memchr(p + pos, c1, end - pos);
+        if (q) return int((const char *)q - p);
+        pos = end;
+      } else {
+        for (; pos < end; pos++)
+          if ((unsigned char)p[pos] == c1 || (unsigned char)p[pos] == c2) return pos;
+      }
+    }
+    return -1;
+  }
+
+  // last position in [from, to) that holds the byte c1 or c2, or -1
+  int rfind(int from, int to, unsigned char c1, unsigned char c2) const {
+    if (to > len) to = len;
+    for (int pos = to - 1; pos >= from; pos--) {
+      unsigned char c = byte(pos);
+      if (c == c1 || c == c2) return pos;
+    }
+    return -1;
+  }
+};
+
+
+/*
+ Simulation of the program on all threads at once. Threads are kept in the
+ order of their start positions, and a thread that reaches an instruction
+ already reached by another thread is dropped, so that the leftmost match
+ wins, and among those the longest one.
+ */
+class Fl_Text_Regex_VM {
+  struct Thread { int pc, start; };
+  const Fl_Text_Regex_Program &prog;
+  const Fl_Text_Regex_Text &text;
+  std::vector<Thread> clist, nlist;
+  std::vector<int> mark, stack;
+  int gen;
+  unsigned char c1, c2;            // first byte of the prefix, in both cases
+
+  bool check(int op, int pos) const {
+    switch (op) {
+      case RX_BOL:    return pos == 0 || text.byte(pos - 1) == '\n';
+      case RX_EOL:    return pos == text.len || text.byte(pos) == '\n';
+      case RX_WORDB:  return text.word(pos - 1) != text.word(pos);
+      case RX_NWORDB: return text.word(pos - 1) == text.word(pos);
+    }
+    return true;
+  }
+
+  void add(std::vector<Thread> &list, int pc0, int start, int pos) {
+    stack.push_back(pc0);
+    while (!stack.empty()) {
+      int pc = stack.back();
+      stack.pop_back();
+      if (mark[pc] == gen) continue;
+      mark[pc] = gen;
+      const Fl_Text_Regex_Inst &in = prog.code[pc];
+      switch (in.op) {
+        case RX_JMP:
+          stack.push_back(in.x);
+          break;
+        case RX_SPLIT:
+          stack.push_back(in.y);
+          stack.push_back(in.x);
+          break;
+        case RX_BOL: case RX_EOL: case RX_WORDB: case RX_NWORDB:
+          if (check(in.op, pos)) stack.push_back(pc + 1);
+          break;
+        default: {
+          Thread t = { pc, start };
+          list.push_back(t);
+        }
+      }
+    }
+  }
+
+  // true if the literal prefix of every match is found at pos
+  bool prefix_at(int pos) const {
+    int n = (int)prog.prefix.size();
+    if (pos + n > text.len) return false;
+    for (int i = 0; i < n; i++) {
+      unsigned char c = text.byte(pos + i), p = (unsigned char)prog.prefix[i];
+      if (c != p && !(prog.ignoreCase && tolower(c) == tolower(p))) return false;
+    }
+    return true;
+  }
+
+  // next position in [pos, limit] where a match may start, or -1
+  int candidate(int pos, int limit) const {
+    int end = limit < text.len ? limit + 1 : text.len;
+    if (!prog.prefix.empty()) {
+      for (;; pos++) {
+        pos = text.find(pos, end, c1, c2);
+        if (pos < 0 || prefix_at(pos)) return pos;
+      }
+    } else if (!prog.nullable) {
+      while (pos < end && !prog.first[text.byte(pos)]) pos++;
+      if (pos >= end) return -1;
+    }
+    return pos <= limit ? pos : -1;
+  }
+
+public:
+  Fl_Text_Regex_VM(const Fl_Text_Regex_Program &p, const Fl_Text_Regex_Text &t)
+  : prog(p), text(t), mark(p.code.size(), 0), gen(0) {
+    c1 = c2 = prog.prefix.empty() ? 0 : (unsigned char)prog.prefix[0];
+    if (prog.ignoreCase) { c1 = (unsigned char)tolower(c1); c2 = (unsigned char)toupper(c2); }
+  }
+
+  // previous position in [limit, pos] where the literal prefix is found, or -1
+  int prev_prefix(int pos, int limit) const {
+    for (;; pos--) {
+      pos = text.rfind(limit, pos + 1, c1, c2);
+      if (pos < 0 || prefix_at(pos)) return pos;
+    }
+  }
+
+  /*
+   Find the leftmost longest match that starts between from and limit,
+   inclusive, or only at from if anchored is set.
+   */
+  bool run(int from, int limit, bool anchored, int *foundPos, int *foundEnd) {
+    int bestStart = -1, bestEnd = -1;
+    clist.clear();
+    gen++;
+    for (int pos = from; ; ) {
+      if (bestStart < 0 && (anchored ? pos == from : pos <= limit)) {
+        if (clist.empty() && !anchored) {
+          pos = candidate(pos, limit);
+          if (pos < 0) break;
+          gen++;
+        }
+        add(clist, 0, pos, pos);
+      }
+      if (clist.empty()) {
+        // an assertion failed at a candidate position, try the next one
+        if (anchored || bestStart >= 0 || pos >= limit || pos >= text.len) break;
+        int n;
+        text.decode(pos, &n);
+        pos += n;
+        continue;
+      }
+      int n = 0;
+      unsigned c = pos < text.len ? text.decode(pos, &n) : 0;
+      gen++;
+      nlist.clear();
+      for (size_t i = 0; i < clist.size(); i++) {
+        const Thread &t = clist[i];
+        if (bestStart >= 0 && t.start > bestStart) break;
+        const Fl_Text_Regex_Inst &in = prog.code[t.pc];
+        if (in.op == RX_MATCH) {
+          if (bestStart < 0 || t.start < bestStart || pos > bestEnd) {
+            bestStart = t.start;
+            bestEnd = pos;
+          }
+        } else if (pos < text.len && prog.step(in, c)) {
+          add(nlist, t.pc + 1, t.start, pos + n);
+        }
+      }
+      clist.swap(nlist);
+      if (pos >= text.len) break;
+      pos += n;
+    }
+    if (bestStart < 0) return false;
+    *foundPos = bestStart;
+    *foundEnd = bestEnd;
+    return true;
+  }
+};
+
+
+/**
+ Creates an empty regular expression, call compile() before using it.
+ */
+Fl_Text_Regex::Fl_Text_Regex()
+: program_(0),
+  error_(0)
+{
+}
+
+/**
+ Creates a regular expression and compiles \p pattern.
+ Check compiled() or error() to find out if the pattern was valid.
+ \param pattern the expression, UTF-8 encoded
+ \param flags 0, or Fl_Text_Regex::IGNORE_CASE
+ */
+Fl_Text_Regex::Fl_Text_Regex(const char *pattern, int flags)
+: program_(0),
+  error_(0)
+{
+  compile(pattern, flags);
+}
+
+/**
+ Releases the compiled expression.
+ */
+Fl_Text_Regex::~Fl_Text_Regex()
+{
+  delete program_;
+}
+
+/**
+ \brief Compiles a regular expression.
+
+ Any previously compiled expression is released.
+
+ \param pattern the expression, UTF-8 encoded
+ \param flags 0, or Fl_Text_Regex::IGNORE_CASE
+ \return 0 on success, -1 if the pattern is invalid, see error()
+ */
+int Fl_Text_Regex::compile(const char *pattern, int flags)
+{
+  delete program_;
+  program_ = 0;
+  error_ = 0;
+  if (!pattern) pattern = "";
+
+  Fl_Text_Regex_Program *prog = new Fl_Text_Regex_Program();
+  prog->ignoreCase = (flags & IGNORE_CASE) != 0;
+  Fl_Text_Regex_Parser parser(pattern, prog);
+  int root = parser.parse_alt();
+  if (root >= 0 && *parser.p == ')')
+    root = parser.fail("unmatched )");
+  if (root >= 0 && parser.compile(root))
+    parser.emit(RX_MATCH);
+  if (parser.error) {
+    error_ = parser.error;
+    delete prog;
+    return -1;
+  }
+  prog->analyze();
+  program_ = prog;
+  return 0;
+}
+
+/**
+ \brief Checks if the expression matches the text starting at \p pos.
+
+ \param buf the buffer to search
+ \param pos byte offset of the start of the match
+ \param[out] foundEnd end of the longest match
+ \return 1 if the text matches, 0 if not
+ */
+int Fl_Text_Regex::match(const Fl_Text_Buffer *buf, int pos, int *foundEnd) const
+{
+  if (!program_ || !buf || pos < 0 || pos > buf->length()) return 0;
+  Fl_Text_Regex_Text text(buf);
+  Fl_Text_Regex_VM vm(*program_, text);
+  int found;
+  return vm.run(pos, pos, true, &found, foundEnd) ? 1 : 0;
+}
+
+/**
+ \brief Searches forward for the first match starting at or after \p startPos.
+
+ \param buf the buffer to search
+ \param startPos byte offset where the search starts
+ \param[out] foundPos start of the match
+ \param[out] foundEnd end of the match
+ \param limit only find matches that start before \p limit, or at the end of
+    the buffer if \p limit is the length of the buffer or -1
+ \return 1 if found, 0 if not
+ */
+int Fl_Text_Regex::search_forward(const Fl_Text_Buffer *buf, int startPos,
+                                  int *foundPos, int *foundEnd, int limit) const
+{
+  if (!program_ || !buf) return 0;
+  Fl_Text_Regex_Text text(buf);
+  return search_forward_(text, startPos, foundPos, foundEnd, limit);
+}
+
+/**
+ \brief Searches forward in a string for the first match starting at or after \p startPos.
+
+ This is the same as searching a buffer that contains \p text, for searching
+ text that is not in an Fl_Text_Buffer. \p text does not need to be NUL terminated.
+
+ \param text the UTF-8 text to search
+ \param len length of \p text in bytes
+ \param startPos byte offset where the search starts
+ \param[out] foundPos start of the match
+ \param[out] foundEnd end of the match
+ \param limit only find matches that start before \p limit, or at the end of
+    the text if \p limit is \p len or -1
+ \return 1 if found, 0 if not
+ */
+int Fl_Text_Regex::search_forward(const char *text, int len, int startPos,
+                                  int *foundPos, int *foundEnd, int limit) const
+{
+  if (!program_ || !text || len < 0) return 0;
+  Fl_Text_Regex_Text t(text, len);
+  return search_forward_(t, startPos, foundPos, foundEnd, limit);
+}
+
+int Fl_Text_Regex::search_forward_(const Fl_Text_Regex_Text &text, int startPos,
+                                   int *foundPos, int *foundEnd, int limit) const
+{
+  int len = text.len;
+  if (startPos < 0) startPos = 0;
+  if (limit < 0 || limit >= len) limit = len;
+  else limit--;
+  if (startPos > limit) return 0;
+  Fl_Text_Regex_VM vm(*program_, text);
+  return vm.run(startPos, limit, false, foundPos, foundEnd) ? 1 : 0;
+}
+
+/**
+ \brief Searches backward for the last match starting at or before \p startPos.
+
+ Of all matches starting at the same position, the longest one is returned.
+
+ \param buf the buffer to search
+ \param startPos byte offset where the search starts
+ \param[out] foundPos start of the match
+ \param[out] foundEnd end of the match
+ \param limit only find matches that start at or after \p limit
+ \return 1 if found, 0 if not
+ */
+int Fl_Text_Regex::search_backward(const Fl_Text_Buffer *buf, int startPos,
+                                   int *foundPos, int *foundEnd, int limit) const
+{
+  if (!program_ || !buf) return 0;
+  Fl_Text_Regex_Text text(buf);
+  return search_backward_(text, startPos, foundPos, foundEnd, limit);
+}
+
+/**
+ \brief Searches backward in a string for the last match starting at or before \p startPos.
+
+ This is the same as searching a buffer that contains \p text, for searching
+ text that is not in an Fl_Text_Buffer. \p text does not need to be NUL terminated.
+
+ \param text the UTF-8 text to search
+ \param len length of \p text in bytes
+ \param startPos byte offset where the search starts
+ \param[out] foundPos start of the match
+ \param[out] foundEnd end of the match
+ \param limit only find matches that start at or after \p limit
+ \return 1 if found, 0 if not
+ */
+int Fl_Text_Regex::search_backward(const char *text, int len, int startPos,
+                                   int *foundPos, int *foundEnd, int limit) const
+{
+  if (!program_ || !text || len < 0) return 0;
+  Fl_Text_Regex_Text t(text, len);
+  return search_backward_(t, startPos, foundPos, foundEnd, limit);
+}
+
+int Fl_Text_Regex::search_backward_(const Fl_Text_Regex_Text &text, int startPos,
+                                    int *foundPos, int *foundEnd, int limit) const
+{
+  int len = text.len;
+  if (startPos > len) startPos = len;
+  if (limit < 0) limit = 0;
+  Fl_Text_Regex_VM vm(*program_, text);
+  const Fl_Text_Regex_Program &prog = *program_;
+  for (int pos = startPos; pos >= limit; pos--) {
+    if (!prog.prefix.empty()) {
+      pos = vm.prev_prefix(pos, limit);
+      if (pos < 0) return 0;
+    } else if (pos < len) {
+      unsigned char c = text.byte(pos);
+      if ((c & 0xc0) == 0x80 || (!prog.nullable && !prog.first[c]))
+        continue;
+    } else if (!prog.nullable) {
+      continue;
+    }
+    if (vm.run(pos, pos, true, foundPos, foundEnd))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ \brief Finds all matches in a range of the buffer.
+
+ The matches don't overlap: the search continues at the end of each match,
+ or after the next character if the match is empty.
+
+ \param buf the buffer to search
+ \param[out] foundPositions cleared, then filled with the start of every match
+ \param[out] foundEnds cleared, then filled with the end of every match
+ \param startPos byte offset where the search starts
+ \param limit only find matches that start before \p limit, see search_forward()
+ \return the number of matches
+ */
+int Fl_Text_Regex::find_all(const Fl_Text_Buffer *buf, std::vector<int> &foundPositions,
+                            std::vector<int> &foundEnds, int startPos, int limit) const
+{
+  foundPositions.clear();
+  foundEnds.clear();
+  if (!program_ || !buf) return 0;
+  int pos = startPos, start, end;
+  while (search_forward(buf, pos, &start, &end, limit)) {
+    foundPositions.push_back(start);
+    foundEnds.push_back(end);
+    if (end > start) pos = end;
+    else if (start < buf->length()) pos = buf->next_char(start);
+    else break;
+  }
+  return (int)foundPositions.size();
+}
@@ -83,6 +83,9 @@ Fl_Tree::Fl_Tree(int X, int Y, int W, int H, const char *L) : Fl_Group(X,Y,W,H,L
   _lastselect           = nullptr;
   _lastpushed           = 0;
   _auto_resize_children = 0;                    // don't resize children automatically
+  _walk                 = 0;                    // no walk yet: items keep their xywh
+  _recalc               = 0;
+  _walk_xyw[0] = _walk_xyw[1] = _walk_xyw[2] = 0;
 
   box(FL_DOWN_BOX);
   color(FL_BACKGROUND2_COLOR, FL_SELECTION_COLOR);
@@ -648,12 +651,15 @@ void Fl_Tree::calc_dimensions() {
 /// The tree hierarchy's size only changes when items are added/removed,
 /// open/closed, label contents or font sizes changed, margins changed, etc.
 ///
-/// This calculation involves walking the *entire* tree from top to bottom,
-/// potentially a slow calculation if the tree has many items (potentially
-/// hundreds of thousands), and should therefore be called sparingly.
+/// Each item caches the size of itself and its open children, so this
+/// calculation only walks the items whose size changed since the last
+/// calculation, and their parents. recalc_tree() forgets the cached sizes
+/// of all items, so the next calculation walks the entire tree from top
+/// to bottom, potentially a slow calculation if the tree has many items
+/// (potentially hundreds of thousands).
 ///
-/// For this reason, recalc_tree() is used as a way to /schedule/
-/// calculation when changes affect the tree hierarchy's size.
+/// recalc_tree() is used as a way to /schedule/ calculation when changes
+/// affect the tree hierarchy's size.
 ///
 /// Apps may want to call this method directly if the app makes changes
 /// to the tree's geometry, then immediately needs to work with the tree's
@@ -704,6 +710,8 @@ void Fl_Tree::draw() {
   // Has tree recalc been scheduled? If so, do it
   if ( _tree_w == -1 ) calc_tree();
   else calc_dimensions();
+  // Add the children of items scrolled into view before walking the tree to draw it
+  populate_visible();
   // Let group draw box+label but *NOT* children.
   // We handle drawing children ourselves by calling each item's draw()
   {
@@ -723,7 +731,8 @@ void Fl_Tree::draw() {
       X -= _prefs.openicon_w();
       W += _prefs.openicon_w();
     }
-    // Draw entire tree, starting with root
+    // Draw tree, starting with root
+    //    Subtrees outside the screen are skipped using their cached sizes
     fl_push_clip(_tix,_tiy,_tiw,_tih);
     {
       int xmax = 0;
@@ -2348,6 +2357,148 @@ void Fl_Tree::item_draw_mode(int mode) {
   _prefs.item_draw_mode(Fl_Tree_Item_Draw_Mode(mode));
 }
 
+/// Set the callback that adds the children of items marked with
+/// Fl_Tree_Item::children_pending(1).
+///
+/// This lets a tree show a large hierarchy, e.g. a file system or the
+/// objects of a database, while only creating the items the user looks at.
+/// The callback is invoked with the item and \p 'data' when the item is
+/// opened, or when an open item marked this way is scrolled into view.
+/// It should add the item's children, e.g. with Fl_Tree::add(item, name),
+/// and can mark the new children pending in turn. If the callback adds no
+/// children, the item's open/close icon disappears.
+///
+/// Items scrolled into view are populated by draw() before it walks the
+/// tree, so the callback may add, remove, open and close items.
+/// \code
+/// void populate_cb(Fl_Tree_Item *item, void *data) {
+///   MyObject *obj = (MyObject*)item->user_data();
+///   for ( int t=0; t<obj->count(); t++ ) {
+///     Fl_Tree_Item *child = item->tree()->add(item, obj->child(t)->name());
+///     child->user_data(obj->child(t));
+///     child->children_pending(obj->child(t)->count() > 0);
+///   }
+/// }
+/// [..]
+/// tree->item_populate_callback(populate_cb);
+/// Fl_Tree_Item *item = tree->add("Objects");
+/// item->user_data(root_object);
+/// item->close();
+/// item->children_pending(1);          // show the open icon, add children when opened
+/// \endcode
+/// \param[in] cb   The callback, or NULL to disable it
+/// \param[in] data User data passed to the callback
+/// \see release_closed_children()
+///
+void Fl_Tree::item_populate_callback(Fl_Tree_Item_Populate_Callback *cb, void *data) {
+  _prefs.item_populate_callback(cb, data);
+}
+
+/// Returns the callback that adds pending children, or NULL if none.
+/// \see item_populate_callback(Fl_Tree_Item_Populate_Callback*, void*)
+///
+Fl_Tree_Item_Populate_Callback* Fl_Tree::item_populate_callback() const {
+  return(_prefs.item_populate_callback());
+}
+
+/// Returns the user data passed to the item_populate_callback().
+void* Fl_Tree::item_populate_user_data() const {
+  return(_prefs.item_populate_user_data());
+}
+
+/// Returns 1 if the children added by the item_populate_callback()
+/// are removed when their parent item is closed.
+/// \see release_closed_children(int)
+///
+int Fl_Tree::release_closed_children() const {
+  return(_prefs.release_closed_children());
+}
+
+/// Set if the children added by the item_populate_callback() are
+/// removed when their parent item is closed.
+///
+/// This caps the memory used by a large tree to the items that are
+/// open: the closed item is marked with Fl_Tree_Item::children_pending(1)
+/// again, and the callback adds the children again when it is reopened.
+/// The state of the removed items, e.g. their selection, is lost.
+/// Default is 0, the children are kept.
+///
+void Fl_Tree::release_closed_children(int val) {
+  _prefs.release_closed_children(val);
+}
+
+// Internal: Add the pending children of 'item' with the populate callback.
+void Fl_Tree::populate(Fl_Tree_Item *item) {
+  item->set_flag(Fl_Tree_Item::CHILDREN_PENDING, 0);    // once, even if callback opens item
+  item->set_flag(Fl_Tree_Item::CHILDREN_POPULATED, 1);
+  if ( _prefs.item_populate_callback() )
+    _prefs.do_item_populate_callback(item);
+  item->recalc_tree();          // may change icon, even without new children
+}
+
+// Internal: Add the children of the open items in view that are still pending.
+//
+//    New children may be open and pending themselves, or change the scrollbars
+//    and with them the area in view, so look again until none are left.
+//    Each item is populated once: one whose callback marks it pending again
+//    isn't populated again until it is reopened.
+//
+void Fl_Tree::populate_visible() {
+  if ( !_root ) return;
+  for (;;) {
+    int Y = _tiy + _prefs.margintop() - _vscroll->value();
+    Fl_Tree_Item *item = find_pending(_root, Y);
+    if ( !item ) return;
+    populate(item);
+    calc_tree();
+  }
+}
+
+// Internal: Find an open item in view whose children are pending.
+//
+//    Walks down from 'item' at position 'Y' the same way draw() does,
+//    skipping subtrees outside the screen with their cached heights.
+//    Returns the item, or NULL if there is none. On return 'Y' is below 'item'.
+//
+Fl_Tree_Item *Fl_Tree::find_pending(Fl_Tree_Item *item, int &Y) {
+  int tree_top = _tiy;
+  int tree_bot = _tiy + _tih;
+  int ystart = Y;
+  int SH = item->calc_subtree_height(_prefs);
+  if ( SH == 0 || (Y+SH) < tree_top || Y > tree_bot ) {  // hidden or offscreen
+    Y += SH;
+    return(0);
+  }
+  int H = item->calc_item_height(_prefs);
+  if ( item->is_open() && item->is_flag(Fl_Tree_Item::CHILDREN_PENDING) &&
+       !item->is_flag(Fl_Tree_Item::CHILDREN_POPULATED) &&
+       (Y+H) >= tree_top && Y <= tree_bot )
+    return(item);
+  if ( !item->is_root() || _prefs.showroot() ) Y += H + _prefs.linespacing();
+  if ( item->has_children() && item->is_open() ) {
+    for ( int t=0; t<item->children() && Y <= tree_bot; t++ ) {
+      Fl_Tree_Item *found = find_pending(item->child(t), Y);
+      if ( found ) return(found);
+    }
+  }
+  Y = ystart + SH;
+  return(0);
+}
+
+// Internal: Remove the children of 'item' added by the populate callback,
+//           and have them added again when needed.
+//
+void Fl_Tree::release(Fl_Tree_Item *item) {
+  // Forget items about to be removed
+  if ( _lastselect ) {
+    for ( Fl_Tree_Item *p = _lastselect->parent(); p; p = p->parent() )
+      if ( p == item ) { _lastselect = 0; break; }
+  }
+  item->clear_children();       // handles _item_focus and recalc_tree()
+  item->set_flag(Fl_Tree_Item::CHILDREN_POPULATED, 0);
+  item->set_flag(Fl_Tree_Item::CHILDREN_PENDING, 1);
+}
+
 /// See if \p 'item' is currently displayed on-screen (visible within the widget).
 ///
 /// This can be used to detect if the item is scrolled off-screen.
@@ -2686,8 +2837,13 @@ void Fl_Tree::fix_scrollbar_order() {
 }
 
 /// Schedule tree to recalc the entire tree size.
+/// This also forgets the cached size of every item, use it after changes
+/// that affect all items, such as the tree's margins or icons.
 /// \note Must be using FLTK ABI 1.3.3 or higher for this to be effective.
 ///
 void Fl_Tree::recalc_tree() {
+  // Forget the cached sizes of all items, changes to the tree's settings may affect them.
+  //    Items notice when they are next asked for their size, see Fl_Tree_Item::cached()
+  _recalc++;
   _tree_w = _tree_h = -1;
 }
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <FL/Fl.H>
 #include <FL/Fl_Widget.H>
 #include <FL/Fl_Tree_Item.H>
@@ -72,6 +73,11 @@ void Fl_Tree_Item::_Init(const Fl_Tree_Prefs &prefs, Fl_Tree *tree) {
   _children.manage_item_destroy(1);     // let array's dtor manage destroying Fl_Tree_Items
   _prev_sibling     = 0;
   _next_sibling     = 0;
+  _subtree_h        = 0;
+  _subtree_w        = 0;
+  _cache            = 0;
+  _recalc           = 0;
+  _walk             = 0;
 }
 
 /// Constructor.
@@ -131,6 +137,11 @@ Fl_Tree_Item::Fl_Tree_Item(const Fl_Tree_Item *o) {
   _parent           = o->_parent;
   _prev_sibling     = 0;                // do not copy ptrs! use update_prev_next()
   _next_sibling     = 0;                // do not copy ptrs! use update_prev_next()
+  _subtree_h        = 0;
+  _subtree_w        = 0;
+  _cache            = 0;                // children aren't copied, so neither is their size
+  _recalc           = 0;
+  _walk             = o->_walk;
 }
 
 /// Print the tree as 'ascii art' to stdout.
@@ -157,8 +168,11 @@ void Fl_Tree_Item::show_self(const char *indent) const {
 /// Makes and manages an internal copy of \p 'name'.
 ///
 void Fl_Tree_Item::label(const char *name) {
+  // The parent's label index (if any) refers to our label string
+  int indexed = _parent ? _parent->_children.unindex(this) : 0;
   if ( _label ) { free((void*)_label); _label = 0; }
   _label = name ? fl_strdup(name) : 0;
+  if ( indexed ) _parent->_children.index(this);
   recalc_tree();                // may change label geometry
 }
 
@@ -181,17 +195,17 @@ void Fl_Tree_Item::clear_children() {
 /// Return the index of the immediate child of this item
 /// that has the label \p 'name'.
 ///
+/// The child itself is looked up in the label index of items with many
+/// children, but its position is then found by comparing it with each
+/// child before it. Use find_child_item(const char*) if only the item
+/// is needed.
+///
 /// \returns index of found item, or -1 if not found.
 /// \version 1.3.0 release
 ///
 int Fl_Tree_Item::find_child(const char *name) {
-  if ( name ) {
-    for ( int t=0; t<children(); t++ )
-      if ( child(t)->label() )
-        if ( strcmp(child(t)->label(), name) == 0 )
-          return(t);
-  }
-  return(-1);
+  Fl_Tree_Item *item = _children.find(name);
+  return(item ? find_child(item) : -1);
 }
 
 /// Return the /immediate/ child of current item
@@ -201,12 +215,7 @@ int Fl_Tree_Item::find_child(const char *name) {
 /// \version 1.3.3
 ///
 const Fl_Tree_Item* Fl_Tree_Item::find_child_item(const char *name) const {
-  if ( name )
-    for ( int t=0; t<children(); t++ )
-      if ( child(t)->label() )
-        if ( strcmp(child(t)->label(), name) == 0 )
-          return(child(t));
-  return(0);
+  return(_children.find(name));
 }
 
 /// Non-const version of Fl_Tree_Item::find_child_item(const char *name) const.
@@ -224,18 +233,10 @@ Fl_Tree_Item* Fl_Tree_Item::find_child_item(const char *name) {
 /// \version 1.3.0 release
 ///
 const Fl_Tree_Item *Fl_Tree_Item::find_child_item(char **arr) const {
-  for ( int t=0; t<children(); t++ ) {
-    if ( child(t)->label() ) {
-      if ( strcmp(child(t)->label(), *arr) == 0 ) {     // match?
-        if ( *(arr+1) ) {                               // more in arr? descend
-          return(_children[t]->find_child_item(arr+1));
-        } else {                                        // end of arr? done
-          return(_children[t]);
-        }
-      }
-    }
-  }
-  return(0);
+  const Fl_Tree_Item *item = _children.find(*arr);
+  if ( item && *(arr+1) )                               // more in arr? descend
+    return(item->find_child_item(arr+1));
+  return(item);                                         // end of arr? done
 }
 
 /// Non-const version of Fl_Tree_Item::find_child_item(char **arr) const.
@@ -442,6 +443,7 @@ Fl_Tree_Item *Fl_Tree_Item::insert_above(const Fl_Tree_Prefs &prefs, const char
 Fl_Tree_Item* Fl_Tree_Item::deparent(int pos) {
   Fl_Tree_Item *orphan = _children[pos];
   if ( _children.deparent(pos) < 0 ) return NULL;
+  recalc_tree();                        // may change tree geometry
   return orphan;
 }
 
@@ -457,6 +459,7 @@ int Fl_Tree_Item::reparent(Fl_Tree_Item *newchild, int pos) {
   int ret;
   if ( (ret = _children.reparent(newchild, this, pos)) < 0 ) return ret;
   newchild->parent(this);               // take custody
+  recalc_tree();                        // may change tree geometry
   return 0;
 }
 
@@ -661,16 +664,11 @@ int Fl_Tree_Item::remove_child(Fl_Tree_Item *item) {
 /// \version 1.3.3
 ///
 int Fl_Tree_Item::remove_child(const char *name) {
-  for ( int t=0; t<children(); t++ ) {
-    if ( child(t)->label() ) {
-      if ( strcmp(child(t)->label(), name) == 0 ) {
-        _children.remove(t);
-        recalc_tree();          // may change tree geometry
-        return(0);
-      }
-    }
-  }
-  return(-1);
+  int t = find_child(name);
+  if ( t < 0 ) return(-1);
+  _children.remove(t);
+  recalc_tree();                // may change tree geometry
+  return(0);
 }
 
 /// Swap two of our children, given two child index values \p 'ax' and \p 'bx'.
@@ -771,7 +769,9 @@ void Fl_Tree_Item::draw_vertical_connector(int x, int y1, int y2, const Fl_Tree_
 ///
 const Fl_Tree_Item *Fl_Tree_Item::find_clicked(const Fl_Tree_Prefs &prefs, int yonly) const {
   if ( ! is_visible() ) return(0);
-  if ( is_root() && !prefs.showroot() ) {
+  locate();
+  char drawthis = ( is_root() && prefs.showroot() == 0 ) ? 0 : 1;
+  if ( !drawthis ) {
     // skip event check if we're root but root not being shown
   } else {
     // See if event is over us
@@ -787,10 +787,16 @@ const Fl_Tree_Item *Fl_Tree_Item::find_clicked(const Fl_Tree_Prefs &prefs, int y
     }
   }
   if ( is_open() ) {                            // open? check children of this item
-    for ( int t=0; t<children(); t++ ) {
-      const Fl_Tree_Item *item;
-      if ( (item = _children[t]->find_clicked(prefs, yonly)) != NULL)  // recurse into child for descendents
-        return(item);                                                  // found?
+    // Only descend into children whose subtree spans the event's y position
+    int Y = _xywh[1] + (drawthis ? _xywh[3] + prefs.linespacing() : 0);
+    for ( int t=0; t<children() && Fl::event_y() >= Y; t++ ) {   // stop at children below event
+      int H = _children[t]->calc_subtree_height(prefs);
+      if ( Fl::event_y() <= Y + H ) {
+        const Fl_Tree_Item *item;
+        if ( (item = _children[t]->find_clicked(prefs, yonly)) != NULL)  // recurse into child for descendents
+          return(item);                                                  // found?
+      }
+      Y += H;
     }
   }
   return(0);
@@ -824,13 +830,112 @@ int Fl_Tree_Item::calc_item_height(const Fl_Tree_Prefs &prefs) const {
        H < widget()->h()) {
     H = widget()->h();
   }
-  if ( has_children() && H < prefs.openicon_h() )
+  if ( (has_children() || children_pending()) && H < prefs.openicon_h() )
     H = prefs.openicon_h();
   if ( usericon() && H<usericon()->h() )
     H = usericon()->h();
   return(H);
 }
 
+/// Return the 'visible' height of this item and its open children, the
+/// distance draw() moves down to the next item. This is cached until
+/// recalc_tree() is called for the item or one of its children, so that
+/// Fl_Tree can skip subtrees outside the screen without walking them.
+/// \returns pixel height, 0 if the item is not visible
+///
+int Fl_Tree_Item::calc_subtree_height(const Fl_Tree_Prefs &prefs) const {
+  if ( ! is_visible() ) return(0);
+  if ( ! (cached() & SUBTREE_H) ) {
+    int H = ( is_root() && prefs.showroot() == 0 ) ? 0
+                                                   : calc_item_height(prefs) + prefs.linespacing();
+    unsigned char widgets = widget() ? SUBTREE_WIDGETS : 0;
+    if ( has_children() && is_open() ) {
+      for ( int t=0; t<children(); t++ ) {
+        H += _children[t]->calc_subtree_height(prefs);
+        widgets |= _children[t]->cached() & SUBTREE_WIDGETS;
+      }
+      H += prefs.openchild_marginbottom();
+    }
+    _subtree_h = H;
+    _cache = SUBTREE_H | widgets;
+  }
+  return(_subtree_h);
+}
+
+/// Return which of the item's cached sizes are valid.
+///
+/// Fl_Tree::recalc_tree() makes the sizes of all items stale by counting
+/// up the tree's _recalc, without visiting the items. An item whose count
+/// differs forgets its sizes here, the next time they are asked for.
+///
+unsigned char Fl_Tree_Item::cached() const {
+  if ( _tree && _recalc != _tree->_recalc ) {
+    _cache  = 0;
+    _recalc = _tree->_recalc;
+  }
+  return(_cache);
+}
+
+/// Return how far right of x() the children of this item are drawn.
+int Fl_Tree_Item::child_x_offset(const Fl_Tree_Prefs &prefs) const {
+  if ( is_root() && prefs.showroot() == 0 ) return(0);  // children drawn in our place
+  int icon_w   = prefs.openicon_w();
+  int hconn_x  = icon_w/2-1;
+  int hconn_x2 = hconn_x + prefs.connectorwidth();
+  return(icon_w + ((hconn_x2 - icon_w) / 2) - (icon_w/2) + 1);
+}
+
+/// Update the item's xywh if the tree's last walk didn't reach it.
+///
+/// Fl_Tree's draw() skips subtrees outside the screen, and calc_tree()
+/// skips subtrees whose size it knows. The position of the items in them
+/// is calculated here from the parent's position and the cached heights
+/// of the items above, when it is asked for.
+///
+void Fl_Tree_Item::locate() const {
+  if ( !_tree || _walk == _tree->_walk ) return;
+  _walk = _tree->_walk;
+  if ( !is_visible_r() ) return;        // not walked by draw() either: keep old xywh
+  const Fl_Tree_Prefs &prefs = _tree->_prefs;
+  const Fl_Tree_Item *p = _parent;
+  if ( !p ) {
+    _xywh[0] = _tree->_walk_xyw[0];
+    _xywh[1] = _tree->_walk_xyw[1];
+    _xywh[2] = _tree->_walk_xyw[2];
+  } else {
+    p->locate();
+    int Y = p->_xywh[1];
+    if ( !p->is_root() || prefs.showroot() )
+      Y += p->_xywh[3] + prefs.linespacing();
+    for ( int t=0; t<p->children() && p->_children[t] != this; t++ )
+      Y += p->_children[t]->calc_subtree_height(prefs);
+    _xywh[0] = p->_xywh[0] + p->child_x_offset(prefs);
+    _xywh[1] = Y;
+    _xywh[2] = p->_xywh[2] - p->child_x_offset(prefs);
+  }
+  _xywh[3] = calc_item_height(prefs);
+}
+
+int Fl_Tree_Item::x() const {
+  locate();
+  return(_xywh[0]);
+}
+
+int Fl_Tree_Item::y() const {
+  locate();
+  return(_xywh[1]);
+}
+
+int Fl_Tree_Item::w() const {
+  locate();
+  return(_xywh[2]);
+}
+
+int Fl_Tree_Item::h() const {
+  locate();
+  return(_xywh[3]);
+}
+
 // These methods held for 1.3.3 ABI: all need 'tree()' back-reference.
 
 /// Returns the recommended foreground color used for drawing this item.
@@ -959,6 +1064,11 @@ int Fl_Tree_Item::draw_item_content(int render) {
 
 /// Draw this item and its children.
 ///
+/// Subtrees whose size is cached and that lie entirely outside the
+/// tree's visible area are skipped, their items compute their position
+/// from the cached sizes when x(), y(), w() or h() is asked for.
+/// Subtrees with FLTK widgets are always walked to move the widgets.
+///
 /// \param[in]     X              Horizontal position for item being drawn
 /// \param[in,out] Y              Vertical position for item being drawn,
 ///                               returns new position for next item
@@ -980,6 +1090,38 @@ void Fl_Tree_Item::draw(int X, int &Y, int W, Fl_Tree_Item *itemfocus,
   if ( !is_visible() ) return;
   int tree_top = tree()->_tiy;
   int tree_bot = tree_top + tree()->_tih;
+
+  // Starting a new walk of the tree?
+  //    Items in subtrees skipped below calculate their xywh from this when asked, see locate()
+  //
+  if ( is_root() ) {
+    _tree->_walk++;
+    _tree->_walk_xyw[0] = X;
+    _tree->_walk_xyw[1] = Y;
+    _tree->_walk_xyw[2] = W;
+  }
+
+  // Skip this item and its children if we know their size and don't need to draw them.
+  //    Rendering? Skip if all of it is clipped off the screen.
+  //    Not rendering? Skip, the tree only wants its size.
+  //    Never skip subtrees with widgets, the widgets must be moved even when offscreen.
+  //
+  unsigned char cache = cached();
+  char skip = (cache & SUBTREE_H) && !(cache & SUBTREE_WIDGETS);
+  if ( skip ) {
+    if ( render ) {
+      if ( (Y+_subtree_h) < tree_top || Y > tree_bot ) {
+        Y += _subtree_h;
+        return;
+      }
+    } else if ( cache & SUBTREE_W ) {
+      if ( _subtree_w != INT_MIN && X + _subtree_w > tree_item_xmax )
+        tree_item_xmax = X + _subtree_w;
+      Y += _subtree_h;
+      return;
+    }
+  }
+  int ystart = Y;
   int H = calc_item_height(prefs);      // height of item
   int H2 = H + prefs.linespacing();     // height of item with line spacing
 
@@ -988,6 +1130,7 @@ void Fl_Tree_Item::draw(int X, int &Y, int W, Fl_Tree_Item *itemfocus,
   _xywh[1] = Y;
   _xywh[2] = W;
   _xywh[3] = H;
+  _walk = _tree->_walk;
 
   // Determine collapse icon's xywh
   //   Note: calculate collapse icon's xywh for possible mouse click detection.
@@ -1025,9 +1168,9 @@ void Fl_Tree_Item::draw(int X, int &Y, int W, Fl_Tree_Item *itemfocus,
   _label_xywh[3] = H;
 
   // Begin calc of this item's max width..
-  //     It might not even be visible, so start at zero.
+  //     It might not even be visible, so start with nothing.
   //
-  int xmax = 0;
+  int xmax = INT_MIN;
 
   // Recalc widget position
   //   Do this whether clipped or not, so that when scrolled,
@@ -1079,7 +1222,7 @@ void Fl_Tree_Item::draw(int X, int &Y, int W, Fl_Tree_Item *itemfocus,
           }
         }
         // Draw collapse icon
-        if ( render && has_children() && prefs.showcollapse() ) {
+        if ( render && (has_children() || children_pending()) && prefs.showcollapse() ) {
           // Draw icon image
           if ( is_open() ) {
             if ( prefs.closeicon() ) {
@@ -1131,20 +1274,24 @@ void Fl_Tree_Item::draw(int X, int &Y, int W, Fl_Tree_Item *itemfocus,
     }                   // end drawthis
   }                     // end clipped
   if ( drawthis ) Y += H2;                                      // adjust Y (even if clipped)
-  // Manage tree_item_xmax
-  if ( xmax > tree_item_xmax )
-    tree_item_xmax = xmax;
   // Draw child items (if any)
+  //    xmax becomes the max width of this item and its children
+  unsigned char widgets = widget() ? SUBTREE_WIDGETS : 0;
   if ( has_children() && is_open() ) {
     int child_x = drawthis ? (hconn_x_center - (icon_w/2) + 1)  // offset children to right,
                            : X;                                 // unless didn't drawthis
     int child_w = W - (child_x-X);
     int child_y_start = Y;
-    for ( int t=0; t<children(); t++ ) {
+    int t;
+    for ( t=0; t<children(); t++ ) {
+      if ( render && skip && Y > tree_bot ) break;      // rest is offscreen, size is known
       int is_lastchild = ((t+1)==children()) ? 1 : 0;
-      _children[t]->draw(child_x, Y, child_w, itemfocus, tree_item_xmax, is_lastchild, render);
+      _children[t]->draw(child_x, Y, child_w, itemfocus, xmax, is_lastchild, render);
+      widgets |= _children[t]->cached() & SUBTREE_WIDGETS;
     }
-    if ( has_children() && is_open() ) {
+    if ( t < children() ) {
+      Y = ystart + _subtree_h;                          // skipped the rest of the children
+    } else {
       Y += prefs.openchild_marginbottom();              // offset below open child tree
     }
     if ( ! lastchild ) {
@@ -1178,13 +1325,24 @@ void Fl_Tree_Item::draw(int X, int &Y, int W, Fl_Tree_Item *itemfocus,
       }
     }
   }
+  // Manage tree_item_xmax
+  if ( xmax > tree_item_xmax )
+    tree_item_xmax = xmax;
+  // Cache our size for the next walk. The width is only known if nothing was clipped.
+  _subtree_h = Y - ystart;
+  _cache = (_cache & SUBTREE_W) | SUBTREE_H | widgets;
+  if ( !render ) {
+    _subtree_w = (xmax == INT_MIN) ? INT_MIN : xmax - X;
+    _cache |= SUBTREE_W;
+  }
 }
 
 
 /// Was the event on the 'collapse' button of this item?
 ///
 int Fl_Tree_Item::event_on_collapse_icon(const Fl_Tree_Prefs &prefs) const {
-  if ( is_visible() && is_active() && has_children() && prefs.showcollapse() ) {
+  if ( is_visible() && is_active() && (has_children() || children_pending()) &&
+       prefs.showcollapse() ) {
     return(event_inside(_collapse_xywh) ? 1 : 0);
   } else {
     return(0);
@@ -1256,6 +1414,7 @@ void Fl_Tree_Item::hide_widgets() {
 
 /// Open this item and all its children.
 void Fl_Tree_Item::open() {
+  if ( is_flag(CHILDREN_PENDING) ) _tree->populate(this);
   set_flag(OPEN,1);
   // Tell children to show() their widgets
   for ( int t=0; t<_children.total(); t++ ) {
@@ -1271,9 +1430,25 @@ void Fl_Tree_Item::close() {
   for ( int t=0; t<_children.total(); t++ ) {
     _children[t]->hide_widgets();
   }
+  // Populated children no longer needed? Release them
+  if ( is_flag(CHILDREN_POPULATED) && _tree->_prefs.release_closed_children() )
+    _tree->release(this);
   recalc_tree();                // may change tree geometry
 }
 
+/// Mark this item as having children that aren't added yet.
+///
+/// The item is drawn with an open/close icon as if it had children, and
+/// the tree's item_populate_callback() is invoked to add them when the
+/// item is opened, or when it is scrolled into view while open.
+/// \param[in] val 1: children will be added when needed, 0: no children pending
+/// \see Fl_Tree::item_populate_callback(), Fl_Tree::release_closed_children()
+///
+void Fl_Tree_Item::children_pending(int val) {
+  set_flag(CHILDREN_PENDING, val);
+  recalc_tree();                // may change icon and item height
+}
+
 /// Returns how many levels deep this item is in the hierarchy.
 ///
 /// For instance; root has a depth of zero, and its immediate children
@@ -1478,5 +1653,9 @@ int Fl_Tree_Item::is_visible_r() const {
 /// \version 1.3.3 ABI
 ///
 void Fl_Tree_Item::recalc_tree() {
-  _tree->recalc_tree();
+  // Only our size and that of our parents changes, the rest of the tree
+  // keeps its cached sizes
+  for ( Fl_Tree_Item *item = this; item; item = item->_parent )
+    item->_cache = 0;
+  _tree->_tree_w = _tree->_tree_h = -1;
 }
@@ -7,6 +7,8 @@
 #include <FL/Fl_Tree_Item_Array.H>
 #include <FL/Fl_Tree_Item.H>
 
+#include <unordered_map>
+
 //////////////////////
 // Fl_Tree_Item_Array.cxx
 //////////////////////
@@ -25,6 +27,33 @@
 //     https://www.fltk.org/bugs.php
 //
 
+// Arrays with fewer items than this are searched without an index
+static const int INDEX_MIN_ITEMS = 32;
+
+// Hash and compare item labels, NULL labels are indexed as well
+struct Fl_Tree_Item_Label_Hash {
+  size_t operator()(const char *s) const {
+    size_t h = 2166136261u;                     // FNV-1a
+    if ( s ) while ( *s ) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+  }
+};
+struct Fl_Tree_Item_Label_Equal {
+  bool operator()(const char *a, const char *b) const {
+    return (a && b) ? strcmp(a, b) == 0 : a == b;
+  }
+};
+
+// Internal: index of the items in an array by their label.
+//    The key is the item's own label string, so an item must be
+//    removed from the index before its label is changed or freed.
+//
+class Fl_Tree_Item_Index
+  : public std::unordered_multimap<const char*, Fl_Tree_Item*,
+                                   Fl_Tree_Item_Label_Hash,
+                                   Fl_Tree_Item_Label_Equal> {
+};
+
 /// Constructor; creates an empty array.
 ///
 ///     The optional 'chunksize' can be specified to optimize
@@ -35,6 +64,7 @@ Fl_Tree_Item_Array::Fl_Tree_Item_Array(int new_chunksize) {
   _total     = 0;
   _size      = 0;
   _flags     = 0;
+  _index     = 0;
   _chunksize = new_chunksize;
 }
 
@@ -50,6 +80,7 @@ Fl_Tree_Item_Array::Fl_Tree_Item_Array(const Fl_Tree_Item_Array* o) {
   _size      = o->_size;
   _chunksize = o->_chunksize;
   _flags     = o->_flags;
+  _index     = 0;                       // built again when needed
   for ( int t=0; t<o->_total; t++ ) {
     if ( _flags & MANAGE_ITEM ) {
       _items[t] = new Fl_Tree_Item(o->_items[t]);       // make new copy of item
@@ -68,6 +99,7 @@ Fl_Tree_Item_Array::Fl_Tree_Item_Array(const Fl_Tree_Item_Array* o) {
 ///     and the array will be cleared. total() will return 0.
 ///
 void Fl_Tree_Item_Array::clear() {
+  delete _index; _index = 0;
   if ( _items ) {
     for ( int t=0; t<_total; t++ ) {
       if ( _flags & MANAGE_ITEM )
@@ -123,6 +155,7 @@ void Fl_Tree_Item_Array::insert(int pos, Fl_Tree_Item *new_item) {
   }
   _items[pos] = new_item;
   _total++;
+  index(new_item);
   if ( _flags & MANAGE_ITEM )
   {
     _items[pos]->update_prev_next(pos); // adjust item's prev/next and its neighbors
@@ -146,11 +179,13 @@ void Fl_Tree_Item_Array::add(Fl_Tree_Item *val) {
 ///
 void Fl_Tree_Item_Array::replace(int index, Fl_Tree_Item *newitem) {
   if ( _items[index] ) {                        // delete if non-zero
+    unindex(_items[index]);
     if ( _flags & MANAGE_ITEM )
       // Destroy old item
       delete _items[index];
   }
   _items[index] = newitem;                      // install new item
+  this->index(newitem);
   if ( _flags & MANAGE_ITEM )
   {
     // Restitch into linked list
@@ -164,6 +199,7 @@ void Fl_Tree_Item_Array::replace(int index, Fl_Tree_Item *newitem) {
 ///
 void Fl_Tree_Item_Array::remove(int index) {
   if ( _items[index] ) {                        // delete if non-zero
+    unindex(_items[index]);
     if ( _flags & MANAGE_ITEM )
       delete _items[index];
   }
@@ -251,6 +287,7 @@ int Fl_Tree_Item_Array::deparent(int pos) {
   Fl_Tree_Item *prev = item->prev_sibling();
   Fl_Tree_Item *next = item->next_sibling();
   // Remove from parent's list of children
+  unindex(item);
   _total -= 1;
   for ( int t=pos; t<_total; t++ )
     _items[t] = _items[t+1];            // delete, no destroy
@@ -275,8 +312,66 @@ int Fl_Tree_Item_Array::reparent(Fl_Tree_Item *item, Fl_Tree_Item* newparent, in
   for ( int t=_total-1; t>pos; --t )    // shuffle array to make room for new entry
     _items[t] = _items[t-1];
   _items[pos] = item;                   // insert new entry
+  index(item);
   // Attach to new parent and siblings
   _items[pos]->parent(newparent);       // reparent (update_prev_next() needs this)
   _items[pos]->update_prev_next(pos);   // find new siblings
   return 0;
 }
+
+// Internal: Add an item to the label index, if there is one.
+void Fl_Tree_Item_Array::index(Fl_Tree_Item *item) {
+  if ( _index )
+    _index->insert(std::make_pair(item->label(), item));
+}
+
+// Internal: Remove an item from the label index, if there is one.
+//
+//    Returns 1 if the item was removed from the index, 0 if there
+//    is no index or the item is not in it.
+//
+int Fl_Tree_Item_Array::unindex(Fl_Tree_Item *item) {
+  if ( !_index ) return 0;
+  std::pair<Fl_Tree_Item_Index::iterator, Fl_Tree_Item_Index::iterator>
+    range = _index->equal_range(item->label());
+  for ( Fl_Tree_Item_Index::iterator i = range.first; i != range.second; ++i ) {
+    if ( i->second == item ) {
+      _index->erase(i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/// Find the first item in the array with the label \p 'label'.
+///
+///     The first time an array with many items is searched, an index of
+///     the item labels is built, which makes this and later searches fast
+///     regardless of the number of items. Smaller arrays are searched
+///     item by item, and so is an array in which several items have
+///     \p 'label', to return the first of them.
+///
+///     \returns the item, or NULL if \p 'label' is NULL or not found.
+///
+Fl_Tree_Item *Fl_Tree_Item_Array::find(const char *label) const {
+  if ( !label ) return 0;
+  if ( !_index && _total >= INDEX_MIN_ITEMS ) {         // build index
+    _index = new Fl_Tree_Item_Index;
+    _index->reserve(_total);
+    for ( int t=0; t<_total; t++ )
+      _index->insert(std::make_pair(_items[t]->label(), _items[t]));
+  }
+  if ( _index ) {
+    std::pair<Fl_Tree_Item_Index::iterator, Fl_Tree_Item_Index::iterator>
+      range = _index->equal_range(label);
+    if ( range.first == range.second ) return 0;        // not found
+    Fl_Tree_Item_Index::iterator second = range.first;
+    if ( ++second == range.second )                     // only one? done
+      return range.first->second;
+    // Several items with this label: find the first one below
+  }
+  for ( int t=0; t<_total; t++ )
+    if ( _items[t]->label() && strcmp(_items[t]->label(), label) == 0 )
+      return _items[t];
+  return 0;
+}
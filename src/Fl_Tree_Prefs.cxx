@@ -121,6 +121,9 @@ Fl_Tree_Prefs::Fl_Tree_Prefs() {
   _itemdrawmode           = FL_TREE_ITEM_DRAW_DEFAULT;
   _itemdrawcallback       = 0;
   _itemdrawuserdata       = 0;
+  _itempopulatecallback   = 0;
+  _itempopulateuserdata   = 0;
+  _releaseclosed          = 0;
 }
 
 /// Fl_Tree_Prefs destructor
@@ -336,6 +336,14 @@ void Fl_WinAPI_System_Driver::remove_fd(int n) {
   remove_fd(n, -1);
 }
 
+// Fl::add_fd() only supports sockets on Windows, so read from a socket.
+int Fl_WinAPI_System_Driver::read_fd(int n, char *buf, int len) {
+  int r = recv((SOCKET)n, buf, len, 0);
+  if (r == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+    return -2;
+  return r < 0 ? -1 : r;
+}
+
 // these pointers are set by the Fl::lock() function:
 static void nothing() {}
 void (*fl_lock_function)() = nothing;
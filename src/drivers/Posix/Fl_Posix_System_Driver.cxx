@@ -29,6 +29,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <pwd.h>
 #include <unistd.h>
 #include <time.h>
@@ -315,6 +316,54 @@ bool Fl_Posix_System_Driver::probe_for_GTK(int major, int minor, void **p_ptr_gt
 int Fl_Posix_System_Driver::close_fd(int fd) { return close(fd); }
 
 
+/*
+ Map a regular file into memory.
+
+ The mapping is private and writable: pages that are written to are copied
+ by the kernel and changes never reach the file. Returns NULL if the file
+ can't be mapped, is empty, or is too large to be indexed with an int.
+ */
+char *Fl_Posix_System_Driver::map_file(const char *f, size_t *size) {
+  *size = 0;
+  int fd = ::open(f, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat st;
+  void *addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+      st.st_size > 0 && st.st_size < 0x7fffffff) {
+    addr = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) return NULL;
+  *size = (size_t)st.st_size;
+  return (char *)addr;
+}
+
+
+void Fl_Posix_System_Driver::unmap_file(char *addr, size_t size) {
+  munmap(addr, size);
+}
+
+
+int Fl_Posix_System_Driver::read_fd(int fd, char *buf, int len) {
+  int n;
+  do {
+    n = (int)::read(fd, buf, (size_t)len);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return -2;
+  return n;
+}
+
+
+void Fl_Posix_System_Driver::sleep_ms(int ms) {
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+  while (nanosleep(&ts, &ts) < 0 && errno == EINTR) { }
+}
+
+
 ////////////////////////////////////////////////////////////////
 // POSIX threading...
 #if defined(HAVE_PTHREAD)
@@ -456,6 +505,33 @@ void Fl_Posix_System_Driver::unlock() {
   fl_unlock_function();
 }
 
+struct Fl_Posix_Thread_Start {
+  void (*func)(void*);
+  void *arg;
+};
+
+static void *thread_start(void *data) {
+  Fl_Posix_Thread_Start *start = (Fl_Posix_Thread_Start*)data;
+  void (*func)(void*) = start->func;
+  void *arg = start->arg;
+  delete start;
+  func(arg);
+  return NULL;
+}
+
+int Fl_Posix_System_Driver::create_thread(void (*func)(void*), void *arg) {
+  Fl_Posix_Thread_Start *start = new Fl_Posix_Thread_Start;
+  start->func = func;
+  start->arg = arg;
+  pthread_t t;
+  if (pthread_create(&t, NULL, thread_start, start)) {
+    delete start;
+    return -1;
+  }
+  pthread_detach(t);
+  return 0;
+}
+
 // Mutex code for the awake ring buffer
 static pthread_mutex_t *ring_mutex;
 
@@ -477,6 +553,7 @@ void Fl_Posix_System_Driver::awake(void*) {}
 int Fl_Posix_System_Driver::lock() { return 1; }
 void Fl_Posix_System_Driver::unlock() {}
 void* Fl_Posix_System_Driver::thread_message() { return NULL; }
+int Fl_Posix_System_Driver::create_thread(void (*)(void*), void*) { return -1; }
 
 //void lock_ring() {}
 //void unlock_ring() {}
@@ -237,6 +237,33 @@ FILE *Fl_WinAPI_System_Driver::fopen(const char *fnam, const char *mode) {
   return _wfopen(wbuf, wbuf1);
 }
 
+/*
+ Map a file into memory with copy-on-write access, so that pages written
+ to are private to the process and changes never reach the file.
+ */
+char *Fl_WinAPI_System_Driver::map_file(const char *fnam, size_t *size) {
+  *size = 0;
+  HANDLE file = CreateFileW(utf8_to_wchar(fnam, wbuf), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return NULL;
+  char *addr = NULL;
+  LARGE_INTEGER fsize;
+  if (GetFileSizeEx(file, &fsize) && fsize.QuadPart > 0 && fsize.QuadPart < 0x7fffffff) {
+    HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (mapping) {
+      addr = (char *)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+      CloseHandle(mapping); // the view keeps the mapping alive
+    }
+    if (addr) *size = (size_t)fsize.QuadPart;
+  }
+  CloseHandle(file);
+  return addr;
+}
+
+void Fl_WinAPI_System_Driver::unmap_file(char *addr, size_t) {
+  UnmapViewOfFile(addr);
+}
+
 int Fl_WinAPI_System_Driver::system(const char *cmd) {
   return _wsystem(utf8_to_wchar(cmd, wbuf));
 }
@@ -1129,6 +1156,15 @@ void Fl_WinAPI_System_Driver::awake(void* msg) {
   PostThreadMessage( main_thread, fl_wake_msg, (WPARAM)msg, 0);
 }
 
+int Fl_WinAPI_System_Driver::create_thread(void (*func)(void*), void *arg) {
+  uintptr_t t = _beginthread(func, 0, arg);
+  return (t == (uintptr_t)-1L) ? -1 : 0;
+}
+
+void Fl_WinAPI_System_Driver::sleep_ms(int ms) {
+  Sleep(ms);
+}
+
 int Fl_WinAPI_System_Driver::close_fd(int fd) {
   return _close(fd);
 }
@@ -0,0 +1,227 @@
+//
+// Fl_Terminal benchmark program for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 2026 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     https://www.fltk.org/COPYING.php
+//
+// Please see the following page on how to report bugs and issues:
+//
+//     https://www.fltk.org/bugs.php
+//
+
+//
+// Feeds canned workloads through Fl_Terminal::append() and reports the
+// throughput of the escape sequence parser, the cost of redrawing the
+// terminal, and the peak memory used. No window is opened, so this runs
+// headless, e.g. on a build server:
+//
+//     terminal_bench [-m megabytes] [ascii] [sgr] [cursor] [cjk]
+//
+// Drawing goes to the Ut_Null_Driver of the unit tests, which discards
+// everything and only counts the calls, so the redraw cost is the time
+// spent in Fl_Terminal itself, and the text and rectangle counts show how
+// much it draws.
+// Without a window the screen can't be scrolled with fl_scroll(), so
+// output that scrolls redraws all rows, as on an obscured window.
+// Run a single workload to get its own peak memory, the peak memory of a
+// process never goes down.
+//
+
+#include "unittests.h"                 // Ut_Null_Drawing
+
+#include <FL/Fl.H>
+#include <FL/Fl_Terminal.H>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#ifdef _WIN32
+#  include <windows.h>
+#  define PSAPI_VERSION 2               // GetProcessMemoryInfo() in kernel32
+#  include <psapi.h>
+#else
+#  include <sys/resource.h>
+#endif
+
+// Terminal that can be drawn without showing it, with 80x24 cells of
+// 10x20 pixels in the font metrics of Ut_Null_Driver
+class Bench_Terminal : public Fl_Terminal {
+public:
+  Bench_Terminal() : Fl_Terminal(0, 0, 80*10+30, 24*20+10, 0, 24, 80, 1000) {
+    // fl_scroll() needs a window, so let draw() redraw scrolled rows instead
+    box(FL_FLAT_BOX);
+    redraw_style(NO_REDRAW);
+    textsize(16);
+  }
+  void draw_now(uchar flags) {
+    clear_damage(flags);
+    draw();
+  }
+};
+
+// Peak memory of the process in KB
+static long peak_memory() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+  return long(pmc.PeakWorkingSetSize / 1024);
+#else
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#  ifdef __APPLE__
+  return long(ru.ru_maxrss / 1024);     // bytes on macOS
+#  else
+  return long(ru.ru_maxrss);
+#  endif
+#endif
+}
+
+static double seconds(clock_t start) {
+  return double(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// Plain ASCII lines, like a build log
+static void make_ascii(std::string &out, size_t size) {
+  char line[200];
+  for (int i = 0; out.size() < size; i++) {
+    snprintf(line, sizeof(line),
+             "[%5d] g++ -O2 -Wall -Iinclude -c src/module_%d.cxx -o obj/module_%d.o\n",
+             i, i, i);
+    out += line;
+  }
+}
+
+// Every word in a different color and attribute, like colored ls or diff output
+static void make_sgr(std::string &out, size_t size) {
+  static const char *words[] = { "alpha", "beta", "gamma", "delta", "epsilon", "zeta" };
+  char word[80];
+  for (int i = 0; out.size() < size; i++) {
+    snprintf(word, sizeof(word), "\033[%d;%d;%dm%s\033[0m ",
+             i % 3, 30 + i % 8, 40 + (i / 8) % 8, words[i % 6]);
+    out += word;
+    if (i % 10 == 9) out += "\n";
+  }
+}
+
+// Full screen updates with cursor addressing, like top or a text editor
+static void make_cursor(std::string &out, size_t size) {
+  char cell[80];
+  for (int i = 0; out.size() < size; i++) {
+    out += "\033[H";
+    for (int row = 1; row <= 24; row++) {
+      snprintf(cell, sizeof(cell), "\033[%d;1H%5d %-20d\033[%d;60H\033[7m%8d\033[0m",
+               row, row, i * row, row, i + row);
+      out += cell;
+    }
+  }
+}
+
+// UTF-8 text with double width CJK characters
+static void make_cjk(std::string &out, size_t size) {
+  static const char *text =
+    "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe3\x83\x86\xe3\x82\xad"
+    "\xe3\x82\xb9\xe3\x83\x88 \xe4\xb8\xad\xe6\x96\x87\xe6\x96\x87\xe6\x9c\xac "
+    "\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4 abc \xc3\xa4\xc3\xb6\xc3\xbc\n";
+  while (out.size() < size) out += text;
+}
+
+struct Workload {
+  const char *name;
+  void (*make)(std::string&, size_t);
+};
+
+static const Workload workloads[] = {
+  { "ascii",  make_ascii  },
+  { "sgr",    make_sgr    },
+  { "cursor", make_cursor },
+  { "cjk",    make_cjk    }
+};
+
+static void run(const Workload &w, size_t size, Ut_Null_Driver &driver) {
+  std::string data;
+  w.make(data, size);
+  double mb = data.size() / (1024.0 * 1024.0);
+
+  // Parser throughput: block writes, as from a pipe
+  double parse_secs;
+  {
+    Bench_Terminal term;
+    clock_t start = clock();
+    for (size_t i = 0; i < data.size(); i += 4096) {
+      size_t n = data.size() - i < 4096 ? data.size() - i : 4096;
+      term.append(data.data() + i, int(n));
+    }
+    parse_secs = seconds(start);
+  }
+
+  // Redraw cost: redraw the modified rows after every 1 KB of output,
+  // as the redraw timer would for a fast producer, then the whole screen
+  int frames = 0;
+  long texts = 0, rects = 0;
+  double draw_secs = 0.0, full_secs;
+  {
+    Bench_Terminal term;
+    for (size_t i = 0; i < data.size() && frames < 20000; i += 1024) {
+      size_t n = data.size() - i < 1024 ? data.size() - i : 1024;
+      term.append(data.data() + i, int(n));
+      driver.texts = driver.rects = 0;
+      clock_t start = clock();
+      term.draw_now(FL_DAMAGE_USER1);
+      draw_secs += seconds(start);
+      texts += driver.texts;
+      rects += driver.rects;
+      frames++;
+    }
+    clock_t start = clock();
+    for (int i = 0; i < 1000; i++) term.draw_now(FL_DAMAGE_ALL);
+    full_secs = seconds(start) / 1000;
+  }
+
+  printf("%-8s %6.1f %8.1f %10.1f %8.1f %8.1f %10.1f %9ld\n",
+         w.name, mb, parse_secs > 0.0 ? mb / parse_secs : 0.0,
+         frames ? draw_secs * 1e6 / frames : 0.0,
+         frames ? double(texts) / frames : 0.0,
+         frames ? double(rects) / frames : 0.0,
+         full_secs * 1e6, peak_memory());
+}
+
+int main(int argc, char **argv) {
+  size_t size = 16 * 1024 * 1024;
+  int i = 1;
+  if (i + 1 < argc && strcmp(argv[i], "-m") == 0) {
+    size = size_t(atof(argv[i + 1]) * 1024 * 1024);
+    i += 2;
+  }
+  Ut_Null_Drawing drawing;              // draw without opening the display
+
+  const int n = int(sizeof(workloads) / sizeof(workloads[0]));
+  const int first = i;                  // first workload name
+  for (; i < argc; i++) {
+    int w;
+    for (w = 0; w < n; w++) if (strcmp(argv[i], workloads[w].name) == 0) break;
+    if (w == n) {
+      fprintf(stderr, "usage: %s [-m megabytes] [ascii] [sgr] [cursor] [cjk]\n", argv[0]);
+      return 1;
+    }
+  }
+  // parser:  MB/s appended
+  // frame:   redraw of the modified rows after each KB, time and calls per frame
+  // full:    redraw of the whole terminal
+  // peak:    peak memory of the process
+  printf("%-8s %6s %8s %10s %8s %8s %10s %9s\n", "workload", "MB", "parser",
+         "us/frame", "texts", "rects", "us/full", "peak KB");
+  for (int w = 0; w < n; w++) {
+    bool selected = (first == argc);
+    for (int a = first; a < argc; a++)
+      if (strcmp(argv[a], workloads[w].name) == 0) selected = true;
+    if (selected) run(workloads[w], size, drawing.driver());
+  }
+  return 0;
+}
@@ -16,15 +16,22 @@
 
 #include "unittests.h"
 
+#include <FL/Fl.H>
 #include <FL/Fl_Group.H>
 #include <FL/Fl_Button.H>
 #include <FL/Fl_Terminal.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Text_Display.H>
+#include <FL/Fl_Text_Regex.H>
+#include <FL/Fl_Tree.H>
 #include <FL/Fl_Preferences.H>
 #include <FL/fl_callback_macros.H>
 #include <FL/filename.H>
 #include <FL/fl_utf8.h>
 
 #include <string>
+#include <algorithm>
+#include <limits.h>
 
 
 /* Test additions to Fl_Preferences. */
@@ -50,6 +57,860 @@ TEST(Fl_Preferences, Strings) {
   return true;
 }
 
+/* Test line queries on a text buffer that is large enough to be indexed. */
+TEST(Fl_Text_Buffer, LineIndex) {
+  Fl_Text_Buffer buf;
+  std::string line = "0123456789abcdefghijklmnopqrstuvwxyz\n"; // 37 bytes
+  for (int i = 0; i < 2000; i++) buf.append(line.c_str());
+  EXPECT_EQ(buf.count_lines(0, buf.length()), 2000);
+  EXPECT_EQ(buf.skip_lines(0, 1000), 37000);
+  EXPECT_EQ(buf.rewind_lines(37000, 1), 36963);
+  EXPECT_EQ(buf.line_start(37010), 37000);
+  EXPECT_EQ(buf.line_end(37010), 37036);
+  buf.insert(37, "new\nlines\n");
+  EXPECT_EQ(buf.count_lines(0, buf.length()), 2002);
+  EXPECT_EQ(buf.skip_lines(0, 3), 37+10);
+  buf.remove(0, 37+10);
+  EXPECT_EQ(buf.count_lines(0, buf.length()), 1999);
+  EXPECT_EQ(buf.skip_lines(0, 1998), 1998*37);
+  EXPECT_EQ(buf.line_start(buf.length()), buf.length());
+  return true;
+}
+
+/* Test literal searches across the gap of a text buffer. */
+TEST(Fl_Text_Buffer, Search) {
+  Fl_Text_Buffer buf;
+  buf.text("One two ONE two one");
+  buf.insert(8, "xx ");  // moves the gap into the text
+  int pos = -1;
+  EXPECT_EQ(buf.search_forward(1, "one", &pos, 0), 1);
+  EXPECT_EQ(pos, 11);
+  EXPECT_EQ(buf.search_forward(1, "one", &pos, 1), 1);
+  EXPECT_EQ(pos, 19);
+  EXPECT_EQ(buf.search_backward(18, "two", &pos, 1), 1);
+  EXPECT_EQ(pos, 15);
+  EXPECT_EQ(buf.findchar_backward(8, 'O', &pos), 1);
+  EXPECT_EQ(pos, 0);
+  std::vector<int> found;
+  EXPECT_EQ(buf.find_all("one", found), 3);
+  EXPECT_EQ(found[1], 11);
+  EXPECT_EQ(buf.find_all("two xx", found, 1), 1);
+  EXPECT_EQ(found[0], 4);
+  return true;
+}
+
+static int tx_calls, tx_pos, tx_inserted, tx_deleted;
+static void tx_modified(int pos, int nInserted, int nDeleted, int, const char*, void*) {
+  tx_calls++; tx_pos = pos; tx_inserted = nInserted; tx_deleted = nDeleted;
+}
+
+/* Test that a transaction is reported and undone as a single change. */
+TEST(Fl_Text_Buffer, Transaction) {
+  Fl_Text_Buffer buf;
+  buf.text("one two one two one");
+  buf.add_modify_callback(tx_modified, NULL);
+  tx_calls = 0;
+  buf.begin_transaction();
+  std::vector<int> found;
+  buf.find_all("one", found);
+  for (size_t i = found.size(); i > 0; i--)
+    buf.replace(found[i-1], found[i-1] + 3, "1");
+  EXPECT_EQ(tx_calls, 0);
+  buf.end_transaction();
+  EXPECT_EQ(tx_calls, 1);
+  EXPECT_EQ(tx_pos, 0);
+  EXPECT_EQ(tx_deleted, 19);
+  EXPECT_EQ(tx_inserted, 13);
+  char *text = buf.text();
+  EXPECT_STREQ(text, "1 two 1 two 1");
+  free(text);
+  buf.undo();
+  text = buf.text();
+  EXPECT_STREQ(text, "one two one two one");
+  free(text);
+  buf.remove_modify_callback(tx_modified, NULL);
+  return true;
+}
+
+/* Test access to the text on either side of the gap. */
+TEST(Fl_Text_Buffer, Spans) {
+  Fl_Text_Buffer buf;
+  buf.text("0123456789");
+  buf.insert(4, "abc");     // the gap is now after "0123abc"
+  const char *t1, *t2;
+  int n1, n2;
+  EXPECT_EQ(buf.spans(2, 9, &t1, &n1, &t2, &n2), 2);
+  std::string both = std::string(t1, n1) + std::string(t2, n2);
+  EXPECT_STREQ(both.c_str(), "23abc45");
+  EXPECT_EQ(buf.spans(8, 20, &t1, &n1, &t2, &n2), 1);
+  std::string one(t1, n1);
+  EXPECT_STREQ(one.c_str(), "56789");
+  EXPECT_EQ(buf.spans(5, 5, &t1, &n1, &t2, &n2), 0);
+  std::string all;
+  const char *text;
+  for (int pos = 0, n; (n = buf.read_chunk(pos, buf.length(), &text, 3)); pos += n) {
+    EXPECT_TRUE(n <= 3);
+    all.append(text, n);
+  }
+  EXPECT_STREQ(all.c_str(), "0123abc456789");
+  return true;
+}
+
+static int pt_span(int pos, const char *text, int len, void *data) {
+  std::string *s = (std::string *)data;
+  EXPECT_EQ(pos, (int)s->size());
+  s->append(text, len);
+  return 0;
+}
+
+/* Test random edits in piece table mode against a copy of the text. */
+TEST(Fl_Text_Buffer, PieceTable) {
+  Fl_Text_Buffer buf;
+  std::string model;
+  for (int i = 0; i < 2000; i++) model += "line \xc3\xa4 with text\n";
+  buf.text(model.c_str());
+  buf.piece_table(1);
+  EXPECT_EQ(buf.piece_table(), 1);
+  unsigned seed = 1;
+  for (int step = 0; step < 2000; step++) {
+    seed = seed * 1103515245 + 12345;
+    int pos = buf.utf8_align((int)((seed >> 8) % (model.size() + 1)));
+    int len = (int)((seed >> 4) % 17);
+    int end = buf.utf8_align(std::min(pos + len, (int)model.size()));
+    if (step % 3 == 0) {
+      buf.remove(pos, end);
+      model.erase(pos, end - pos);
+    } else if (step % 3 == 1) {
+      const char *t = (step & 4) ? "new\nline " : "\xe2\x82\xac";
+      buf.insert(pos, t);
+      model.insert(pos, t);
+    } else {
+      buf.replace(pos, end, "xy");
+      model.replace(pos, end - pos, "xy");
+    }
+    EXPECT_EQ(buf.length(), (int)model.size());
+    char *range = buf.text_range(pos, pos + 40);
+    std::string expected = model.substr(pos, 40);
+    EXPECT_STREQ(range, expected.c_str());
+    free(range);
+    if (pos < buf.length()) {
+      EXPECT_EQ(buf.byte_at(pos), model[pos]);
+    }
+  }
+  EXPECT_TRUE(buf.text_str() == model);
+  std::string spans;
+  buf.for_each_span(0, buf.length(), pt_span, &spans);
+  EXPECT_TRUE(spans == model);
+  const char *t1, *t2;
+  int n1, n2;
+  EXPECT_EQ(buf.spans(0, buf.length(), &t1, &n1, &t2, &n2), 3);
+  int lines = 0;
+  for (size_t i = 0; i < model.size(); i++) lines += (model[i] == '\n');
+  EXPECT_EQ(buf.count_lines(0, buf.length()), lines);
+  int p = (int)model.find('\n', 10000) + 1;
+  EXPECT_EQ(buf.skip_lines(0, buf.count_lines(0, p)), p);
+  EXPECT_EQ(buf.rewind_lines(p, 1), (int)model.rfind('\n', p - 2) + 1);
+  int found = -1;
+  EXPECT_EQ(buf.search_backward(buf.length(), "xy", &found, 1), 1);
+  EXPECT_EQ(found, (int)model.rfind("xy"));
+  EXPECT_EQ(buf.search_forward(0, "NEW\nLINE", &found, 0), 1);
+  EXPECT_EQ(found, (int)model.find("new\nline"));
+  // undo restores the text that was removed
+  buf.remove(buf.utf8_align(100), buf.utf8_align(20000));
+  EXPECT_TRUE(buf.undo());
+  EXPECT_TRUE(buf.text_str() == model);
+  // leaving piece table mode copies the text back into a gap buffer
+  buf.piece_table(0);
+  EXPECT_EQ(buf.spans(0, buf.length(), &t1, &n1, &t2, &n2), 1);
+  EXPECT_TRUE(buf.text_str() == model);
+  return true;
+}
+
+/* Test that a tail limit keeps only the last lines of a growing buffer. */
+TEST(Fl_Text_Buffer, Tail) {
+  Fl_Text_Buffer buf;
+  buf.tail_limit(80);
+  char line[32];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(line, sizeof(line), "line %d\n", i);
+    buf.append(line);
+    EXPECT_TRUE(buf.count_lines(0, buf.length()) <= 90);
+  }
+  EXPECT_TRUE(buf.count_lines(0, buf.length()) >= 80);
+  char *text = buf.line_text(buf.line_start(buf.length() - 1));
+  EXPECT_STREQ(text, "line 999");
+  free(text);
+  buf.tail_limit(10);
+  EXPECT_EQ(buf.count_lines(0, buf.length()), 10);
+  text = buf.line_text(0);
+  EXPECT_STREQ(text, "line 990");
+  free(text);
+  EXPECT_TRUE(!buf.can_undo());
+  return true;
+}
+
+/* Test that the undo history is trimmed to its memory budget. */
+TEST(Fl_Text_Buffer, UndoBudget) {
+  Fl_Text_Buffer buf;
+  std::string line(999, 'x');
+  line += '\n';
+  for (int i = 0; i < 100; i++)
+    buf.append(line.c_str());
+  buf.undo_budget(20000);
+  // remove every other line, each removal is a separate undo action
+  for (int i = 99; i > 0; i -= 2)
+    buf.remove(i * 1000, i * 1000 + 1000);
+  EXPECT_EQ(buf.length(), 50000);
+  EXPECT_TRUE(buf.undo_bytes() <= 20000);
+  int n = 0;
+  while (buf.undo()) n++;
+  EXPECT_TRUE(n > 0 && n < 50);
+  // removing characters after the cursor is undone in a single step
+  buf.text("hello world");
+  for (int i = 0; i < 6; i++)
+    buf.remove(0, 1);
+  EXPECT_TRUE(buf.undo());
+  char *text = buf.text();
+  EXPECT_STREQ(text, "hello world");
+  free(text);
+  EXPECT_TRUE(!buf.can_undo());
+  return true;
+}
+
+TEST(Fl_Text_Buffer, Async) {
+  struct Result {
+    int status, calls;
+    static void cb(Fl_Text_Buffer *, int status, double, void *arg) {
+      Result *r = (Result*)arg;
+      r->calls++;
+      if (status >= 0) r->status = status;
+    }
+    // waits for the result, but not forever
+    void wait() {
+      time_t start = time(NULL);
+      while (status < 0 && time(NULL) - start < 10) Fl::wait(0.1);
+    }
+  };
+  // removes the file when the test returns, after the buffers closed it
+  struct Remove {
+    const char *name;
+    ~Remove() { fl_unlink(name); }
+  };
+  const char *name = "unittest_async.txt";
+  Remove cleanup = { name };
+  Fl_Text_Buffer src, buf;
+  std::string line(99, 'x');
+  line += '\n';
+  for (int i = 0; i < 2000; i++)
+    src.append(line.c_str());
+  Result r = { -1, 0 };
+  EXPECT_EQ(src.savefile_async(name, Result::cb, &r, 4096), 0);
+  EXPECT_TRUE(src.async_pending());
+  r.wait();
+  EXPECT_EQ(r.status, 0);
+  EXPECT_TRUE(!src.async_pending());
+  r.status = -1; r.calls = 0;
+  buf.text("old text");
+  buf.transcoding_warning_action = NULL;
+  EXPECT_EQ(buf.loadfile_async(name, Result::cb, &r, 4096), 0);
+  r.wait();
+  EXPECT_EQ(r.status, 0);
+  EXPECT_TRUE(r.calls > 1);
+  EXPECT_EQ(buf.length(), src.length());
+  EXPECT_EQ(buf.input_file_was_transcoded, 0);
+  char *a = src.text(), *b = buf.text();
+  EXPECT_STREQ(a, b);
+  free(a);
+  free(b);
+  // cancelling reports the status right away
+  r.status = -1;
+  EXPECT_EQ(buf.loadfile_async(name, Result::cb, &r, 4096), 0);
+  buf.cancel_async();
+  EXPECT_EQ(r.status, 3);
+  EXPECT_TRUE(!buf.async_pending());
+  EXPECT_EQ(buf.loadfile_async("does/not/exist.txt", Result::cb, &r), 1);
+  return true;
+}
+
+TEST(Fl_Text_Buffer, MapFile) {
+  struct Remove {
+    const char *name;
+    ~Remove() { fl_unlink(name); }
+  };
+  const char *name = "unittest_mapfile.txt";
+  Remove cleanup = { name };
+  std::string model;
+  char line[40];
+  for (int i = 0; i < 5000; i++) {
+    snprintf(line, sizeof(line), "line %d \xc3\xa9t\xc3\xa9\n", i);
+    model += line;
+  }
+  Fl_Text_Buffer src, buf;
+  buf.transcoding_warning_action = NULL;
+  src.text(model.c_str());
+  EXPECT_EQ(src.savefile(name), 0);
+  EXPECT_EQ(buf.mapfile(name), 0);
+  EXPECT_EQ(buf.input_file_was_transcoded, 0);
+  std::string text = buf.text_str();
+  EXPECT_TRUE(text == model);
+  int pos = (int)model.find("line 2500 ");
+  EXPECT_EQ(buf.skip_lines(0, 2500), pos);
+  EXPECT_EQ(buf.line_start(pos + 7), pos);
+  EXPECT_EQ(buf.count_lines(0, buf.length()), 5000);
+  // edits copy the mapped text, the file is not modified
+  buf.insert(pos, "new ");
+  model.insert(pos, "new ");
+  buf.remove(0, 14);
+  model.erase(0, 14);
+  buf.append("end");
+  model += "end";
+  text = buf.text_str();
+  EXPECT_TRUE(text == model);
+  EXPECT_EQ(src.loadfile(name), 0);
+  EXPECT_EQ(src.length(), (int)model.size() + 14 - 4 - 3);
+  // text that is not UTF-8 is loaded and transcoded
+  src.text("caf\xe9 au lait\n");
+  EXPECT_EQ(src.savefile(name), 0);
+  EXPECT_EQ(buf.mapfile(name), 0);
+  EXPECT_EQ(buf.input_file_was_transcoded, 1);
+  text = buf.text_str();
+  EXPECT_TRUE(text == "caf\xc3\xa9 au lait\n");
+  return true;
+}
+
+TEST(Fl_Text_Regex, Search) {
+  Fl_Text_Buffer buf;
+  buf.text("Error 12 in line 3\nwarning: x = 0x1f\n\xc3\xa9t\xc3\xa9 ERROR 7\n");
+  // move the gap into the middle of the text
+  buf.insert(20, "w");
+  buf.remove(20, 21);
+  int start = -1, end = -1;
+  Fl_Text_Regex re("error +[0-9]+", Fl_Text_Regex::IGNORE_CASE);
+  EXPECT_TRUE(re.compiled());
+  EXPECT_EQ(re.search_forward(&buf, 0, &start, &end), 1);
+  EXPECT_EQ(start, 0);
+  EXPECT_EQ(end, 8);
+  EXPECT_EQ(re.search_forward(&buf, 1, &start, &end), 1);
+  EXPECT_EQ(start, 43);
+  EXPECT_EQ(end, 50);
+  EXPECT_EQ(re.search_backward(&buf, 42, &start, &end), 1);
+  EXPECT_EQ(start, 0);
+  // a search limited to a range of start positions
+  EXPECT_EQ(re.search_forward(&buf, 1, &start, &end, 43), 0);
+  std::vector<int> starts, ends;
+  EXPECT_EQ(re.find_all(&buf, starts, ends), 2);
+  re.compile("^[^ ]+:|\\b0x[0-9a-f]+\\b|^\xc3\xa9.\xc3\xa9");
+  EXPECT_TRUE(re.compiled());
+  EXPECT_EQ(re.find_all(&buf, starts, ends), 3);
+  EXPECT_EQ(starts[0], 19);
+  EXPECT_EQ(ends[0], 27);
+  EXPECT_EQ(starts[1], 32);
+  EXPECT_EQ(ends[1], 36);
+  EXPECT_EQ(starts[2], 37);
+  EXPECT_EQ(ends[2], 42);
+  // the same search in a string instead of a buffer
+  const char *line = "warning: x = 0x1f";
+  EXPECT_EQ(re.search_forward(line, 17, 0, &start, &end), 1);
+  EXPECT_EQ(start, 0);
+  EXPECT_EQ(end, 8);
+  EXPECT_EQ(re.search_backward(line, 17, 17, &start, &end), 1);
+  EXPECT_EQ(start, 13);
+  EXPECT_EQ(end, 17);
+  EXPECT_EQ(re.search_forward(line, 12, 1, &start, &end), 0);
+  EXPECT_EQ(re.compile("(a|b"), -1);
+  EXPECT_TRUE(!re.compiled());
+  EXPECT_TRUE(re.error() != NULL);
+  std::string stacked = "a" + std::string(100000, '?');
+  EXPECT_EQ(re.compile(stacked.c_str()), -1);
+  EXPECT_TRUE(re.error() != NULL);
+  return true;
+}
+
+/* Test that a limited regex search neither reports nor looks for matches past its limit. */
+TEST(Fl_Text_Regex, Limit) {
+  Fl_Text_Buffer buf;
+  std::string text(16 * 1024 * 1024, 'x');
+  text.replace(100, 7, "error 1");
+  text.replace(text.size() - 7, 7, "error 2");
+  buf.text(text.c_str());
+  Fl_Text_Regex re("error [0-9]");
+  int start = -1, end = -1;
+  EXPECT_EQ(re.search_forward(&buf, 0, &start, &end, 101), 1);   // starts before the limit
+  EXPECT_EQ(start, 100);
+  EXPECT_EQ(re.search_forward(&buf, 0, &start, &end, 100), 0);   // starts at the limit
+  EXPECT_EQ(re.search_backward(&buf, 1000, &start, &end, 100), 1);
+  EXPECT_EQ(start, 100);
+  EXPECT_EQ(re.search_backward(&buf, 1000, &start, &end, 101), 0);
+  // searching in slices must not scan the rest of the buffer for every slice
+  clock_t t0 = clock();
+  int found = 0;
+  for (int pos = 1024; pos < buf.length(); pos += 1024)
+    found += re.search_forward(&buf, pos, &start, &end, pos + 1024);
+  for (int pos = buf.length() - 1024; pos > 1024; pos -= 1024)
+    found += re.search_backward(&buf, pos, &start, &end, pos - 1024 + 1);
+  double secs = double(clock() - t0) / CLOCKS_PER_SEC;
+  EXPECT_EQ(found, 1);
+  EXPECT_EQ(start, int(text.size()) - 7);
+  EXPECT_TRUE(secs < 2.0);
+  return true;
+}
+
+/* A text display that is measured without a window, and the uncached way
+   to count its wrapped lines. */
+class Ut_Text_Display : public Fl_Text_Display {
+public:
+  Ut_Text_Display(Fl_Text_Buffer *buf) : Fl_Text_Display(0, 0, 400, 300) {
+    end();
+    buffer(buf);
+  }
+  using Fl_Text_Display::highlight_slice;
+  using Fl_Text_Display::string_width;
+  using Fl_Text_Display::longest_line;
+  // measure the lines of the width cache that are unknown, as idle time would
+  void measure_line_widths() {
+    longest_line();                     // updates the cache after edits
+    while (Fl::has_idle(width_cache_idle_cb, this))
+      width_cache_idle_cb(this);
+  }
+  // width of the longest buffer line
+  int measured_longest_line() const {
+    int longest = 0;
+    for (int pos = 0; ; ) {
+      int end = buffer()->line_end(pos);
+      if (end > pos) {
+        int w = handle_vline(GET_WIDTH, pos, end - pos, 0, 0, 0, 0, 0, 0);
+        if (w > longest) longest = w;
+      }
+      if (end >= buffer()->length()) return longest;
+      pos = end + 1;
+    }
+  }
+  // width of a string in a style, measured without the advance cache
+  double measured_width(const char *s, int n, int style) const {
+    if (style) fl_font(mStyleTable[style - 'A'].font, mStyleTable[style - 'A'].size);
+    else fl_font(textfont(), textsize());
+    return fl_width(s, n);
+  }
+  // 1 if all strings have the same width with and without the advance cache
+  int same_widths() const {
+    static const char *strings[] = { "a", "W", "\xc3\xa9", "\t", "lorem ipsum",
+                                     "Wm i.i", "Caf\xc3\xa9", "" };
+    static const int styles[] = { 0, 'A', 'B', 'C', 'D' };
+    for (int i = 0; strings[i][0]; i++) {
+      for (int j = 0; j < 5; j++) {
+        int n = (int)strlen(strings[i]);
+        double d = string_width(strings[i], n, styles[j]) - measured_width(strings[i], n, styles[j]);
+        if (d > 1e-9 || d < -1e-9) return 0;
+      }
+    }
+    return 1;
+  }
+  // measure the lines of the wrap cache that are estimated, as idle time would
+  void measure_wrapped_lines() {
+    while (Fl::has_idle(wrap_cache_idle_cb, this))
+      wrap_cache_idle_cb(this);
+  }
+  // visual lines from the start of the buffer to 'pos'
+  int wrapped_lines(int pos) const {
+    int retPos, retLines, retLineStart, retLineEnd;
+    wrapped_line_counter(buffer(), 0, pos, INT_MAX, true, 0,
+                         &retPos, &retLines, &retLineStart, &retLineEnd);
+    return retLines;
+  }
+  // start of visual line 'n'
+  int wrapped_skip(int n) const {
+    int retPos, retLines, retLineStart, retLineEnd;
+    wrapped_line_counter(buffer(), 0, buffer()->length(), n, true, 0,
+                         &retPos, &retLines, &retLineStart, &retLineEnd);
+    return retPos;
+  }
+};
+
+static const Fl_Text_Display::Style_Table_Entry ut_styles[] = {
+  { FL_BLACK, FL_HELVETICA,      14, 0, 0 },    // A - text
+  { FL_BLACK, FL_HELVETICA_BOLD, 20, 0, 0 },    // B - capitals
+  { FL_BLACK, FL_COURIER,        14, 0, 0 },    // C - comment
+  { FL_BLACK, FL_COURIER,        14, 0, 0 }     // D - end of comment
+};
+
+/* Styles capitals 'B' and C comments 'C', ending with 'D'. Comments span
+   lines, so the style of a line depends on the text in front of it. */
+static void ut_highlight_cb(const char *text, char *style, int length,
+                            char context, void *) {
+  bool comment = (context == 'C');
+  for (int i = 0; i < length; i++) {
+    if (comment && text[i] == '*' && i+1 < length && text[i+1] == '/') {
+      style[i] = style[i+1] = 'D';
+      comment = false;
+      i++;
+    } else if (!comment && text[i] == '/' && i+1 < length && text[i+1] == '*') {
+      style[i] = style[i+1] = 'C';
+      comment = true;
+      i++;
+    } else {
+      style[i] = comment ? 'C' : (text[i] >= 'A' && text[i] <= 'Z') ? 'B' : 'A';
+    }
+  }
+}
+
+/* Random edits of a text with lines of different lengths and styles. */
+class Ut_Text_Edits {
+  unsigned seed;
+  unsigned random(unsigned n) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % n;
+  }
+public:
+  Fl_Text_Buffer text, style;
+  Ut_Text_Edits() : seed(1) {
+    static const char *words[] = { "lorem ", "ipsum ", "Wm ", "i.i ", "WIDE ", "\t" };
+    std::string s;
+    for (int i = 0; i < 400; i++) {
+      for (int n = random(40); n > 0; n--) s += words[random(6)];
+      s += "\n";
+    }
+    text.text(s.c_str());
+  }
+  void edit() {
+    static const char *inserts[] = { "Wm WORDS here ", "\n", "/*", "*/",
+                                     "iii lll\nnext Line\n", "\t\tTAB",
+                                     "Caf\xc3\xa9 /* \xc3\xa9 */ " };
+    int pos = text.utf8_align(random(text.length() + 1));
+    if (random(3) == 0) text.remove(pos, text.utf8_align(pos + random(300)));
+    else text.insert(pos, inserts[random(7)]);
+  }
+  // the styles of the text, styled all at once
+  std::string expected_style() {
+    char *t = text.text();
+    std::string s(text.length(), 'A');
+    if (!s.empty()) ut_highlight_cb(t, &s[0], text.length(), 0, 0);
+    free(t);
+    return s;
+  }
+  std::string style_text() {
+    char *t = style.text();
+    std::string s(t);
+    free(t);
+    return s;
+  }
+};
+
+/* Test that the wrap cache counts and skips the same lines as counting them
+   from the start of the buffer, after edits and changes of the styles. */
+TEST(Fl_Text_Display, WrapCache) {
+  Ut_Null_Drawing drawing;
+  Ut_Text_Edits edits;
+  Ut_Text_Display display(&edits.text);
+  display.highlight_data(&edits.style, ut_styles, 4, 'A', 0, 0);
+  display.highlight_engine(ut_highlight_cb);
+  display.wrap_mode(Fl_Text_Display::WRAP_AT_BOUNDS, 0);
+  display.recalc_display();             // lay out the text area
+  for (int step = 0; step < 40; step++) {
+    if (step) edits.edit();
+    while (display.highlight_slice()) { }
+    int length = edits.text.length();
+    EXPECT_TRUE(length > 16384);        // large enough to be cached
+    // lines not measured yet are estimated, consistently
+    int estimated = display.count_lines(0, length, true);
+    for (int n = 100; n < estimated; n += estimated / 5) {
+      EXPECT_EQ(display.count_lines(0, display.skip_lines(0, n, true), true), n);
+    }
+    display.measure_wrapped_lines();
+    for (int pos = 0; pos <= length; pos += length / 7 + 1) {
+      EXPECT_EQ(display.count_lines(0, pos, true), display.wrapped_lines(pos));
+    }
+    EXPECT_EQ(display.count_lines(0, length, true), display.wrapped_lines(length));
+    int nLines = display.wrapped_lines(length);
+    for (int n = 100; n < nLines; n += nLines / 5) {
+      EXPECT_EQ(display.skip_lines(0, n, true), display.wrapped_skip(n));
+    }
+  }
+  return true;
+}
+
+/* Test that the highlight engine restyles edited text, and text styled in
+   view ahead of the rest, the same as styling all text at once. */
+TEST(Fl_Text_Display, Highlight) {
+  Ut_Null_Drawing drawing;
+  Ut_Text_Edits edits;
+  Ut_Text_Display display(&edits.text);
+  display.highlight_data(&edits.style, ut_styles, 4, 'A', 0, 0);
+  edits.style.canUndo(1);                 // styling is never undone
+  display.highlight_engine(ut_highlight_cb);
+  display.recalc_display();
+  for (int step = 0; step < 40; step++) {
+    if (step % 10 == 5) {                 // restyle all text below the view
+      display.scroll(350, 0);
+      display.recalc_display();
+      edits.text.insert(0, step % 20 == 5 ? "/*" : "*/");
+    } else if (step) {
+      edits.edit();
+    }
+    if (step % 10 == 6) {
+      display.scroll(1, 0);
+      display.recalc_display();
+    }
+    while (display.highlight_slice()) { }
+    EXPECT_EQ(edits.style.length(), edits.text.length());
+    EXPECT_TRUE(edits.style_text() == edits.expected_style());
+  }
+  EXPECT_TRUE(!edits.style.can_undo());
+  return true;
+}
+
+/* Test that the advance cache measures text the same as the font backend,
+   after the styles or the graphics driver changed, and that it is used. */
+TEST(Fl_Text_Display, Advances) {
+  Ut_Null_Drawing drawing;
+  Fl_Text_Buffer text, style;
+  Ut_Text_Display display(&text);
+  display.highlight_data(&style, ut_styles, 4, 'A', 0, 0);
+  EXPECT_TRUE(display.same_widths());
+  // measured once: single characters, and ASCII runs in monospaced fonts
+  int measured = drawing.driver().measured;
+  EXPECT_EQ(display.string_width("a", 1, 'A'), 0.5 * 14);
+  EXPECT_EQ(display.string_width("\xc3\xa9", 2, 'B'), 0.5 * 20);
+  EXPECT_EQ(display.string_width("lorem ipsum", 11, 'C'), 11 * 0.625 * 14);
+  EXPECT_EQ(drawing.driver().measured, measured);
+  // the measured font is selected for drawing, also from the cache
+  display.string_width("\xc3\xa9", 2, 'B');
+  EXPECT_EQ(fl_font(), FL_HELVETICA_BOLD);
+  EXPECT_EQ(fl_size(), 20);
+  // styles in other fonts and sizes
+  Fl_Text_Display::Style_Table_Entry bigger[4];
+  for (int i = 0; i < 4; i++) {
+    bigger[i] = ut_styles[i];
+    bigger[i].size += 6;
+  }
+  bigger[0].font = FL_COURIER;
+  display.highlight_data(&style, bigger, 4, 'A', 0, 0);
+  EXPECT_TRUE(display.same_widths());
+  display.textsize(9);
+  EXPECT_TRUE(display.same_widths());
+  // other graphics drivers have their own metrics
+  {
+    Ut_Null_Drawing wide(2.0);
+    EXPECT_TRUE(display.same_widths());
+    EXPECT_EQ(display.string_width("a", 1, 'B'), 2 * 0.5 * 26);
+  }
+  EXPECT_TRUE(display.same_widths());
+  return true;
+}
+
+/* Test that the width cache knows the longest line after edits and changes
+   of the styles, the same as measuring every line. */
+TEST(Fl_Text_Display, WidthCache) {
+  Ut_Null_Drawing drawing;
+  Ut_Text_Edits edits;
+  Ut_Text_Display display(&edits.text);
+  display.highlight_data(&edits.style, ut_styles, 4, 'A', 0, 0);
+  display.highlight_engine(ut_highlight_cb);
+  display.recalc_display();
+  for (int step = 0; step < 40; step++) {
+    if (step % 10 == 5) {                 // restyle all text below
+      edits.text.insert(0, step % 20 == 5 ? "/*" : "*/");
+    } else if (step) {
+      edits.edit();
+    }
+    if (step % 10 == 7) {                 // remove the line with most bytes
+      int pos = 0, longest = 0, longest_pos = 0;
+      for (; pos < edits.text.length(); pos = edits.text.line_end(pos) + 1) {
+        int n = edits.text.line_end(pos) - pos;
+        if (n > longest) { longest = n; longest_pos = pos; }
+      }
+      edits.text.remove(longest_pos, longest_pos + longest);
+    }
+    while (display.highlight_slice()) { }
+    display.measure_line_widths();
+    EXPECT_EQ(display.longest_line(), display.measured_longest_line());
+  }
+  return true;
+}
+
+TEST(Fl_Tree, FindItem) {
+  Fl_Tree tree(0, 0, 200, 200);
+  tree.end();
+  char path[40];
+  for (int i = 0; i < 200; i++) {       // enough children to be indexed
+    snprintf(path, sizeof(path), "dir/item %d", i);
+    EXPECT_TRUE(tree.add(path) != NULL);
+  }
+  EXPECT_TRUE(tree.add("dir/item 7") == NULL);
+  Fl_Tree_Item *dir = tree.find_item("dir");
+  EXPECT_TRUE(dir != NULL);
+  EXPECT_EQ(dir->children(), 200);
+  EXPECT_EQ(dir->find_child("item 150"), 150);
+  EXPECT_STREQ(tree.find_item("dir/item 99")->label(), "item 99");
+  EXPECT_TRUE(tree.find_item("dir/item 200") == NULL);
+  // changes to the children are found
+  dir->child(10)->label("renamed");
+  EXPECT_TRUE(tree.find_item("dir/item 10") == NULL);
+  EXPECT_TRUE(tree.find_item("dir/renamed") == dir->child(10));
+  EXPECT_EQ(dir->remove_child("item 20"), 0);
+  EXPECT_TRUE(tree.find_item("dir/item 20") == NULL);
+  EXPECT_EQ(dir->find_child("item 21"), 20);
+  // the first of several items with the same label is found
+  dir->insert(tree.prefs(), "item 50", 0);
+  EXPECT_EQ(dir->find_child("item 50"), 0);
+  Fl_Tree_Item *item = tree.find_item("dir/item 60");
+  item->move_into(tree.root());
+  EXPECT_TRUE(tree.find_item("dir/item 60") == NULL);
+  EXPECT_TRUE(tree.find_item("item 60") == item);
+  return true;
+}
+
+static void populate_cb(Fl_Tree_Item *item, void *data) {
+  ++*(int*)data;
+  if (strcmp(item->label(), "empty") == 0) return;
+  Fl_Tree_Item *child = item->tree()->add(item, "child");
+  child->close();
+  child->children_pending(1);
+}
+
+TEST(Fl_Tree, Populate) {
+  Fl_Tree tree(0, 0, 200, 200);
+  tree.end();
+  int calls = 0;
+  tree.item_populate_callback(populate_cb, &calls);
+  Fl_Tree_Item *item = tree.add("item");
+  Fl_Tree_Item *empty = tree.add("empty");
+  item->close();
+  empty->close();
+  item->children_pending(1);
+  empty->children_pending(1);
+  EXPECT_EQ(item->children(), 0);
+  // opening adds the children once
+  tree.open(item);
+  EXPECT_EQ(calls, 1);
+  EXPECT_TRUE(!item->children_pending());
+  EXPECT_TRUE(tree.find_item("item/child") != NULL);
+  EXPECT_TRUE(tree.find_item("item/child")->children_pending() != 0);
+  tree.close(item);
+  tree.open(item);
+  EXPECT_EQ(calls, 1);
+  EXPECT_EQ(item->children(), 1);
+  // no children to add: no longer pending
+  tree.open(empty);
+  EXPECT_EQ(calls, 2);
+  EXPECT_TRUE(!empty->children_pending());
+  EXPECT_EQ(empty->children(), 0);
+  // released when closed, added again when opened
+  tree.release_closed_children(1);
+  tree.close(item);
+  EXPECT_EQ(item->children(), 0);
+  EXPECT_TRUE(item->children_pending() != 0);
+  tree.open(item);
+  EXPECT_EQ(calls, 3);
+  EXPECT_EQ(item->children(), 1);
+  return true;
+}
+
+class Ut_Draw_Tree : public Fl_Tree {
+public:
+  Ut_Draw_Tree() : Fl_Tree(0, 0, 200, 200) { end(); }
+  void draw_tree() {                    // needs a Ut_Null_Drawing
+    draw();
+    clear_damage();
+  }
+  // the position of the items that are shown, and the scroll ranges.
+  // (w() is left out: draw() and calc_tree() give the root different widths)
+  std::vector<int> geometry() {
+    std::vector<int> g;
+    for (Fl_Tree_Item *item = first(); item; item = next(item)) {
+      if (!item->is_visible_r()) continue;
+      g.push_back(item->x()); g.push_back(item->y()); g.push_back(item->h());
+    }
+    g.push_back(int(_vscroll->maximum()));
+    g.push_back(int(_hscroll->maximum()));
+    return g;
+  }
+};
+
+/* Test that draw() skipping offscreen subtrees, calc_tree() and the item
+   positions calculated when asked agree with a walk of the entire tree. */
+TEST(Fl_Tree, DrawSkip) {
+  Ut_Null_Drawing drawing;
+  Ut_Draw_Tree tree;
+  std::vector<Fl_Tree_Item*> items;
+  char name[20];
+  for (int i = 0; i < 150; i++) {
+    snprintf(name, sizeof(name), "d%d/s%d/item %d", i % 5, i % 7, i);
+    items.push_back(tree.add(name));
+  }
+  for (Fl_Tree_Item *item = tree.first(); item; item = tree.next(item))
+    if (item->has_children()) items.push_back(item);
+  unsigned seed = 1;
+  for (int step = 0; step < 300; step++) {
+    seed = seed * 1103515245 + 12345;
+    unsigned r = seed >> 8;
+    Fl_Tree_Item *item = items[(r / 8) % items.size()];
+    switch (r % 8) {
+      case 0: case 1: item->open(); break;
+      case 2:         item->close(); break;
+      case 3:         snprintf(name, sizeof(name), "new %d", step);
+                      items.push_back(tree.add(item, name)); break;
+      case 4:         item->labelsize(10 + r % 11); break;
+      case 5:         item->label(step % 2 ? "Wide Wide Wide" : "i"); break;
+      case 6:         tree.vposition(int(r % 2000)); break;
+      case 7:         tree.linespacing(tree.linespacing() ? 0 : 2); break;
+    }
+    tree.draw_tree();
+    std::vector<int> cached = tree.geometry();
+    tree.recalc_tree();
+    tree.calc_tree();                   // walks every item that is shown
+    std::vector<int> full = tree.geometry();
+    EXPECT_TRUE(cached == full);
+  }
+  return true;
+}
+
+static void populate_open_cb(Fl_Tree_Item *item, void *data) {
+  int &calls = *(int*)data;
+  char name[20];
+  snprintf(name, sizeof(name), "other %d", ++calls);
+  item->tree()->add(name);              // changes the tree while it is populated
+  if (item->depth() >= 3) return;
+  Fl_Tree_Item *child = item->tree()->add(item, "child");
+  child->open();
+  child->children_pending(1);           // open and pending: added when drawn
+}
+
+/* Test that drawing populates the open items in view, outside the draw walk. */
+TEST(Fl_Tree, PopulateDraw) {
+  Ut_Null_Drawing drawing;              // item positions measure the labels
+  Ut_Draw_Tree tree;
+  int calls = 0;
+  tree.item_populate_callback(populate_open_cb, &calls);
+  Fl_Tree_Item *item = tree.add("item");
+  item->open();
+  item->children_pending(1);
+  char name[20];
+  for (int i = 0; i < 50; i++) {        // push the next item out of view
+    snprintf(name, sizeof(name), "filler %d", i);
+    tree.add(name);
+  }
+  Fl_Tree_Item *far = tree.add("far");
+  far->open();
+  far->children_pending(1);
+  tree.draw_tree();
+  EXPECT_EQ(calls, 3);                  // item, item/child, item/child/child
+  EXPECT_TRUE(tree.find_item("item/child/child") != NULL);
+  EXPECT_TRUE(!tree.find_item("item/child/child")->children_pending());
+  EXPECT_TRUE(tree.find_item("other 3") != NULL);
+  EXPECT_TRUE(far->children_pending() != 0);
+  EXPECT_EQ(far->children(), 0);
+  // the positions include the added items
+  Fl_Tree_Item *other = tree.find_item("other 1");
+  EXPECT_EQ(other->y(), far->y() + far->h() + tree.linespacing());
+  EXPECT_EQ(tree.find_item("other 3")->y(), other->y() + 2 * (other->h() + tree.linespacing()));
+  // scrolled into view: populated by the next draw
+  tree.show_item_top(far);
+  tree.draw_tree();
+  EXPECT_EQ(calls, 6);
+  EXPECT_TRUE(tree.find_item("far/child/child") != NULL);
+  return true;
+}
+
 #if 0
 
 TEST(fl_filename, ext) {
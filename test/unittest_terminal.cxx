@@ -14,11 +14,28 @@
 //     https://www.fltk.org/bugs.php
 //
 
+#include <config.h>
 #include "unittests.h"
 
 #include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <FL/Fl_Group.H>
 #include <FL/Fl_Terminal.H>
+#include <FL/fl_utf8.h>
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#if defined(HAVE_PTHREAD) || defined(_WIN32)
+#  include "threads.h"
+#endif
+
+#if defined(HAVE_PTHREAD) && !defined(_WIN32)
+#  include <unistd.h>                       // usleep()
+#endif
 
 //
 //------- test the Fl_Terminal drawing capabilities ----------
@@ -96,3 +113,351 @@ public:
 };
 
 UnitTest simple_terminal(UT_TEST_SIMPLE_TERMINAL, "Terminal", Ut_Terminal_Test::create);
+
+//
+//------- test the Fl_Terminal append() throughput ----------
+//
+// Appends a large build log and compares the result with the same text
+// printed one character at a time with print_char(), which does not use
+// the bulk ASCII path of append(). Both throughputs are reported.
+//
+static double ut_terminal_mbps(size_t bytes, clock_t start) {
+  double secs = double(clock() - start) / CLOCKS_PER_SEC;
+  return secs > 0.0 ? (bytes / (1024.0 * 1024.0)) / secs : 0.0;
+}
+
+TEST(Fl_Terminal, AppendThroughput) {
+  std::string log;
+  char line[200];
+  for (int i = 0; log.size() < 4 * 1024 * 1024; i++) {
+    snprintf(line, sizeof(line),
+             "[%5d/99999] g++ -O2 -Wall -I../include -c src/module_%d.cxx -o obj/module_%d.o\n",
+             i, i, i);
+    log += line;
+    if (i % 16 == 0) log += "\033[1;32mok\033[0m ~ warning: unused variable \xc3\xa4\n";
+  }
+
+  Fl_Terminal fast(0, 0, 600, 400, 0, 24, 80, 1000);
+  Fl_Terminal slow(0, 0, 600, 400, 0, 24, 80, 1000);
+  fast.redraw_style(Fl_Terminal::NO_REDRAW);
+  slow.redraw_style(Fl_Terminal::NO_REDRAW);
+
+  clock_t start = clock();
+  for (size_t i = 0; i < log.size(); i += 4096) {    // block writes, as from a pipe
+    size_t n = log.size() - i < 4096 ? log.size() - i : 4096;
+    fast.append(log.data() + i, int(n));
+  }
+  double fast_mbps = ut_terminal_mbps(log.size(), start);
+
+  start = clock();
+  for (const char *p = log.c_str(); *p; ) {
+    int len = fl_utf8len(*p);
+    slow.print_char(p, len);
+    p += len;
+  }
+  double slow_mbps = ut_terminal_mbps(log.size(), start);
+
+  Ut_Suite::printf("  append(): %.1f MB/s, print_char(): %.1f MB/s\n", fast_mbps, slow_mbps);
+
+  char *fast_text = (char*)fast.text();
+  char *slow_text = (char*)slow.text();
+  std::string a(fast_text), b(slow_text);
+  free(fast_text);
+  free(slow_text);
+  EXPECT_TRUE(a == b);
+  EXPECT_EQ(fast.cursor_row(), slow.cursor_row());
+  EXPECT_EQ(fast.cursor_col(), slow.cursor_col());
+  return true;
+}
+
+//
+//------- test the Fl_Terminal search ----------
+//
+// Searches a terminal whose output has scrolled well into the history,
+// with literal text and regular expressions, forward and backward,
+// checking each match through the selection it makes.
+//
+static std::string ut_terminal_selection(Fl_Terminal &term) {
+  char *text = (char*)term.selection_text();
+  std::string ret(text ? text : "");
+  free(text);
+  return ret;
+}
+
+TEST(Fl_Terminal, Search) {
+  Fl_Terminal term(0, 0, 600, 400, 0, 24, 80, 100);
+  term.redraw_style(Fl_Terminal::NO_REDRAW);
+  for (int i = 0; i < 110; i++) {
+    if (i == 5)        term.append("Error: disk full\n");
+    else if (i == 100) term.append("error: disk 0x1f again\n");
+    else               term.printf("line %d: ok\n", i);
+  }
+  int row, scol, ecol;
+
+  // Literal text: '.' is not special, and case matters
+  EXPECT_EQ(term.search("k f"), 0);
+  EXPECT_TRUE(term.search_forward());
+  EXPECT_TRUE(term.search_match(row, scol, ecol));
+  EXPECT_EQ(scol, 10);
+  EXPECT_EQ(ecol, 12);
+  EXPECT_TRUE(ut_terminal_selection(term) == "k f");
+  EXPECT_TRUE(!term.search_forward());             // no more matches
+  EXPECT_EQ(term.search("disk."), 0);
+  EXPECT_TRUE(!term.search_forward());
+
+  // Ignore case, forward from the top of the history, then backward
+  EXPECT_EQ(term.search("error", Fl_Terminal::SEARCH_IGNORE_CASE), 0);
+  EXPECT_TRUE(term.search_forward());
+  EXPECT_TRUE(ut_terminal_selection(term) == "Error");
+  int first_row = 0;
+  term.search_match(first_row, scol, ecol);
+  EXPECT_TRUE(term.search_forward());
+  EXPECT_TRUE(ut_terminal_selection(term) == "error");
+  term.search_match(row, scol, ecol);
+  EXPECT_EQ(row - first_row, 95);
+  EXPECT_TRUE(!term.search_forward());
+  EXPECT_TRUE(term.search_backward());             // back to the first match
+  term.search_match(row, scol, ecol);
+  EXPECT_EQ(row, first_row);
+  EXPECT_TRUE(ut_terminal_selection(term) == "Error");
+  EXPECT_TRUE(term.scrollbar->value() > 0);        // scrolled back to show it
+
+  // Regular expressions, starting at the bottom of the display
+  EXPECT_EQ(term.search("line 10[0-9]: ok$", Fl_Terminal::SEARCH_REGEX), 0);
+  EXPECT_TRUE(term.search_backward());
+  EXPECT_TRUE(ut_terminal_selection(term) == "line 109: ok");
+  EXPECT_TRUE(term.search_backward());
+  EXPECT_TRUE(ut_terminal_selection(term) == "line 108: ok");
+  EXPECT_EQ(term.search("0x[0-9a-f]+", Fl_Terminal::SEARCH_REGEX), 0);
+  EXPECT_TRUE(term.search_forward());
+  EXPECT_TRUE(ut_terminal_selection(term) == "0x1f");
+  EXPECT_EQ(term.search("(unbalanced", Fl_Terminal::SEARCH_REGEX), -1);
+  EXPECT_TRUE(!term.search_forward());
+  EXPECT_TRUE(!term.search_match(row, scol, ecol));
+  return true;
+}
+
+//
+//------- test the Fl_Terminal output queue ----------
+//
+// Queues more text than fits, without waiting, and lets the event loop
+// append it to the terminal, as it would for text from a worker thread.
+//
+static void ut_terminal_lock() {
+  static bool locked = false;               // the main thread locks only once
+  if (!locked) { Fl::lock(); locked = true; }
+}
+
+TEST(Fl_Terminal, Queue) {
+  ut_terminal_lock();
+  Fl_Terminal term(0, 0, 600, 400, 0, 24, 80, 100);
+  term.redraw_style(Fl_Terminal::NO_REDRAW);
+  EXPECT_EQ(term.queue_append("no queue"), -1);
+  term.queue_size(1000);
+  EXPECT_EQ(term.queue_size(), 1024);               // rounded up to a power of 2
+  std::string text;
+  for (int i = 0; i < 100; i++)
+    text += "queued \033[1mline\033[0m \xc3\xa4\n";
+  size_t done = 0;
+  while (done < text.size()) {
+    int n = term.queue_append(text.data() + done, int(text.size() - done), false);
+    EXPECT_TRUE(n >= 0 && n <= 1024);
+    done += n;
+    Fl::wait(0.01);
+  }
+  term.queue_size(0);                               // appends what's left
+  EXPECT_EQ(term.queue_size(), 0);
+  Fl_Terminal ref(0, 0, 600, 400, 0, 24, 80, 100);
+  ref.redraw_style(Fl_Terminal::NO_REDRAW);
+  ref.append(text.c_str());
+  char *a = (char*)term.text();
+  char *b = (char*)ref.text();
+  EXPECT_STREQ(a, b);
+  free(a);
+  free(b);
+  return true;
+}
+
+#if defined(HAVE_PTHREAD) || defined(_WIN32)
+
+//
+//------- test the Fl_Terminal output queue with a worker thread ----------
+//
+// A worker thread prints numbered lines in bursts through a small queue,
+// so it has to wait for room. Between the bursts it waits until the main
+// thread has shown everything, so the queue runs empty and the main thread
+// stops draining it, and the next burst has to wake it up. The lines must
+// arrive complete and in order.
+//
+struct Ut_Queue_Worker {
+  Fl_Terminal *term;
+  std::atomic<int> burst;                   // last burst the main thread has shown
+  std::atomic<int> done;                    // set when the worker is finished
+};
+
+extern "C" void *ut_queue_worker(void *data) {
+  Ut_Queue_Worker *w = (Ut_Queue_Worker*)data;
+  char s[32];
+  for (int b = 0; b < 3; b++) {
+    while (w->burst < b) {                  // wait for the previous burst
+#ifdef _WIN32
+      Sleep(1);
+#else
+      usleep(1000);
+#endif
+    }
+    for (int i = 0; i < 200; i++) {
+      snprintf(s, sizeof(s), "line %d\n", b * 200 + i);
+      w->term->queue_append(s);
+    }
+  }
+  w->done = 1;
+  return 0;
+}
+
+TEST(Fl_Terminal, QueueThread) {
+  ut_terminal_lock();
+  // on failure, both are leaked, because the worker may still use them
+  Fl_Terminal *term = new Fl_Terminal(0, 0, 600, 400, 0, 24, 80, 1000);
+  Ut_Queue_Worker *w = new Ut_Queue_Worker;
+  term->redraw_style(Fl_Terminal::NO_REDRAW);
+  term->queue_size(256);
+  w->term = term;
+  w->burst = 0;
+  w->done = 0;
+  Fl_Thread thread;
+  fl_create_thread(thread, ut_queue_worker, w);
+  time_t start = time(NULL);
+  char s[32];
+  while (!w->done && time(NULL) - start < 10) {
+    Fl::wait(0.05);
+    snprintf(s, sizeof(s), "line %d\n", w->burst * 200 + 199);
+    char *text = (char*)term->text(true);
+    if (strstr(text, s)) w->burst = w->burst + 1;
+    free(text);
+  }
+  EXPECT_TRUE(w->done != 0);                // else the main thread was not woken up
+  term->queue_size(0);
+  Fl_Terminal ref(0, 0, 600, 400, 0, 24, 80, 1000);
+  ref.redraw_style(Fl_Terminal::NO_REDRAW);
+  for (int i = 0; i < 600; i++) {
+    snprintf(s, sizeof(s), "line %d\n", i);
+    ref.append(s);
+  }
+  char *a = (char*)term->text();
+  char *b = (char*)ref.text();
+  EXPECT_STREQ(a, b);
+  free(a);
+  free(b);
+  delete term;
+  delete w;
+  return true;
+}
+
+#endif // HAVE_PTHREAD || _WIN32
+
+//
+//------- test resizing the Fl_Terminal ----------
+//
+// Resizing the columns and the history must keep all text that still fits.
+//
+TEST(Fl_Terminal, Resize) {
+  Fl_Terminal term(0, 0, 600, 400, 0, 24, 80, 100);
+  term.redraw_style(Fl_Terminal::NO_REDRAW);
+  char s[32];
+  for (int i = 0; i < 60; i++) {
+    snprintf(s, sizeof(s), "line %d\n", i);
+    term.append(s);
+  }
+  term.display_columns(120);
+  term.display_columns(40);
+  term.history_rows(500);
+  EXPECT_EQ(term.history_rows(), 500);
+  char *text = (char*)term.text(true);
+  for (int i = 0; i < 60; i++) {
+    snprintf(s, sizeof(s), "line %d\n", i);
+    EXPECT_TRUE(strstr(text, s) != 0);
+  }
+  free(text);
+  term.history_rows(5);                           // drops the oldest lines
+  text = (char*)term.text(true);
+  EXPECT_TRUE(strstr(text, "line 0\n") == 0);
+  EXPECT_TRUE(strstr(text, "line 59\n") != 0);
+  free(text);
+  return true;
+}
+
+//
+//------- test the Fl_Terminal partial redraw ----------
+//
+// Checks which rows are marked for redrawing after text is appended and
+// after the output scrolled, and which rows draw() then repaints. Drawing
+// goes to a Ut_Null_Driver that records the clip rectangles, and each row
+// is clipped to its own height, so no window is needed. With the driver's
+// font metrics, size 16 makes the cells 10 by 20 pixels.
+//
+class Ut_Dirty_Terminal : public Fl_Terminal {
+public:
+  Ut_Dirty_Terminal() : Fl_Terminal(0, 0, 80*10+30, 24*20+10, 0, 24, 80, 100) {
+    redraw_style(NO_REDRAW);
+    Ut_Null_Drawing drawing;                // measure the font without a display
+    textsize(16);
+  }
+  // number of display rows marked for redrawing
+  int dirty_count() const {
+    int n = 0;
+    for (int drow = 0; drow < dirty_rows().rows(); drow++)
+      if (dirty_rows().is_dirty(drow)) n++;
+    return n;
+  }
+  bool dirty(int drow, int scol, int ecol) const {
+    return dirty_rows().is_dirty(drow) &&
+           dirty_rows().scol(drow) == scol && dirty_rows().ecol(drow) == ecol;
+  }
+  bool all() const { return dirty_rows().all(); }
+  int scrolled() const { return dirty_rows().scrolled(); }
+  // draws the terminal, returns the display rows that were repainted
+  std::vector<int> draw_rows() {
+    Ut_Null_Drawing drawing;
+    drawing.driver().record_clips = true;
+    draw();
+    clear_damage();                         // as Fl::flush() would
+    std::vector<int> rows, drows;             // Y of each clip one row high
+    const std::vector<Fl_Rect> &clips = drawing.driver().clips;
+    for (size_t i = 0; i < clips.size(); i++)
+      if (clips[i].h() == 20) rows.push_back(clips[i].y());
+    for (size_t i = 0; i < rows.size(); i++)
+      drows.push_back((rows[i] - rows[0]) / 20);
+    return drows;
+  }
+};
+
+TEST(Fl_Terminal, DirtyRows) {
+  Ut_Dirty_Terminal term;
+  term.draw_rows();                         // first draw repaints everything
+  EXPECT_TRUE(!term.all());
+  EXPECT_EQ(term.dirty_count(), 0);
+  term.append("abc");
+  EXPECT_EQ(term.dirty_count(), 1);
+  EXPECT_TRUE(term.dirty(0, 0, 2));
+  std::vector<int> drows = term.draw_rows();
+  EXPECT_EQ((int)drows.size(), 1);          // just the row with the text and the cursor
+  EXPECT_TRUE(!term.all());
+  EXPECT_EQ(term.dirty_count(), 0);
+  for (int i = 0; i < 23; i++) term.append("\n");
+  EXPECT_EQ(term.dirty_count(), 0);         // only the cursor moved
+  drows = term.draw_rows();
+  EXPECT_EQ((int)drows.size(), 2);          // old and new cursor row
+  EXPECT_EQ(drows[1] - drows[0], 23);
+  // output that scrolls moves the marks up with their rows
+  term.append("x\ny");
+  EXPECT_EQ(term.scrolled(), 1);
+  EXPECT_TRUE(term.dirty(22, 0, 0));        // 'x' moved up one row
+  EXPECT_TRUE(term.dirty(23, 0, 0x7fffffff)); // the new row is redrawn entirely
+  EXPECT_EQ(term.dirty_count(), 2);
+  term.box(FL_FLAT_BOX);                    // fl_scroll() needs a window, redraw all instead
+  term.draw_rows();
+  EXPECT_EQ(term.scrolled(), 0);
+  EXPECT_EQ(term.dirty_count(), 0);
+  return true;
+}
@@ -19,8 +19,13 @@
 
 #include <FL/Fl.H>
 #include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Device.H>
+#include <FL/Fl_Graphics_Driver.H>
+#include <FL/Fl_Rect.H>
+#include <FL/fl_utf8.h>
 
 #include <stdarg.h>
+#include <vector>
 
 class Fl_Terminal;
 
@@ -246,6 +251,70 @@ public:
   Ut_Suite::run_all_tests()
 
 
+/**
+ A graphics driver that draws nothing, so that widgets can be drawn without
+ a window. Text is measured with fixed widths: narrow and wide letters
+ differ, as in most fonts, and FL_COURIER is monospaced. The driver counts
+ the calls that measure text and draw text and rectangles, and can record
+ the clip rectangles that are pushed.
+ */
+class Ut_Null_Driver : public Fl_Graphics_Driver {
+  double char_width(unsigned c) const {
+    if (font_ == FL_COURIER) return 0.625 * size_ * factor;
+    if (c == 'i' || c == 'l' || c == '.' || c == ' ') return 0.25 * size_ * factor;
+    if (c == 'W' || c == 'm') return 0.875 * size_ * factor;
+    return 0.5 * size_ * factor;
+  }
+public:
+  double factor;                            // scales all widths
+  int measured;                             // number of calls of width()
+  long texts, rects;                        // number of calls of draw() and rectf()
+  bool record_clips;                        // if set, push_clip() adds to clips
+  std::vector<Fl_Rect> clips;               // clip rectangles that were pushed
+  Ut_Null_Driver() : factor(1.0), measured(0), texts(0), rects(0), record_clips(false) { }
+  void font(Fl_Font f, Fl_Fontsize s) FL_OVERRIDE { font_ = f; size_ = s; }
+  Fl_Font font() FL_OVERRIDE { return font_; }
+  double width(const char *str, int n) FL_OVERRIDE {
+    measured++;
+    double w = 0;
+    for (int i = 0; i < n; ) {
+      int len;
+      w += char_width(fl_utf8decode(str + i, str + n, &len));
+      i += len;
+    }
+    return w;
+  }
+  double width(unsigned int c) FL_OVERRIDE { measured++; return char_width(c); }
+  int height() FL_OVERRIDE { return size_ + size_ / 4; }
+  int descent() FL_OVERRIDE { return size_ / 4; }
+  void draw(const char*, int, int, int) FL_OVERRIDE { texts++; }
+  void rectf(int, int, int, int) FL_OVERRIDE { rects++; }
+  void push_clip(int X, int Y, int W, int H) FL_OVERRIDE {
+    if (record_clips) clips.push_back(Fl_Rect(X, Y, W, H));
+  }
+  void push_no_clip() FL_OVERRIDE { }
+  void pop_clip() FL_OVERRIDE { }
+};
+
+/**
+ Makes a Ut_Null_Driver the current graphics driver while in scope.
+ The display driver is created, but the display is not opened.
+ */
+class Ut_Null_Drawing {
+  Ut_Null_Driver driver_;
+  Fl_Graphics_Driver *old_;
+public:
+  Ut_Null_Drawing(double factor = 1.0) {
+    Fl_Display_Device::display_device();    // create the display driver first
+    driver_.factor = factor;
+    old_ = fl_graphics_driver;
+    fl_graphics_driver = &driver_;
+  }
+  ~Ut_Null_Drawing() { fl_graphics_driver = old_; }
+  Ut_Null_Driver &driver() { return driver_; }
+};
+
+
 // The main window needs an additional drawing feature in order to support
 // the viewport alignment test.
 class Ut_Main_Window : public Fl_Double_Window {